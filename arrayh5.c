@@ -190,45 +190,88 @@ const char arrayh5_read_strerror[][100] = {
      "error opening data set in HDF file",
 };
 
-int arrayh5_read(arrayh5 *a, const char *fname, const char *datapath,
-		 char **dataname,
-		 int nslicedims_, const int *slicedim_, const int *islice_,
-		 const int *center_slice)
+/* Create *a for the data that read_slab reads, and return where the
+   data goes: a->data, or if fdata is not NULL a new array of floats
+   *fdata (with a->data NULL). */
+static void *create_slab(arrayh5 *a, int rank, const int *dims,
+			 float **fdata)
 {
-     hid_t file_id = -1, data_id = -1, space_id = -1;
-     char *dname = NULL;
-     int err = NO_ERROR;
-     hsize_t i, rank, *dims_copy, *maxdims, *slicedim = 0;
-     int *islice = 0;
-     int *dims = 0;
-     hsize_t nslicedims = (hsize_t) nslicedims_;
+     int i, N = 1;
 
-     CHECK(a, "NULL array passed to arrayh5_read");
-     a->dims = NULL;
+     if (!fdata) {
+	  *a = arrayh5_create(rank, dims);
+	  return a->data;
+     }
+     for (i = 0; i < rank; ++i)
+	  N *= dims[i];
+     CHK_MALLOC(*fdata, float, N);
+     *a = arrayh5_create_withdata(rank, dims, (double *) *fdata);
      a->data = NULL;
+     return *fdata;
+}
 
-     file_id = H5Fopen(fname, H5F_ACC_RDONLY, H5P_DEFAULT);
-     if (file_id < 0) {
-	  err = OPEN_FAILED;
-	  goto done;
-     }
+/* open the data set datapath (or the first data set, if datapath is
+   NULL or empty) of the file fname, opened with the file-access
+   properties fapl_id, returning its name in *dname */
+static int open_data(const char *fname, const char *datapath, hid_t fapl_id,
+		     hid_t *file_id, hid_t *data_id, char **dname)
+{
+     *data_id = -1;
+     *dname = NULL;
+
+     *file_id = H5Fopen(fname, H5F_ACC_RDONLY, fapl_id);
+     if (*file_id < 0)
+	  return OPEN_FAILED;
 
      if (datapath && datapath[0]) {
-	  CHK_MALLOC(dname, char, strlen(datapath) + 1);
-	  strcpy(dname, datapath);
+	  CHK_MALLOC(*dname, char, strlen(datapath) + 1);
+	  strcpy(*dname, datapath);
      }
      else {
-	  if (H5Giterate(file_id, "/", NULL, find_dataset, &dname) <= 0) {
-	       err = NO_DATA;
-	       goto done;
-	  }
+	  if (H5Giterate(*file_id, "/", NULL, find_dataset, dname) <= 0)
+	       return NO_DATA;
      }
 
-     data_id = H5Dopen(file_id, dname);
-     if (data_id < 0) {
-	  err = OPEN_DATA_FAILED;
-	  goto done;
+     *data_id = H5Dopen(*file_id, *dname);
+     if (*data_id < 0)
+	  return OPEN_DATA_FAILED;
+     return NO_ERROR;
+}
+
+/* read the data set data_id, or if banddim >= 0 just the elements
+   n0..n1-1 along dimension banddim of the sliced data (whose size is
+   returned in *n), or if stride is not NULL every stride[i]-th element
+   along each dimension i of the sliced data.  If fdata is not NULL and
+   the data is stored in single precision, it is read into *fdata (see
+   arrayh5_read_strided). */
+static int read_data_slab(hid_t data_id, arrayh5 *a, float **fdata,
+			  int nslicedims_, const int *slicedim_,
+			  const int *islice_, const int *center_slice,
+			  int banddim, int n0, int n1, int *n,
+			  const int *stride)
+{
+     hid_t space_id = -1, type_id, mem_type_id;
+     int err = NO_ERROR;
+     hsize_t i, rank, *dims_copy, *maxdims, *slicedim = 0;
+     int *islice = 0;
+     int *dims = 0;
+     hsize_t nslicedims = (hsize_t) nslicedims_;
+     void *data;
+
+     CHECK(a, "NULL array passed to arrayh5_read");
+     a->dims = NULL;
+     a->data = NULL;
+     if (fdata)
+	  *fdata = NULL;
+
+     if (fdata) {
+	  type_id = H5Dget_type(data_id);
+	  if (H5Tget_class(type_id) != H5T_FLOAT
+	      || H5Tget_size(type_id) != sizeof(float))
+	       fdata = NULL;
+	  H5Tclose(type_id);
      }
+     mem_type_id = fdata ? H5T_NATIVE_FLOAT : H5T_NATIVE_DOUBLE;
 
      space_id = H5Dget_space(data_id);
      rank = H5Sget_simple_extent_ndims(space_id);
@@ -251,11 +294,11 @@ int arrayh5_read(arrayh5 *a, const char *fname, const char *datapath,
      for (i = 0; i < nslicedims && slicedim_[i] == NO_SLICE_DIM; ++i)
 	  ;
 
-     if (i == nslicedims) { /* no slices */
-	  *a = arrayh5_create(rank, dims);
+     if (i == nslicedims && banddim < 0 && !stride) { /* no slices */
+	  data = create_slab(a, rank, dims, fdata);
 
-	  if (H5Dread(data_id, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL,
-		      H5P_DEFAULT, (void *) a->data) < 0) {
+	  if (H5Dread(data_id, mem_type_id, H5S_ALL, H5S_ALL,
+		      H5P_DEFAULT, data) < 0) {
 	       err = READ_FAILED;
 	       goto done;
 	  }
@@ -264,6 +307,7 @@ int arrayh5_read(arrayh5 *a, const char *fname, const char *datapath,
 	  int j, rank2 = rank;
 	  hsize_t *start;
 	  hsize_t *count;
+	  hsize_t *hstride = NULL;
 	  hid_t mem_space_id;
 	  herr_t readerr;
 
@@ -303,22 +347,59 @@ int arrayh5_read(arrayh5 *a, const char *fname, const char *datapath,
 	       count[slicedim[i]] = 1;
 	  }
 
-	  H5Sselect_hyperslab(space_id, H5S_SELECT_SET,
-			      start, NULL, count, NULL);
-
 	  for (i = j = 0; i < rank; ++i)
 	       if (count[i] > 1)
 		    dims[j++] = count[i];
 	  rank2 = j;
 
-	  *a = arrayh5_create(rank2, dims);
+	  if (stride) {
+	       CHK_MALLOC(hstride, hsize_t, rank);
+	       for (i = j = 0; i < rank; ++i) {
+		    hstride[i] = 1;
+		    if (count[i] > 1) {
+			 hstride[i] = stride[j] > 1 ? stride[j] : 1;
+			 count[i] = (count[i] + hstride[i] - 1) / hstride[i];
+			 dims[j++] = count[i];
+		    }
+	       }
+	  }
+
+	  if (banddim >= 0) {
+	       if (banddim >= rank2 || n0 < 0 || n1 <= n0) {
+		    free(count);
+		    free(start);
+		    err = INVALID_SLICE;
+		    goto done;
+	       }
+	       for (i = j = 0; i < rank; ++i)
+		    if (count[i] > 1 && j++ == banddim)
+			 break;
+	       *n = dims[banddim];
+	       if (n1 > *n)
+		    n1 = *n;
+	       if (n0 >= n1) {
+		    free(count);
+		    free(start);
+		    err = INVALID_SLICE;
+		    goto done;
+	       }
+	       start[i] = n0;
+	       count[i] = n1 - n0;
+	       dims[banddim] = n1 - n0;
+	  }
+
+	  H5Sselect_hyperslab(space_id, H5S_SELECT_SET,
+			      start, hstride, count, NULL);
+	  free(hstride);
+
+	  data = create_slab(a, rank2, dims, fdata);
 
 	  mem_space_id = H5Screate_simple(rank, count, NULL);
 	  H5Sselect_all(mem_space_id);
 
-	  readerr = H5Dread(data_id, H5T_NATIVE_DOUBLE,
+	  readerr = H5Dread(data_id, mem_type_id,
 			    mem_space_id, space_id,
-			    H5P_DEFAULT, (void *) a->data);
+			    H5P_DEFAULT, data);
 
 	  H5Sclose(mem_space_id);
 	  free(count);
@@ -335,13 +416,47 @@ int arrayh5_read(arrayh5 *a, const char *fname, const char *datapath,
      }
 
  done:
-     if (err != NO_ERROR)
+     if (err != NO_ERROR) {
 	  arrayh5_destroy(*a);
+	  if (fdata) {
+	       free(*fdata);
+	       *fdata = NULL;
+	  }
+     }
      free(islice);
      free(slicedim);
      free(dims);
      if (space_id >= 0)
 	  H5Sclose(space_id);
+
+     return err;
+}
+
+/* read_data_slab of the data set datapath of fname (see open_data),
+   also returning its name in *dataname if dataname is not NULL */
+static int read_slab(arrayh5 *a, float **fdata,
+		     const char *fname, const char *datapath,
+		     char **dataname,
+		     int nslicedims, const int *slicedim, const int *islice,
+		     const int *center_slice, int banddim, int n0, int n1,
+		     int *n, const int *stride)
+{
+     hid_t file_id, data_id;
+     char *dname;
+     int err;
+
+     err = open_data(fname, datapath, H5P_DEFAULT, &file_id, &data_id,
+		     &dname);
+     if (err == NO_ERROR)
+	  err = read_data_slab(data_id, a, fdata, nslicedims, slicedim,
+			       islice, center_slice, banddim, n0, n1, n,
+			       stride);
+     else {
+	  a->dims = NULL;
+	  a->data = NULL;
+	  if (fdata)
+	       *fdata = NULL;
+     }
      if (data_id >= 0)
 	  H5Dclose(data_id);
      if (dataname)
@@ -354,6 +469,132 @@ int arrayh5_read(arrayh5 *a, const char *fname, const char *datapath,
      return err;
 }
 
+int arrayh5_read(arrayh5 *a, const char *fname, const char *datapath,
+		 char **dataname,
+		 int nslicedims, const int *slicedim, const int *islice,
+		 const int *center_slice)
+{
+     return read_slab(a, NULL, fname, datapath, dataname,
+		      nslicedims, slicedim, islice, center_slice, -1, 0, 0, NULL,
+		      NULL);
+}
+
+int arrayh5_read_strided(arrayh5 *a, float **fdata,
+			 const char *fname, const char *datapath,
+			 int nslicedims, const int *slicedim, const int *islice,
+			 const int *center_slice, const int *stride)
+{
+     return read_slab(a, fdata, fname, datapath, NULL,
+		      nslicedims, slicedim, islice, center_slice, -1, 0, 0, NULL,
+		      stride);
+}
+
+int arrayh5_read_band(arrayh5 *a, const char *fname, const char *datapath,
+		      int nslicedims, const int *slicedim, const int *islice,
+		      const int *center_slice, int banddim, int n0, int n1,
+		      int *n)
+{
+     return read_slab(a, NULL, fname, datapath, NULL,
+		      nslicedims, slicedim, islice, center_slice,
+		      banddim, n0, n1, n, NULL);
+}
+
+/* The chunks of a chunked data set that the three planes have in common
+   (along the lines where they meet) would be read, and decompressed,
+   once per plane with HDF5's default (1MB) chunk cache, so we open the
+   file with a bigger one. */
+#define ORTHO_CACHE_BYTES (32 * 1048576)
+#define ORTHO_CACHE_SLOTS 10007 /* a prime, as HDF5 recommends */
+
+int arrayh5_read_orthogonal(arrayh5 *a, const char *fname,
+			    const char *datapath,
+			    int nslicedims, const int *slicedim,
+			    const int *islice, const int *center_slice)
+{
+     hid_t fapl_id, file_id, data_id;
+     char *dname;
+     int *slicedim2, i, j, err;
+
+     for (i = 0; i < 3; ++i)
+	  a[i].dims = NULL, a[i].data = NULL;
+     if (nslicedims < 3 || slicedim[0] != 0 || slicedim[1] != 1
+	 || slicedim[2] != 2)
+	  return INVALID_SLICE;
+
+     fapl_id = H5Pcreate(H5P_FILE_ACCESS);
+     H5Pset_cache(fapl_id, 0, ORTHO_CACHE_SLOTS, ORTHO_CACHE_BYTES, 0.75);
+     err = open_data(fname, datapath, fapl_id, &file_id, &data_id, &dname);
+     H5Pclose(fapl_id);
+
+     CHK_MALLOC(slicedim2, int, nslicedims);
+     memcpy(slicedim2, slicedim, nslicedims * sizeof(int));
+     /* the xy, xz and yz planes: sliced in z, y and x, respectively */
+     for (i = 0; i < 3 && err == NO_ERROR; ++i) {
+	  for (j = 0; j < 3; ++j)
+	       slicedim2[j] = j == 2 - i ? j : NO_SLICE_DIM;
+	  err = read_data_slab(data_id, a + i, NULL, nslicedims, slicedim2,
+			       islice, center_slice, -1, 0, 0, NULL, NULL);
+	  if (err == NO_ERROR && a[i].rank != 2) {
+	       arrayh5_destroy(a[i]);
+	       err = INVALID_RANK;
+	  }
+	  if (err != NO_ERROR) { /* a[i] is freed */
+	       while (i-- > 0)
+		    arrayh5_destroy(a[i]);
+	       break;
+	  }
+     }
+     free(slicedim2);
+
+     if (data_id >= 0)
+	  H5Dclose(data_id);
+     free(dname);
+     if (file_id >= 0)
+	  H5Fclose(file_id);
+     return err;
+}
+
+struct arrayh5_dataset_s {
+     hid_t file_id, data_id;
+};
+
+arrayh5_dataset *arrayh5_open_dataset(const char *fname, const char *datapath)
+{
+     arrayh5_dataset *d;
+     char *dname;
+     int err;
+
+     CHK_MALLOC(d, arrayh5_dataset, 1);
+     err = open_data(fname, datapath, H5P_DEFAULT, &d->file_id, &d->data_id,
+		     &dname);
+     free(dname);
+     if (err != NO_ERROR) {
+	  arrayh5_close_dataset(d);
+	  return NULL;
+     }
+     return d;
+}
+
+int arrayh5_read_dataset(arrayh5_dataset *d, arrayh5 *a, float **fdata,
+			 int nslicedims, const int *slicedim, const int *islice,
+			 const int *center_slice, const int *stride,
+			 int banddim, int n0, int n1, int *n)
+{
+     return read_data_slab(d->data_id, a, fdata, nslicedims, slicedim, islice,
+			   center_slice, banddim, n0, n1, n, stride);
+}
+
+void arrayh5_close_dataset(arrayh5_dataset *d)
+{
+     if (d) {
+	  if (d->data_id >= 0)
+	       H5Dclose(d->data_id);
+	  if (d->file_id >= 0)
+	       H5Fclose(d->file_id);
+	  free(d);
+     }
+}
+
 static int dataset_exists(hid_t id, const char *name)
 {
      hid_t data_id;
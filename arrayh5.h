@@ -48,11 +48,62 @@ extern int arrayh5_read(arrayh5 *a, const char *fname, const char *datapath,
 			int nslicedims,
 			const int *slicedim, const int *islice,
 			const int *center_slice);
+/* Like arrayh5_read (but without dataname), except:
+   -- if stride is not NULL, only every stride[i]-th element along each
+      dimension i of the sliced data is read (starting with the first);
+   -- if fdata is not NULL and the data set is stored in single
+      precision, it is read as floats into a new array *fdata (leaving
+      a->data NULL), rather than converted to double; otherwise *fdata
+      is NULL. */
+extern int arrayh5_read_strided(arrayh5 *a, float **fdata,
+				const char *fname, const char *datapath,
+				int nslicedims,
+				const int *slicedim, const int *islice,
+				const int *center_slice, const int *stride);
 extern void arrayh5_write(arrayh5 a, char *filename, char *dataname,
 			  short append_data);
 
+/* Like arrayh5_read (but without dataname), only read the elements
+   n0..n1-1 (or up to the end) along dimension banddim of the sliced
+   data, e.g. a band of rows of a huge slice, returning the size of that
+   dimension of the whole slice in *n. */
+extern int arrayh5_read_band(arrayh5 *a, const char *fname,
+			     const char *datapath,
+			     int nslicedims,
+			     const int *slicedim, const int *islice,
+			     const int *center_slice,
+			     int banddim, int n0, int n1, int *n);
+
+/* Read the three orthogonal planes through a point of a (sliced) 3d
+   data set, opening the file only once: like arrayh5_read (but without
+   dataname), except that slicedim[0..2] must be 0, 1 and 2, where
+   islice[0..2] give the point, and a[0], a[1] and a[2] are the xy, xz
+   and yz planes (the data sliced only at the z, y and x of the point,
+   respectively). */
+extern int arrayh5_read_orthogonal(arrayh5 *a, const char *fname,
+				   const char *datapath,
+				   int nslicedims,
+				   const int *slicedim, const int *islice,
+				   const int *center_slice);
+
 int arrayh5_read_rank(const char *fname, const char *datapath, int *rank);
 
+/* A data set kept open, to read many slices of it without reopening the
+   file each time: arrayh5_open_dataset opens the data set datapath (or
+   the first one) of fname, returning NULL on failure, and
+   arrayh5_read_dataset reads it like arrayh5_read_strided, or if
+   banddim >= 0 like arrayh5_read_band (in which case stride must be
+   NULL). */
+typedef struct arrayh5_dataset_s arrayh5_dataset;
+extern arrayh5_dataset *arrayh5_open_dataset(const char *fname,
+					     const char *datapath);
+extern int arrayh5_read_dataset(arrayh5_dataset *d, arrayh5 *a, float **fdata,
+				int nslicedims,
+				const int *slicedim, const int *islice,
+				const int *center_slice, const int *stride,
+				int banddim, int n0, int n1, int *n);
+extern void arrayh5_close_dataset(arrayh5_dataset *d);
+
 #define NO_SLICE_DIM -1
 #define LAST_SLICE_DIM -2
 
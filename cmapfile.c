@@ -0,0 +1,199 @@
+/* Copyright (c) 1999-2023 Massachusetts Institute of Technology
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/* Loading colormaps by name: one of the builtin_colormaps, or else a
+   colormap file (in CMAP_DIR, or given by its path). */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "config.h"
+#include "colormap.h"
+
+#if defined(HAVE_WORDEXP) && defined(HAVE_WORDEXP_H)
+#  include <wordexp.h>
+#endif
+
+static char *copy_string(const char *s)
+{
+     char *t = (char *) malloc(strlen(s) + 1);
+     if (t)
+	  strcpy(t, s);
+     return t;
+}
+
+/* shell expansion on a path, used for CMAP_DIR (only needed for
+   colormaps that are not compiled in) */
+static char *shell_expand(const char *path)
+{
+#if defined(HAVE_WORDEXP) && defined(HAVE_WORDEXP_H)
+	wordexp_t p;
+	char *newpath;
+	if (wordexp(path, &p, 0))
+	     return copy_string(path);
+	newpath = copy_string(p.we_wordc == 1 ? p.we_wordv[0] : path);
+	wordfree(&p);
+	return newpath;
+#else
+	return copy_string(path);
+#endif
+}
+
+/* read a colormap file, returning a colormap with n = 0 if the file is
+   invalid or we run out of memory */
+static colormap_t load_colormap(FILE *f, int verbose)
+{
+     colormap_t cmap = {0, NULL};
+     int nalloc = 0;
+     float r,g,b,a;
+     int c;
+
+     /* read initial comment lines, and echo if verbose */
+     do {
+	  while (isspace(c = fgetc(f)));
+	  if (c == '#' || c == '%') {
+	       while (isspace(c = fgetc(f)) && c != '\n' && c != EOF);
+	       if (c != EOF) ungetc(c, f);
+	       while ('\n' != (c = fgetc(f)) && c != EOF)
+		    if (verbose)
+			 putchar(c);
+	       if (verbose)
+		    putchar('\n');
+	  }
+     } while (c == '\n');
+     if (c != EOF) ungetc(c, f);
+
+     while (4 == fscanf(f, "%g %g %g %g", &r, &g, &b, &a)) {
+	  if (cmap.n >= nalloc) {
+	       rgba_t *rgba;
+	       nalloc = (1 + nalloc) * 2;
+	       rgba = (rgba_t *) realloc(cmap.rgba, nalloc * sizeof(rgba_t));
+	       if (!rgba) {
+		    free(cmap.rgba);
+		    cmap.n = 0;
+		    cmap.rgba = NULL;
+		    return cmap;
+	       }
+	       cmap.rgba = rgba;
+	  }
+	  cmap.rgba[cmap.n].r = r;
+	  cmap.rgba[cmap.n].g = g;
+	  cmap.rgba[cmap.n].b = b;
+	  cmap.rgba[cmap.n].a = a;
+	  cmap.n++;
+     }
+     if (verbose && cmap.n >= 1)
+	  printf("%d color entries read from colormap file.\n", cmap.n);
+     return cmap;
+}
+
+const builtin_colormap *find_builtin_cmap(const char *name)
+{
+     const builtin_colormap *c;
+     for (c = builtin_colormaps; c->name && strcmp(c->name, name); ++c)
+	  ;
+     return c->name ? c : NULL;
+}
+
+int get_colormap(colormap_t *cmap_, const char *colormap, int invert,
+		 double scale_alpha, int verbose)
+{
+     int i;
+     colormap_t cmap = {0, NULL};
+     const builtin_colormap *builtin = NULL;
+     FILE *cmap_f = NULL;
+     char *cmap_fname = NULL;
+
+     if (colormap[0] == '-') {
+	  invert = 1;
+	  colormap++;
+     }
+     if (colormap[0] != '.' && colormap[0] != '/')
+	  builtin = find_builtin_cmap(colormap);
+     if (builtin) {
+	  if (verbose) {
+	       fputs(builtin->comment, stdout);
+	       printf("Using built-in colormap \"%s\"%s.\n", colormap,
+		      invert ? " (inverted)" : "");
+	  }
+	  cmap.n = builtin->cmap.n;
+	  cmap.rgba = (rgba_t *) malloc(cmap.n * sizeof(rgba_t));
+	  if (!cmap.rgba)
+	       goto nomem;
+	  memcpy(cmap.rgba, builtin->cmap.rgba, cmap.n * sizeof(rgba_t));
+     }
+     else {
+	  if (colormap[0] != '.' && colormap[0] != '/') {
+	       char *cmap_dir = shell_expand(CMAP_DIR);
+	       if (!cmap_dir)
+		    goto nomem;
+	       cmap_fname = (char *) malloc(sizeof(char) *
+					    (strlen(cmap_dir)
+					     + strlen(colormap) + 1));
+	       if (!cmap_fname) {
+		    free(cmap_dir);
+		    goto nomem;
+	       }
+	       strcpy(cmap_fname, cmap_dir); strcat(cmap_fname, colormap);
+	       free(cmap_dir);
+	       cmap_f = fopen(cmap_fname, "r");
+	  }
+	  if (!cmap_f) {
+	       free(cmap_fname);
+	       if (!(cmap_fname = copy_string(colormap)))
+		    goto nomem;
+	       if (!(cmap_f = fopen(cmap_fname, "r"))) {
+		    fprintf(stderr, "Could not find colormap \"%s\"\n",
+			    colormap);
+		    free(cmap_fname);
+		    return 1;
+	       }
+	  }
+	  if (verbose)
+	       printf("Using colormap \"%s\" in file \"%s\"%s.\n",
+		      colormap, cmap_fname, invert ? " (inverted)" : "");
+	  cmap = load_colormap(cmap_f, verbose);
+	  fclose(cmap_f);
+	  if (cmap.n < 1)
+	       fprintf(stderr, "Invalid colormap file \"%s\"\n", cmap_fname);
+	  free(cmap_fname);
+	  if (cmap.n < 1)
+	       return 1;
+     }
+     if (invert)
+	  for (i = 0; i < cmap.n - 1 - i; ++i) {
+	       rgba_t rgba = cmap.rgba[i];
+	       cmap.rgba[i] = cmap.rgba[cmap.n - 1 - i];
+	       cmap.rgba[cmap.n - 1 - i] = rgba;
+	  }
+     if (verbose) printf("Scaling opacity by %g\n", scale_alpha);
+     for (i = 0; i < cmap.n; ++i)
+	  cmap.rgba[i].a *= scale_alpha;
+     *cmap_ = cmap;
+     return 0;
+
+nomem:
+     fprintf(stderr, "Out of memory loading colormap \"%s\"\n", colormap);
+     return 1;
+}
@@ -0,0 +1,76 @@
+# Generate cmaps.c, the colormaps compiled into h5topng, from the
+# colormap files given as arguments (see load_colormap in h5topng.c for
+# the format: initial comment lines, then r g b a values).
+
+function finish_cmap() {
+     if (name == "")
+	  return;
+     if (ncolors == 0) {
+	  print "cmaps.awk: no colors in " name > "/dev/stderr";
+	  exit 1;
+     }
+     printf "};\n\n";
+     names[nmaps] = name;
+     comments[nmaps] = comment;
+     sizes[nmaps] = ncolors;
+     ++nmaps;
+}
+
+# a float literal, converted directly to float like fscanf's %g does
+function float_literal(s) {
+     if (s !~ /[.eE]/)
+	  s = s ".0";
+     return s "f";
+}
+
+BEGIN {
+     print "/* Generated from the colormaps directory by cmaps.awk.  Do not edit. */\n";
+     print "#include <stddef.h>\n";
+     print "#include \"config.h\"";
+     print "#include \"colormap.h\"\n";
+     nmaps = 0;
+     name = "";
+}
+
+FNR == 1 {
+     finish_cmap();
+     name = FILENAME;
+     sub(/.*\//, "", name);
+     comment = "";
+     ncolors = 0;
+     ntokens = 0;
+     in_comments = 1;
+     printf "static rgba_t cmap_%d[] = {\n", nmaps;
+}
+
+in_comments && /^[ \t]*[#%]/ {
+     line = $0;
+     sub(/^[ \t]*[#%][ \t]*/, "", line);
+     gsub(/\\/, "\\\\", line);
+     gsub(/"/, "\\\"", line);
+     comment = comment line "\\n";
+     next;
+}
+
+{
+     in_comments = 0;
+     for (i = 1; i <= NF; ++i) {
+	  tokens[ntokens++] = float_literal($i);
+	  if (ntokens == 4) {
+	       printf "     { %s, %s, %s, %s },\n",
+		    tokens[0], tokens[1], tokens[2], tokens[3];
+	       ++ncolors;
+	       ntokens = 0;
+	  }
+     }
+}
+
+END {
+     finish_cmap();
+     print "const builtin_colormap builtin_colormaps[] = {";
+     for (i = 0; i < nmaps; ++i)
+	  printf "     { \"%s\", \"%s\", { %d, cmap_%d } },\n",
+	       names[i], comments[i], sizes[i], i;
+     print "     { NULL, NULL, { 0, NULL } }";
+     print "};";
+}
@@ -0,0 +1,444 @@
+/* Copyright (c) 1999-2023 Massachusetts Institute of Technology
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+
+#include "config.h"
+#include "colormap.h"
+
+#define MAX(a,b) ((a) > (b) ? (a) : (b))
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+
+/* convert a value val in [0,1] to a color from the colormap */
+void cmap_lookup(REAL val, colormap_t cmap,
+		 float *r, float *g, float *b, float *a)
+{
+     double w;
+     int i = val * (cmap.n - 1);
+     if (i > cmap.n - 2) i = cmap.n - 2;
+     if (i < 0) i = 0;
+     w = val * (cmap.n - 1) - i;
+     *r = cmap.rgba[i].r * (1 - w) + cmap.rgba[i+1].r * w;
+     *g = cmap.rgba[i].g * (1 - w) + cmap.rgba[i+1].g * w;
+     *b = cmap.rgba[i].b * (1 - w) + cmap.rgba[i+1].b * w;
+     *a = cmap.rgba[i].a * (1 - w) + cmap.rgba[i+1].a * w;
+}
+
+#define LUT_MIN_SIZE 4096
+
+/* Initialize lut for cmap over [min,max], with floating-point rgba
+   values if want_rgba (for blending) and 8-bit rgb values otherwise.
+   Returns nonzero if we run out of memory. */
+int init_lut(cmap_lut *lut, colormap_t cmap, REAL min, REAL max,
+	     int want_rgba)
+{
+     int i, n = LUT_MIN_SIZE;
+     double maxdelta = 0, tol;
+
+     /* The nearest LUT entry is off by at most half a LUT spacing,
+	which changes the color by at most maxdelta*(cmap.n-1) times
+	that; this must be < 0.5/255 (or less, if we blend colors) to be
+	within +/- 1 after rounding to 8 bits. */
+     for (i = 0; i + 1 < cmap.n; ++i) {
+	  maxdelta = MAX(maxdelta, fabs(cmap.rgba[i+1].r - cmap.rgba[i].r));
+	  maxdelta = MAX(maxdelta, fabs(cmap.rgba[i+1].g - cmap.rgba[i].g));
+	  maxdelta = MAX(maxdelta, fabs(cmap.rgba[i+1].b - cmap.rgba[i].b));
+	  if (want_rgba)
+	       maxdelta = MAX(maxdelta,
+			      fabs(cmap.rgba[i+1].a - cmap.rgba[i].a));
+     }
+     tol = want_rgba ? 0.25/255 : 0.5/255;
+     maxdelta = ceil(maxdelta * (cmap.n - 1) * 0.5 / tol);
+     n = MAX(n, (int) maxdelta + 1);
+
+     lut->n = n;
+     lut->scale = range_scale(&min, &max, n - 1);
+     lut->min = min;
+     lut->max = max;
+     lut->rgb = NULL;
+     lut->rgba = NULL;
+     if (want_rgba) {
+	  if (!(lut->rgba = (float *) malloc(4 * n * sizeof(float))))
+	       return 1;
+     }
+     else if (!(lut->rgb = (unsigned char *) malloc(4 * n)))
+	  return 1;
+
+     for (i = 0; i < n; ++i) {
+	  float r, g, b, a;
+	  cmap_lookup(i * 1.0 / (n - 1), cmap, &r, &g, &b, &a);
+	  if (want_rgba) {
+	       lut->rgba[4*i] = r;
+	       lut->rgba[4*i + 1] = g;
+	       lut->rgba[4*i + 2] = b;
+	       lut->rgba[4*i + 3] = a;
+	  }
+	  else {
+	       lut->rgb[4*i] = r * 255 + 0.5;
+	       lut->rgb[4*i + 1] = g * 255 + 0.5;
+	       lut->rgb[4*i + 2] = b * 255 + 0.5;
+	       lut->rgb[4*i + 3] = 0;
+	  }
+     }
+     return 0;
+}
+
+/* (x - x is NaN for x = inf or NaN) */
+#define FINITE(x) ((x) - (x) == 0)
+
+REAL range_scale(REAL *min, REAL *max, REAL n)
+{
+     if (!FINITE(*min) || !FINITE(*max) || !FINITE(*max - *min)) {
+	  *min = *max = FINITE(*min) ? *min : (FINITE(*max) ? *max : 0.0);
+	  return 0.0;
+     }
+     return *max > *min ? n / (*max - *min) : 0.0;
+}
+
+void destroy_lut(cmap_lut *lut)
+{
+     free(lut->rgb);
+     free(lut->rgba);
+}
+
+void colormap_range(double data_min, double data_max,
+		    double min, int min_set, double max, int max_set,
+		    int zero_center, double *min_, double *max_)
+{
+     if (!min_set)
+	  min = data_min;
+     if (!max_set)
+	  max = data_max;
+     if (min > max) {
+	  double swap = min;
+	  min = max;
+	  max = swap;
+     }
+     if (zero_center) {
+	  if (!max_set || min_set || max <= 0)
+	       max = fabs(max) > fabs(min) ? fabs(max) : fabs(min);
+	  min = -max;
+     }
+     *min_ = min;
+     *max_ = max;
+}
+
+void float_range(const float *data, size_t n, double *min, double *max)
+{
+     size_t i;
+
+     *min = *max = data[0];
+     for (i = 1; i < n; ++i) {
+	  if (data[i] < *min)
+	       *min = data[i];
+	  if (data[i] > *max)
+	       *max = data[i];
+     }
+}
+
+/***********************************************************************/
+/* Portable kernels (also used for the leftover pixels at the end of
+   each row by the SIMD kernels). */
+
+static void colormap_row_8bit_scalar(const REAL *vals, int width,
+				     REAL minrange, REAL maxrange, REAL scale,
+				     unsigned char *out)
+{
+     int i;
+     for (i = 0; i < width; ++i)
+	  out[i] = (PIN_RANGE(vals[i], minrange, maxrange) - minrange) * scale;
+}
+
+static void colormap_row_scalar(const REAL *vals, int width,
+				const cmap_lut *lut, unsigned char *out)
+{
+     int i;
+     for (i = 0; i < width; ++i) {
+	  const unsigned char *c = lut->rgb + 4 * LUT_INDEX(lut, vals[i]);
+	  out[3*i    ] = c[0];
+	  out[3*i + 1] = c[1];
+	  out[3*i + 2] = c[2];
+     }
+}
+
+static int supported_scalar(void) { return 1; }
+
+/* colormap vals, blended with the translucent overlay colors of ovals */
+void colormap_row_overlay(const REAL *vals, const REAL *ovals,
+			  int width, const cmap_lut *lut,
+			  const cmap_lut *olut, unsigned char *out)
+{
+     int i;
+     for (i = 0; i < width; ++i) {
+	  const float *c = lut->rgba + 4 * LUT_INDEX(lut, vals[i]);
+	  const float *o = olut->rgba + 4 * LUT_INDEX(olut, ovals[i]);
+	  float ao = o[3];
+	  out[3*i    ] = (c[0] * (1 - ao) + o[0] * ao) * 255 + 0.5;
+	  out[3*i + 1] = (c[1] * (1 - ao) + o[1] * ao) * 255 + 0.5;
+	  out[3*i + 2] = (c[2] * (1 - ao) + o[2] * ao) * 255 + 0.5;
+     }
+}
+
+/***********************************************************************/
+/* x86 SIMD kernels.  These are compiled for each instruction set via
+   target attributes (rather than compiler flags), and selected at
+   runtime according to the CPU, so that a single binary runs everywhere.
+   They compute exactly the same results as the scalar kernels: the
+   pinning with max/min handles NaN in the same way, and the LUT index
+   is truncated from the same multiply and add (and clamped to the LUT
+   before the AVX gathers, as a safeguard).  The AVX kernels clear
+   the upper register halves before calling the scalar kernels for the
+   leftover pixels, since the compiler doesn't always do so and the
+   transition penalty would otherwise dominate for narrow images. */
+
+#if defined(HAVE_X86_SIMD) && !defined(SINGLE_PRECISION)
+
+#include <immintrin.h>
+
+#define TARGET(isa) __attribute__((target(isa)))
+
+TARGET("sse2")
+static void colormap_row_8bit_sse2(const REAL *vals, int width,
+				   REAL minrange, REAL maxrange, REAL scale,
+				   unsigned char *out)
+{
+     int i;
+     __m128d minv = _mm_set1_pd(minrange), maxv = _mm_set1_pd(maxrange);
+     __m128d s = _mm_set1_pd(scale);
+     for (i = 0; i + 4 <= width; i += 4) {
+	  __m128d v0 = _mm_loadu_pd(vals + i), v1 = _mm_loadu_pd(vals + i+2);
+	  __m128i n;
+	  v0 = _mm_min_pd(_mm_max_pd(v0, minv), maxv);
+	  v1 = _mm_min_pd(_mm_max_pd(v1, minv), maxv);
+	  n = _mm_unpacklo_epi64(_mm_cvttpd_epi32(_mm_mul_pd(_mm_sub_pd(v0, minv), s)),
+				 _mm_cvttpd_epi32(_mm_mul_pd(_mm_sub_pd(v1, minv), s)));
+	  n = _mm_packus_epi16(_mm_packs_epi32(n, n), n);
+	  *((int *) (void *) (out + i)) = _mm_cvtsi128_si32(n);
+     }
+     colormap_row_8bit_scalar(vals + i, width - i, minrange, maxrange, scale,
+			      out + i);
+}
+
+/* SSE2 has no gather instruction, so only the index computation is
+   vectorized */
+TARGET("sse2")
+static void colormap_row_sse2(const REAL *vals, int width,
+			      const cmap_lut *lut, unsigned char *out)
+{
+     int i;
+     __m128d minv = _mm_set1_pd(lut->min), maxv = _mm_set1_pd(lut->max);
+     __m128d s = _mm_set1_pd(lut->scale), half = _mm_set1_pd(0.5);
+     for (i = 0; i + 2 <= width; i += 2) {
+	  __m128d v = _mm_loadu_pd(vals + i);
+	  __m128i n;
+	  int n0, n1;
+	  v = _mm_min_pd(_mm_max_pd(v, minv), maxv);
+	  n = _mm_cvttpd_epi32(_mm_add_pd(_mm_mul_pd(_mm_sub_pd(v, minv), s),
+					  half));
+	  n0 = _mm_cvtsi128_si32(n);
+	  n1 = _mm_cvtsi128_si32(_mm_srli_si128(n, 4));
+	  memcpy(out + 3*i, lut->rgb + 4*n0, 3);
+	  memcpy(out + 3*i + 3, lut->rgb + 4*n1, 3);
+     }
+     colormap_row_scalar(vals + i, width - i, lut, out + 3*i);
+}
+
+static int supported_sse2(void)
+{
+     __builtin_cpu_init();
+     return __builtin_cpu_supports("sse2");
+}
+
+TARGET("avx2")
+static void colormap_row_8bit_avx2(const REAL *vals, int width,
+				   REAL minrange, REAL maxrange, REAL scale,
+				   unsigned char *out)
+{
+     int i;
+     __m256d minv = _mm256_set1_pd(minrange), maxv = _mm256_set1_pd(maxrange);
+     __m256d s = _mm256_set1_pd(scale);
+     for (i = 0; i + 8 <= width; i += 8) {
+	  __m256d v0 = _mm256_loadu_pd(vals + i);
+	  __m256d v1 = _mm256_loadu_pd(vals + i+4);
+	  __m128i n0, n1;
+	  v0 = _mm256_min_pd(_mm256_max_pd(v0, minv), maxv);
+	  v1 = _mm256_min_pd(_mm256_max_pd(v1, minv), maxv);
+	  n0 = _mm256_cvttpd_epi32(_mm256_mul_pd(_mm256_sub_pd(v0, minv), s));
+	  n1 = _mm256_cvttpd_epi32(_mm256_mul_pd(_mm256_sub_pd(v1, minv), s));
+	  n0 = _mm_packs_epi32(n0, n1);
+	  _mm_storel_epi64((__m128i *) (void *) (out + i),
+			   _mm_packus_epi16(n0, n0));
+     }
+     _mm256_zeroupper();
+     colormap_row_8bit_scalar(vals + i, width - i, minrange, maxrange, scale,
+			      out + i);
+}
+
+TARGET("avx2")
+static void colormap_row_avx2(const REAL *vals, int width,
+			      const cmap_lut *lut, unsigned char *out)
+{
+     int i;
+     __m256d minv = _mm256_set1_pd(lut->min), maxv = _mm256_set1_pd(lut->max);
+     __m256d s = _mm256_set1_pd(lut->scale), half = _mm256_set1_pd(0.5);
+     __m256i zero = _mm256_setzero_si256();
+     __m256i last = _mm256_set1_epi32(lut->n - 1);
+     /* pack the r,g,b bytes of the four r,g,b,0 colors in each lane */
+     __m256i pack = _mm256_setr_epi8(0,1,2,4,5,6,8,9,10,12,13,14,
+				     -1,-1,-1,-1,
+				     0,1,2,4,5,6,8,9,10,12,13,14,
+				     -1,-1,-1,-1);
+     /* ...then move the 12 bytes of the upper lane next to the lower */
+     __m256i join = _mm256_setr_epi32(0,1,2,4,5,6,3,7);
+     for (i = 0; i + 8 <= width; i += 8) {
+	  __m256d v0 = _mm256_loadu_pd(vals + i);
+	  __m256d v1 = _mm256_loadu_pd(vals + i+4);
+	  __m256i n, c;
+	  v0 = _mm256_min_pd(_mm256_max_pd(v0, minv), maxv);
+	  v1 = _mm256_min_pd(_mm256_max_pd(v1, minv), maxv);
+	  v0 = _mm256_add_pd(_mm256_mul_pd(_mm256_sub_pd(v0, minv), s), half);
+	  v1 = _mm256_add_pd(_mm256_mul_pd(_mm256_sub_pd(v1, minv), s), half);
+	  n = _mm256_insertf128_si256(_mm256_castsi128_si256(_mm256_cvttpd_epi32(v0)),
+				      _mm256_cvttpd_epi32(v1), 1);
+	  /* (a NaN would give INT_MIN; never gather outside the LUT) */
+	  n = _mm256_min_epi32(_mm256_max_epi32(n, zero), last);
+	  c = _mm256_i32gather_epi32((const int *) (const void *) lut->rgb,
+				     n, 4);
+	  c = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(c, pack), join);
+	  _mm_storeu_si128((__m128i *) (void *) (out + 3*i),
+			   _mm256_castsi256_si128(c));
+	  _mm_storel_epi64((__m128i *) (void *) (out + 3*i + 16),
+			   _mm256_extracti128_si256(c, 1));
+     }
+     _mm256_zeroupper();
+     colormap_row_scalar(vals + i, width - i, lut, out + 3*i);
+}
+
+static int supported_avx2(void)
+{
+     __builtin_cpu_init();
+     return __builtin_cpu_supports("avx2");
+}
+
+TARGET("avx512f")
+static void colormap_row_8bit_avx512(const REAL *vals, int width,
+				     REAL minrange, REAL maxrange, REAL scale,
+				     unsigned char *out)
+{
+     int i;
+     __m512d minv = _mm512_set1_pd(minrange), maxv = _mm512_set1_pd(maxrange);
+     __m512d s = _mm512_set1_pd(scale);
+     for (i = 0; i + 16 <= width; i += 16) {
+	  __m512d v0 = _mm512_loadu_pd(vals + i);
+	  __m512d v1 = _mm512_loadu_pd(vals + i+8);
+	  __m512i n;
+	  v0 = _mm512_min_pd(_mm512_max_pd(v0, minv), maxv);
+	  v1 = _mm512_min_pd(_mm512_max_pd(v1, minv), maxv);
+	  n = _mm512_inserti64x4(_mm512_castsi256_si512(
+					_mm512_cvttpd_epi32(_mm512_mul_pd(
+					     _mm512_sub_pd(v0, minv), s))),
+				 _mm512_cvttpd_epi32(_mm512_mul_pd(
+					   _mm512_sub_pd(v1, minv), s)), 1);
+	  _mm_storeu_si128((__m128i *) (void *) (out + i),
+			   _mm512_cvtepi32_epi8(n));
+     }
+     _mm256_zeroupper();
+     colormap_row_8bit_scalar(vals + i, width - i, minrange, maxrange, scale,
+			      out + i);
+}
+
+TARGET("avx512f,avx512bw")
+static void colormap_row_avx512(const REAL *vals, int width,
+				const cmap_lut *lut, unsigned char *out)
+{
+     int i;
+     __m512d minv = _mm512_set1_pd(lut->min), maxv = _mm512_set1_pd(lut->max);
+     __m512d s = _mm512_set1_pd(lut->scale), half = _mm512_set1_pd(0.5);
+     __m512i zero = _mm512_setzero_si512();
+     __m512i last = _mm512_set1_epi32(lut->n - 1);
+     /* pack the r,g,b bytes of the four r,g,b,0 colors in each lane */
+     __m512i pack = _mm512_broadcast_i32x4(_mm_setr_epi8(0,1,2,4,5,6,8,9,
+							 10,12,13,14,
+							 -1,-1,-1,-1));
+     for (i = 0; i + 16 <= width; i += 16) {
+	  __m512d v0 = _mm512_loadu_pd(vals + i);
+	  __m512d v1 = _mm512_loadu_pd(vals + i+8);
+	  __m512i n, c;
+	  v0 = _mm512_min_pd(_mm512_max_pd(v0, minv), maxv);
+	  v1 = _mm512_min_pd(_mm512_max_pd(v1, minv), maxv);
+	  v0 = _mm512_add_pd(_mm512_mul_pd(_mm512_sub_pd(v0, minv), s), half);
+	  v1 = _mm512_add_pd(_mm512_mul_pd(_mm512_sub_pd(v1, minv), s), half);
+	  n = _mm512_inserti64x4(_mm512_castsi256_si512(_mm512_cvttpd_epi32(v0)),
+				 _mm512_cvttpd_epi32(v1), 1);
+	  n = _mm512_min_epi32(_mm512_max_epi32(n, zero), last);
+	  c = _mm512_i32gather_epi32(n, (const void *) lut->rgb, 4);
+	  /* pack, then squeeze out the unused 4th word of each lane */
+	  c = _mm512_maskz_compress_epi32(0x7777, _mm512_shuffle_epi8(c, pack));
+	  _mm512_mask_storeu_epi32(out + 3*i, 0x0fff, c);
+     }
+     _mm256_zeroupper();
+     colormap_row_scalar(vals + i, width - i, lut, out + 3*i);
+}
+
+static int supported_avx512(void)
+{
+     __builtin_cpu_init();
+     return __builtin_cpu_supports("avx512f")
+	  && __builtin_cpu_supports("avx512bw");
+}
+
+#endif /* HAVE_X86_SIMD && !SINGLE_PRECISION */
+
+/***********************************************************************/
+
+/* in order of increasing speed */
+const colormap_kernels colormap_kernels_all[] = {
+     { "scalar", colormap_row_scalar, colormap_row_8bit_scalar,
+       supported_scalar },
+#if defined(HAVE_X86_SIMD) && !defined(SINGLE_PRECISION)
+     { "sse2", colormap_row_sse2, colormap_row_8bit_sse2, supported_sse2 },
+     { "avx2", colormap_row_avx2, colormap_row_8bit_avx2, supported_avx2 },
+     { "avx512", colormap_row_avx512, colormap_row_8bit_avx512,
+       supported_avx512 },
+#endif
+     { NULL, NULL, NULL, NULL }
+};
+
+const colormap_kernels *get_colormap_kernels(void)
+{
+     static const colormap_kernels *k = NULL;
+     if (!k) {
+	  const char *name = getenv("H5UTILS_SIMD");
+	  const colormap_kernels *best = colormap_kernels_all, *ki;
+	  for (ki = colormap_kernels_all; ki->name; ++ki)
+	       if (ki->supported()) {
+		    best = ki;
+		    if (name && !strcmp(name, ki->name))
+			 break;
+	       }
+	  k = best;
+     }
+     return k;
+}
@@ -0,0 +1,137 @@
+/* Copyright (c) 1999-2023 Massachusetts Institute of Technology
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef COLORMAP_H
+#define COLORMAP_H
+
+#include "writepng.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/***********************************************************************/
+
+extern void cmap_lookup(REAL val, colormap_t cmap,
+			float *r, float *g, float *b, float *a);
+
+/* the standard colormaps (the files in the colormaps directory), which
+   are compiled into h5topng by cmaps.awk; terminated by a NULL name */
+typedef struct {
+     const char *name;
+     const char *comment; /* the comment lines of the file */
+     colormap_t cmap;
+} builtin_colormap;
+
+extern const builtin_colormap builtin_colormaps[];
+
+/* where the colormap files are installed */
+#define CMAP_DIR DATADIR "/" PACKAGE_NAME "/colormaps/"
+
+/* the builtin colormap name, or NULL if there is none */
+extern const builtin_colormap *find_builtin_cmap(const char *name);
+
+/* Get the colormap name (reversed if it starts with "-" or if invert):
+   a builtin colormap, or else a colormap file in CMAP_DIR or with the
+   path name, with its opacity multiplied by scale_alpha, describing it
+   on stdout if verbose.  Returns nonzero (with a message on stderr) if
+   there is no such colormap. */
+extern int get_colormap(colormap_t *cmap, const char *name, int invert,
+			double scale_alpha, int verbose);
+
+/* The colormap range [*min_,*max_] for data from data_min to data_max
+   (or between whatever percentiles of the data were asked for): min or
+   max instead, if min_set or max_set, and if zero_center, centered on
+   zero, as h5topng's -m, -M and -Z options. */
+extern void colormap_range(double data_min, double data_max,
+			   double min, int min_set, double max, int max_set,
+			   int zero_center, double *min_, double *max_);
+
+/* the range of n > 0 single-precision values (for data read as is,
+   rather than converted to REAL) */
+extern void float_range(const float *data, size_t n,
+			double *min, double *max);
+
+/* Colormapping every pixel with cmap_lookup is expensive, so instead we
+   precompute the colormap at n equally spaced values from min to max,
+   and colormap a value val in [min,max] by the nearest entry
+   LUT_INDEX(lut, val).  n is large enough that the result is within
+   +/- 1 of the exact 8-bit color. */
+typedef struct {
+     int n;
+     REAL min, max, scale;
+     unsigned char *rgb; /* 4*n bytes: opaque 8-bit colors, as r,g,b,0 */
+     float *rgba; /* 4*n floats (if not NULL): colors to blend */
+} cmap_lut;
+
+/* pin val to [minrange,maxrange], with NaN pinned to minrange */
+#define PIN_RANGE(val, minrange, maxrange) \
+     ((val) > (maxrange) ? (maxrange) \
+      : (!((val) >= (minrange)) ? (minrange) : (val)))
+
+/* (val is pinned first, so that this is always in [0, lut->n - 1]) */
+#define LUT_INDEX(lut, val) \
+     ((int) ((PIN_RANGE(val, (lut)->min, (lut)->max) - (lut)->min) \
+	     * (lut)->scale + 0.5))
+
+/* Return the factor n / (*max - *min) that maps [*min,*max] linearly
+   onto [0,n].  If the range is not finite (e.g. the data contain an inf,
+   or are all NaN), it is first collapsed to a single finite value (and
+   0 is returned), so that pinned values never give a NaN index. */
+extern REAL range_scale(REAL *min, REAL *max, REAL n);
+
+extern int init_lut(cmap_lut *lut, colormap_t cmap, REAL min, REAL max,
+		    int want_rgba);
+extern void destroy_lut(cmap_lut *lut);
+
+/* Kernels to colormap a row of width values, as 8-bit direct color
+   (3 bytes per pixel) via lut, or as 8-bit palette indices
+   (vals - minrange) * scale, respectively.  There are several variants,
+   using the SIMD instructions of different CPUs. */
+typedef struct {
+     const char *name;
+     void (*rgb)(const REAL *vals, int width, const cmap_lut *lut,
+		 unsigned char *out);
+     void (*eight_bit)(const REAL *vals, int width,
+		       REAL minrange, REAL maxrange, REAL scale,
+		       unsigned char *out);
+     int (*supported)(void);
+} colormap_kernels;
+
+/* all of the kernel variants, ending with a variant with name NULL */
+extern const colormap_kernels colormap_kernels_all[];
+
+/* The fastest kernels supported by this CPU, or the variant named by
+   the H5UTILS_SIMD environment variable (if supported). */
+extern const colormap_kernels *get_colormap_kernels(void);
+
+extern void colormap_row_overlay(const REAL *vals, const REAL *ovals,
+				 int width, const cmap_lut *lut,
+				 const cmap_lut *olut, unsigned char *out);
+
+/***********************************************************************/
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif /* __cplusplus */
+
+#endif /* COLORMAP_H */
@@ -0,0 +1,130 @@
+/* Copyright (c) 1999-2023 Massachusetts Institute of Technology
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/* Microbenchmark of the colormapping kernel variants (see colormap.c)
+   supported by this CPU, which also checks that every variant gives
+   the same output as the scalar kernels.  Not installed; build it with
+   "make colormap_bench".  Usage: colormap_bench [width] [rows] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "config.h"
+#include "colormap.h"
+
+#define NCOLORS 3
+
+static double elapsed(clock_t start)
+{
+     return (clock() - start) * 1.0 / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char **argv)
+{
+     int width = argc > 1 ? atoi(argv[1]) : 1021; /* not a multiple of 16 */
+     int rows = argc > 2 ? atoi(argv[2]) : 4096;
+     rgba_t colors[NCOLORS] = { {0,0,1,1}, {1,1,1,1}, {1,0,0,1} };
+     colormap_t cmap;
+     cmap_lut lut;
+     REAL *vals, scale;
+     unsigned char *out, *ref_rgb, *ref_8bit;
+     const colormap_kernels *k;
+     int i, row, status = EXIT_SUCCESS;
+
+     if (width < 1 || rows < 1) {
+	  fprintf(stderr, "usage: colormap_bench [width] [rows]\n");
+	  return EXIT_FAILURE;
+     }
+
+     cmap.n = NCOLORS;
+     cmap.rgba = colors;
+     vals = (REAL *) malloc(width * sizeof(REAL));
+     out = (unsigned char *) malloc(width * 3);
+     ref_rgb = (unsigned char *) malloc(width * 3);
+     ref_8bit = (unsigned char *) malloc(width);
+     if (!vals || !out || !ref_rgb || !ref_8bit || init_lut(&lut, cmap,
+							      -1, 1, 0)) {
+	  fprintf(stderr, "colormap_bench: out of memory\n");
+	  return EXIT_FAILURE;
+     }
+     scale = 254.0 / (1 - -1);
+
+     /* values somewhat outside the range (and a NaN), to test pinning */
+     srand(1);
+     for (i = 0; i < width; ++i)
+	  vals[i] = rand() * 2.4 / RAND_MAX - 1.2;
+     vals[width / 2] = sqrt(-1.0);
+
+     colormap_kernels_all[0].rgb(vals, width, &lut, ref_rgb);
+     colormap_kernels_all[0].eight_bit(vals, width, -1, 1, scale, ref_8bit);
+
+     printf("%d x %d values; selected variant: %s\n", width, rows,
+	    get_colormap_kernels()->name);
+     printf("%-8s %14s %14s\n", "variant", "rgb Mpix/s", "8-bit Mpix/s");
+     for (k = colormap_kernels_all; k->name; ++k) {
+	  clock_t start;
+	  double t_rgb, t_8bit;
+
+	  if (!k->supported()) {
+	       printf("%-8s %14s %14s\n", k->name, "-", "-");
+	       continue;
+	  }
+
+	  memset(out, 0, width * 3);
+	  k->rgb(vals, width, &lut, out);
+	  if (memcmp(out, ref_rgb, width * 3)) {
+	       fprintf(stderr, "colormap_bench: %s rgb output differs\n",
+		       k->name);
+	       status = EXIT_FAILURE;
+	  }
+	  memset(out, 0, width);
+	  k->eight_bit(vals, width, -1, 1, scale, out);
+	  if (memcmp(out, ref_8bit, width)) {
+	       fprintf(stderr, "colormap_bench: %s 8-bit output differs\n",
+		       k->name);
+	       status = EXIT_FAILURE;
+	  }
+
+	  start = clock();
+	  for (row = 0; row < rows; ++row)
+	       k->rgb(vals, width, &lut, out);
+	  t_rgb = elapsed(start);
+	  start = clock();
+	  for (row = 0; row < rows; ++row)
+	       k->eight_bit(vals, width, -1, 1, scale, out);
+	  t_8bit = elapsed(start);
+
+	  printf("%-8s %14.1f %14.1f\n", k->name,
+		 t_rgb > 0 ? width * 1e-6 * rows / t_rgb : 0.0,
+		 t_8bit > 0 ? width * 1e-6 * rows / t_8bit : 0.0);
+     }
+
+     destroy_lut(&lut);
+     free(ref_8bit);
+     free(ref_rgb);
+     free(out);
+     free(vals);
+     return status;
+}
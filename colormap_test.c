@@ -0,0 +1,112 @@
+/* Copyright (c) 1999-2023 Massachusetts Institute of Technology
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/* Regression test (run by "make check") for the colormapping kernel
+   variants (see colormap.c) supported by this CPU, on data whose range
+   is not finite: every variant must stay within the LUT and give the
+   same output as the scalar kernels. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "config.h"
+#include "colormap.h"
+
+#define NCOLORS 3
+#define WIDTH 37 /* not a multiple of 16, to test the leftover pixels */
+
+/* colormap vals with every kernel variant, using the range of vals
+   (as h5topng does by default), returning the number of failures */
+static int test_vals(const char *name, const REAL *vals, colormap_t cmap)
+{
+     REAL min = vals[0], max = vals[0], scale;
+     unsigned char ref_rgb[3*WIDTH], ref_8bit[WIDTH], out[3*WIDTH];
+     cmap_lut lut;
+     const colormap_kernels *k;
+     int i, failures = 0;
+
+     for (i = 1; i < WIDTH; ++i) {
+	  if (vals[i] < min)
+	       min = vals[i];
+	  if (vals[i] > max)
+	       max = vals[i];
+     }
+     if (init_lut(&lut, cmap, min, max, 0)) {
+	  fprintf(stderr, "colormap_test: out of memory\n");
+	  exit(EXIT_FAILURE);
+     }
+     scale = range_scale(&min, &max, 254.0);
+
+     colormap_kernels_all[0].rgb(vals, WIDTH, &lut, ref_rgb);
+     colormap_kernels_all[0].eight_bit(vals, WIDTH, min, max, scale,
+				       ref_8bit);
+     for (k = colormap_kernels_all; k->name; ++k) {
+	  if (!k->supported())
+	       continue;
+	  memset(out, 0, sizeof(out));
+	  k->rgb(vals, WIDTH, &lut, out);
+	  if (memcmp(out, ref_rgb, sizeof(ref_rgb))) {
+	       fprintf(stderr, "colormap_test: %s: %s rgb output differs\n",
+		       name, k->name);
+	       ++failures;
+	  }
+	  memset(out, 0, sizeof(out));
+	  k->eight_bit(vals, WIDTH, min, max, scale, out);
+	  if (memcmp(out, ref_8bit, sizeof(ref_8bit))) {
+	       fprintf(stderr, "colormap_test: %s: %s 8-bit output differs\n",
+		       name, k->name);
+	       ++failures;
+	  }
+	  printf("%-8s %s: %s\n", k->name, name,
+		 failures ? "FAIL" : "ok");
+     }
+     destroy_lut(&lut);
+     return failures;
+}
+
+int main(void)
+{
+     rgba_t colors[NCOLORS] = { {0,0,1,1}, {1,1,1,1}, {1,0,0,1} };
+     colormap_t cmap;
+     REAL vals[WIDTH];
+     int i, failures = 0;
+
+     cmap.n = NCOLORS;
+     cmap.rgba = colors;
+
+     for (i = 0; i < WIDTH; ++i)
+	  vals[i] = i;
+     vals[WIDTH / 2] = HUGE_VAL;
+     failures += test_vals("inf element", vals, cmap);
+
+     vals[WIDTH / 2] = -HUGE_VAL;
+     vals[WIDTH - 1] = HUGE_VAL;
+     failures += test_vals("+/-inf elements", vals, cmap);
+
+     for (i = 0; i < WIDTH; ++i)
+	  vals[i] = sqrt(-1.0);
+     failures += test_vals("all NaN", vals, cmap);
+
+     return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -32,6 +32,11 @@
 #include "arrayh5.h"
 #include "copyright.h"
 #include "writepng.h"
+#include "colormap.h"
+#include "qsketch.h"
+#include "rangefile.h"
+#include "project.h"
+#include "serve.h"
 #include "h5utils.h"
 
 #define CHECK(cond, msg) { if (!(cond)) { fprintf(stderr, "h5topng error: %s\n", msg); exit(EXIT_FAILURE); } }
@@ -39,26 +44,19 @@
 #define CMAP_DEFAULT "gray"
 #define OVERLAY_CMAP_DEFAULT "yellow"
 #define OVERLAY_OPACITY_DEFAULT 0.2
-#define CMAP_DIR DATADIR "/" PACKAGE_NAME "/colormaps/"
 
-#if defined(HAVE_WORDEXP) && defined(HAVE_WORDEXP_H)
-#  include <wordexp.h>
-#endif
-
-/* shell expansion on a path, used for CMAP_DIR */
-char *shell_expand(const char *path)
-{
-#if defined(HAVE_WORDEXP) && defined(HAVE_WORDEXP_H)
-	wordexp_t p;
-	char *newpath;
-	wordexp(path, &p, 0);
-	newpath = my_strdup(p.we_wordc == 1 ? p.we_wordv[0] : path);
-	wordfree(&p);
-	return newpath;
+/* --serve is a long name for -L */
+#ifdef HAVE_GETOPT_LONG
+#  include <getopt.h>
+static const struct option long_options[] = {
+     { "serve", required_argument, NULL, 'L' },
+     { NULL, 0, NULL, 0 }
+};
+#  define GETOPT(argc, argv, opts) \
+     getopt_long(argc, argv, opts, long_options, NULL)
 #else
-	return my_strdup(path);
+#  define GETOPT(argc, argv, opts) getopt(argc, argv, opts)
 #endif
-}
 
 void usage(FILE *f)
 {
@@ -68,14 +66,30 @@ void usage(FILE *f)
              "         -V : print version number and copyright\n"
 	     "         -v : verbose output\n"
 	     "  -o <file> : output to <file> (first input file only)\n"
+	     "              -- or -o - to write all images to stdout\n"
+	     "   -O <fmt> : output format: png, qoi, ppm, or rgb (raw RGB24)\n"
+	     "              [default: png],\n"
+	     "              or dzi[:<size>] for a Deep Zoom pyramid of <size> tiles\n"
+	     "  -L <addr> : rather than writing files, serve images of slices on\n"
+	     "              demand at the local TCP port or Unix socket <addr>\n"
+	     "              (also --serve <addr>)\n"
 	     "    -x <ix> : take x=<ix> slice of data (or <min>:<inc>:<max>)\n"
 	     "    -y <iy> : take y=<iy> slice of data\n"
 	     "    -z <iz> : take z=<iz> slice of data\n"
 	     "    -t <it> : take t=<it> slice of data's last dimension\n"
 	     "         -0 : use dataset center as origin for -x/-y/-z\n"
+	     "         -3 : output the xy, xz and yz slices through the point given\n"
+	     "              by -x/-y/-z (default: the center) of 3d data\n"
+	     "  -I <op>:<d> : output the max, min, mean or maxabs (max |value|)\n"
+	     "              of the data along dimension <d> (x/y/z/t), e.g. max:z\n"
 	     "    -X <sx> : scale width by <sx> [ default: 1.0 ]\n"
 	     "    -Y <sy> : scale height by <sy> [ default: 1.0 ]\n"
 	     "     -S <s> : equivalent to -X <s> -Y <s>\n"
+	     "  -e <name>[:<settings>] : also write each image with other\n"
+	     "              settings, from the same data, to a file with .<name>\n"
+	     "              before the suffix; <settings> is a comma-separated\n"
+	     "              list of o=<file>, X=/Y=/S=<scale>, c=<cmap>, m=<min>\n"
+	     "              and M=<max> (e.g. -e thumb:S=0.25 -e jet:c=jet)\n"
 	     "  -s <skew> : skew axes by <skew> degrees [ default: 0 ]\n"
 	     "         -T : transpose the data [default: no]\n"
 	     "  -c <cmap> : use colormap <cmap> [default: " CMAP_DEFAULT "]\n"
@@ -85,136 +99,46 @@ void usage(FILE *f)
 	     "   -m <min> : set bottom of color scale to data value <min>\n"
 	     "   -M <max> : set top of color scale to data value <max>\n"
 	     "         -R : use uniform colormap range for all files\n"
+	     "  -P <lo>:<hi> : set colormap range to the <lo> and <hi> percentiles\n"
+	     "              of the data (e.g. 0.5:99.5; -P <p> means <p>:100-<p>)\n"
+	     "  -w <file> : write the range of all the data to a range file,\n"
+	     "              without writing images unless -R is given\n"
+	     "  -u <file> : use the colormap range from a range file written by -w\n"
+	     "              (several -u files are merged)\n"
 	     "  -C <file> : superimpose contour outlines from <file>\n"
 	     "   -b <val> : contours around values != <val> [default: 1.0]\n"
+	     "              -- or -b <v1>,<v2>,... for contours at several\n"
+	     "              levels, each in a different color\n"
 	     "  -A <file> : overlay data from <file>, as specified by -y\n"
 "  -a <c>:<o>: overlay colormap <c>, opacity <o> (0-1) [default: %s:%g]\n"
 "         -8 : use an 8-bit color table, instead of 24-bit direct color\n"
+	     "    -B <mb> : read 2d slices bigger than <mb> megabytes in bands of\n"
+	     "              rows, instead of all at once, to bound memory use\n"
+	     "              (-P percentiles may then differ very slightly)\n"
+	     "     -W <w> : scale the image down to at most <w> pixels wide, reading\n"
+	     "              only about the data needed for that (for previews)\n"
+	     "     -H <h> : likewise, scale the image to at most <h> pixels high\n"
+	     "     -j <n> : process <n> slices/files in parallel (0: #cpus)\n"
+	     "  -p <spec> : PNG compression: fastest, fast, default, small, smallest,\n"
+	     "              0-9, none/sub/up/avg/paeth/adaptive, filtered/huffman/rle/fixed\n"
+	     "  -F <file> : output all slices/files as frames of an animated PNG\n"
+	     "   -f <fps> : frames per second for -F [default: 10]\n"
+	     "         -D : only store the changed pixels of each -F frame\n"
+	     "  -G <file> : output all slices/files as the tiles of one image <file>\n"
+	     "              (a contact sheet), using a common colormap range\n"
+	     "     -g <n> : the number of columns of tiles for -G [default: ~square]\n"
 	     "  -d <name> : use dataset <name> in the input files (default: first dataset)\n"
 	     "              -- you can also specify a dataset via <filename>:<name>\n",
 	  OVERLAY_CMAP_DEFAULT, OVERLAY_OPACITY_DEFAULT);
 }
 
-rgba_t gray_colors[2] = { {1,1,1,0}, {0,0,0,1} };
-colormap_t gray_cmap = { 2, gray_colors };
-
-rgba_t yellow_colors[2] = { {1,1,1,0}, {1,1,0,1} };
-colormap_t yellow_cmap = {2, yellow_colors};
-
-static colormap_t load_colormap(FILE *f, int verbose)
+/* get_colormap, exiting on failure */
+static colormap_t get_cmap(const char *colormap, int invert,
+			   double scale_alpha, int verbose)
 {
-     colormap_t cmap = {0, NULL};
-     int nalloc = 0;
-     float r,g,b,a;
-     int c;
-
-     /* read initial comment lines, and echo if verbose */
-     do {
-	  while (isspace(c = fgetc(f)));
-	  if (c == '#' || c == '%') {
-	       while (isspace(c = fgetc(f)) && c != '\n' && c != EOF);
-	       if (c != EOF) ungetc(c, f);
-	       while ('\n' != (c = fgetc(f)) && c != EOF)
-		    if (verbose)
-			 putchar(c);
-	       if (verbose)
-		    putchar('\n');
-	  }
-     } while (c == '\n');
-     if (c != EOF) ungetc(c, f);
-
-     while (4 == fscanf(f, "%g %g %g %g", &r, &g, &b, &a)) {
-	  if (cmap.n >= nalloc) {
-	       nalloc = (1 + nalloc) * 2;
-	       cmap.rgba = realloc(cmap.rgba, nalloc * sizeof(rgba_t));
-	       CHECK(cmap.rgba, "out of memory");
-	  }
-	  cmap.rgba[cmap.n].r = r;
-	  cmap.rgba[cmap.n].g = g;
-	  cmap.rgba[cmap.n].b = b;
-	  cmap.rgba[cmap.n].a = a;
-	  cmap.n++;
-     }
-     cmap.rgba = realloc(cmap.rgba, cmap.n * sizeof(rgba_t));
-     CHECK(cmap.n >= 1, "invalid colormap file");
-     if (verbose)
-	  printf("%d color entries read from colormap file.\n", cmap.n);
-     return cmap;
-}
-
-colormap_t copy_colormap(const colormap_t c0)
-{
-     colormap_t c;
-     int i;
-     c.n = c0.n;
-     c.rgba = (rgba_t *) malloc(c.n * sizeof(rgba_t));
-     CHECK(c.rgba, "out of memory");
-     for (i = 0; i < c.n; ++i)
-	  c.rgba[i] = c0.rgba[i];
-     return c;
-}
-
-colormap_t get_cmap(const char *cmap_dir,
-                    const char *colormap, int invert, double scale_alpha,
-                    int verbose)
-{
-     int i;
-     colormap_t cmap = {0, NULL};
-     FILE *cmap_f = NULL;
-     char *cmap_fname = (char *) malloc(sizeof(char) *
-					(strlen(cmap_dir)
-					 + strlen(colormap) + 1));
-     CHECK(cmap_fname, "out of memory");
-     if (colormap[0] == '-') {
-	  invert = 1;
-	  colormap++;
-     }
-     strcpy(cmap_fname, cmap_dir); strcat(cmap_fname, colormap);
-     if (colormap[0] == '.' || colormap[0] == '/'
-	 || !(cmap_f = fopen(cmap_fname, "r"))) {
-	  free(cmap_fname);
-	  cmap_fname = my_strdup(colormap);
-	  if (!(cmap_f = fopen(cmap_fname, "r"))) {
-	       if (!strcmp(colormap, "gray"))
-		    cmap = gray_cmap;
-	       if (!strcmp(colormap, "yellow"))
-		    cmap = yellow_cmap;
-	       else {
-		    fprintf(stderr, "Could not find colormap \"%s\"\n",
-			    colormap);
-		    exit(EXIT_FAILURE);
-	       }
-	  }
-     }
-     if (cmap.rgba == gray_colors) {
-	  if (verbose)
-	       printf("Using built-in gray colormap%s.\n",
-		      invert ? " (inverted)" : "");
-	  cmap = copy_colormap(cmap);
-     }
-     else if (cmap.rgba == yellow_colors) {
-	  if (verbose)
-	       printf("Using built-in yellow colormap%s.\n",
-		      invert ? " (inverted)" : "");
-	  cmap = copy_colormap(cmap);
-     }
-     else {
-	  if (verbose)
-	       printf("Using colormap \"%s\" in file \"%s\"%s.\n",
-		      colormap, cmap_fname, invert ? " (inverted)" : "");
-	  cmap = load_colormap(cmap_f, verbose);
-	  fclose(cmap_f);
-     }
-     free(cmap_fname);
-     if (invert)
-	  for (i = 0; i < cmap.n - 1 - i; ++i) {
-	       rgba_t rgba = cmap.rgba[i];
-	       cmap.rgba[i] = cmap.rgba[cmap.n - 1 - i];
-	       cmap.rgba[cmap.n - 1 - i] = rgba;
-	  }
-     if (verbose) printf("Scaling opacity by %g\n", scale_alpha);
-     for (i = 0; i < cmap.n; ++i)
-	  cmap.rgba[i].a *= scale_alpha;
+     colormap_t cmap;
+     if (get_colormap(&cmap, colormap, invert, scale_alpha, verbose))
+	  exit(EXIT_FAILURE);
      return cmap;
 }
 
@@ -235,6 +159,7 @@ static int get_islice(const char *s, int *min, int *max, int *step)
 
 static int iabs(int x) { return x < 0 ? -x : x; }
 static int imax(int x, int y) { return x > y ? x : y; }
+static int imin(int x, int y) { return x < y ? x : y; }
 static int ilog10(int x) {
      int lg = 0, prod = 1;
      while (prod < x) {
@@ -244,45 +169,1812 @@ static int ilog10(int x) {
      return lg - 1;
 }
 
+/* the maximum number of -b contour levels */
+#define MAX_LEVELS 255
+
+static int cmp_levels(const void *a, const void *b)
+{
+     REAL x = *(const REAL *) a, y = *(const REAL *) b;
+     return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/* -e: another image of each frame, from the same data but with its own
+   output file, scale, colormap and/or range (each 0 or unset to use
+   those of the main image) */
+typedef struct {
+     char *name; /* inserted before the suffix of the output files */
+     char *fname; /* the output file for the first frame, like -o */
+     char *colormap;
+     double scalex, scaley;
+     double min, max;
+     int min_set, max_set;
+     colormap_t cmap; /* rgba is NULL if colormap is NULL */
+} variant;
+
+/* settings that are the same for every frame that we output */
+typedef struct {
+     char **fnames;
+     int nfiles;
+     char *data_name, *png_fname, *contour_fname, *overlay_fname;
+     char *apng_fname; /* animated PNG that all frames are written to */
+     char *montage_fname; /* or montage that they are the tiles of */
+     const char *suffix; /* of the output files, e.g. ".png" */
+     REAL mask_thresh;
+     int mask_thresh_set;
+     double min, max;
+     int min_set, max_set, zero_center;
+     int percentiles; /* range from the percentiles plo and phi (0-1) */
+     double plo, phi;
+     double band_budget; /* -B: bytes of data to read at once, or 0 */
+     int max_width, max_height; /* -W/-H: maximum image size, or 0 */
+     int ortho; /* -3: the three planes through the point given by islice */
+     int project_op, project_dim; /* -I: projection along dimension
+				     0-3 (3 = last), or project_op = -1 */
+     int slicedim[4], center_slice[4];
+     int islice_min[4], islice_max[4], islice_step[4];
+     int data_rank;
+     colormap_t cmap, overlay_cmap;
+     int verbose, transpose, eight_bit;
+     double scalex, scaley, skew;
+     variant *variants; /* -e */
+     int nvariants;
+} settings;
+
+/* contour and overlay data, which are shared by all of the files for
+   a given slice, and are kept for as long as the slice they were read
+   at is the same: e.g. a layer of lower rank than the data is not
+   sliced in the last dimension, so with -t it is only read once */
+typedef struct {
+     arrayh5 contour_data, overlay_data; /* data is NULL if not loaded */
+     int contour_slicedim[4], contour_islice[4]; /* slice read at */
+     int overlay_slicedim[4], overlay_islice[4];
+     int cnx, cny, onx, ony;
+     REAL mask_thresh;
+     /* the decimation (see decimate) that they were read for */
+     int data_dims[2], stride[2];
+     int cached; /* whether writepng is keeping their rendered layers */
+} layers;
+
+static int num_islices(const settings *s, int dim)
+{
+     if (s->islice_max[dim] < s->islice_min[dim])
+	  return 0;
+     return (s->islice_max[dim] - s->islice_min[dim]) / s->islice_step[dim] + 1;
+}
+
+/* Each (slice, file) pair is a "frame", numbered in the order of the
+   nested slice loops (t fastest) and then the files; get_frame
+   computes the slice indices and file number of frame iframe. */
+static int num_frames(const settings *s)
+{
+     int dim, n = s->nfiles;
+     for (dim = 0; dim < 4; ++dim)
+	  n *= num_islices(s, dim);
+     return n;
+}
+
+static void get_frame(const settings *s, int iframe, int *islice,
+		      int *islice_index, int *ifile)
+{
+     int dim, i;
+     *ifile = iframe % s->nfiles;
+     i = *islice_index = iframe / s->nfiles;
+     for (dim = 3; dim >= 0; --dim) {
+	  int n = num_islices(s, dim);
+	  islice[dim] = s->islice_min[dim] + (i % n) * s->islice_step[dim];
+	  i /= n;
+     }
+}
+
+/* the size dims[0] x dims[1] (1 if one dimensional) of the slice of
+   fname at islice, found by reading just its first row; returns the
+   rank of the slice */
+static int slice_dims(const char *fname, const char *dname,
+		      const int *slicedim, const int *islice,
+		      const int *center_slice, int *dims)
+{
+     arrayh5 a;
+     int n, rank, err;
+
+     err = arrayh5_read_band(&a, fname, dname, 4, slicedim, islice,
+			     center_slice, 0, 0, 1, &n);
+     CHECK(!err, arrayh5_read_strerror[err]);
+     rank = a.rank;
+     dims[0] = n;
+     dims[1] = rank >= 2 ? a.dims[1] : 1;
+     arrayh5_destroy(a);
+     return rank;
+}
+
+/* With -W/-H, we only read every stride[i]-th element along dimension i
+   of a slice of size dims[0] x dims[1] that is much bigger than the
+   image, with the scale factors *scalex and *scaley (for -X and -Y)
+   adjusted to fit the image within the maximum size for the data that
+   is read. */
+static void decimate(const settings *s, const int *dims, int *stride,
+		     double *scalex, double *scaley)
+{
+     /* the image width is along dimension 0 of the data unless -T */
+     int i, wdim = s->transpose ? 1 : 0;
+     double wskew = 1 + fabs(sin(s->skew)), hskew = cos(s->skew);
+     double width = dims[wdim] * s->scalex * wskew;
+     double height = dims[1-wdim] * s->scaley * hskew;
+     double f = 1;
+
+     stride[0] = stride[1] = 1;
+     *scalex = s->scalex;
+     *scaley = s->scaley;
+     if (s->max_width > 0 && width > s->max_width)
+	  f = s->max_width / width;
+     if (s->max_height > 0 && height * f > s->max_height)
+	  f = s->max_height / height;
+     if (f == 1)
+	  return;
+     *scalex *= f;
+     *scaley *= f;
+     for (i = 0; i < 2; ++i) {
+	  double *scale = i == wdim ? scalex : scaley;
+	  /* pixels per element along dimension i */
+	  double c = *scale * (i == wdim ? wskew : hskew);
+	  if (c > 0 && c < 1) {
+	       double k = floor(1 / c);
+	       int m;
+	       stride[i] = (int) k;
+	       m = (dims[i] + stride[i] - 1) / stride[i];
+	       *scale *= dims[i] / (double) m;
+	  }
+     }
+}
+
+/* layer a, which repeats periodically over the data, at the elements
+   of data of size dims[0] x dims[1] that are read with stride */
+static arrayh5 decimate_layer(arrayh5 a, const int *dims, const int *stride)
+{
+     int m[2], i, j, an = a.dims[0], am = a.rank >= 2 ? a.dims[1] : 1;
+     arrayh5 b;
+
+     m[0] = (dims[0] + stride[0] - 1) / stride[0];
+     m[1] = (dims[1] + stride[1] - 1) / stride[1];
+     b = arrayh5_create(2, m);
+     for (i = 0; i < m[0]; ++i)
+	  for (j = 0; j < m[1]; ++j)
+	       b.data[i * m[1] + j] = a.data[((i * stride[0]) % an) * am
+					     + (j * stride[1]) % am];
+     arrayh5_destroy(a);
+     return b;
+}
+
+/* read a contour or overlay slice, which can be of lower rank than the
+   data (in which case it is not sliced in the last dimension), also
+   returning the slice dimensions used; if the data is read with stride
+   (see decimate), so is the layer, if it is the same size dims as the
+   data, or else it is resampled to match */
+static void read_layer(const settings *s, char *layer_fname,
+		       const char *what, const int *islice,
+		       const int *dims, const int *stride,
+		       arrayh5 *a, int *slicedim)
+{
+     int rank, err, ldims[2];
+     char *fname, *dname;
+
+     fname = split_fname(layer_fname, &dname);
+     if (!dname[0])
+	  dname = NULL;
+
+     if (s->verbose)
+	  printf("reading %s data from \"%s\".\n", what, fname);
+
+     err = arrayh5_read_rank(fname, dname, &rank);
+     CHECK(!err, arrayh5_read_strerror[err]);
+     memcpy(slicedim, s->slicedim, 4 * sizeof(int));
+     if (slicedim[3] == LAST_SLICE_DIM && s->data_rank > rank)
+	  slicedim[3] = NO_SLICE_DIM;
+
+     if (stride[0] > 1 || stride[1] > 1) {
+	  rank = slice_dims(fname, dname, slicedim, islice, s->center_slice,
+			    ldims);
+	  CHECK(rank == 1 || rank == 2,
+		"contour/overlay slice must be one or two dimensional");
+	  if (ldims[0] == dims[0] && ldims[1] == dims[1]) {
+	       err = arrayh5_read_strided(a, NULL, fname, dname, 4, slicedim,
+					  islice, s->center_slice, stride);
+	       CHECK(!err, arrayh5_read_strerror[err]);
+	       free(fname);
+	       return;
+	  }
+     }
+
+     err = arrayh5_read(a, fname, dname, NULL,
+			4, slicedim, islice, s->center_slice);
+     CHECK(!err, arrayh5_read_strerror[err]);
+     CHECK(a->rank == 1 || a->rank == 2,
+	   "contour/overlay slice must be one or two dimensional");
+     if (stride[0] > 1 || stride[1] > 1)
+	  *a = decimate_layer(*a, dims, stride);
+
+     free(fname);
+}
+
+static void init_layers(layers *l)
+{
+     memset(l, 0, sizeof(layers));
+     l->contour_data.data = l->overlay_data.data = NULL;
+     l->cnx = l->cny = l->onx = l->ony = 1;
+     l->stride[0] = l->stride[1] = 1;
+}
+
+static void destroy_layers(layers *l)
+{
+     if (l->contour_data.data)
+	  arrayh5_destroy(l->contour_data);
+     if (l->overlay_data.data)
+	  arrayh5_destroy(l->overlay_data);
+     init_layers(l);
+     writepng_cache_layers(0);
+}
+
+/* whether layer a, read at slice islice0 of slicedim, is the same at
+   slice islice */
+static int same_layer(const arrayh5 *a, const int *slicedim,
+		      const int *islice0, const int *islice)
+{
+     int dim;
+     if (!a->data)
+	  return 0;
+     for (dim = 0; dim < 4; ++dim)
+	  if (slicedim[dim] != NO_SLICE_DIM && islice0[dim] != islice[dim])
+	       return 0;
+     return 1;
+}
+
+/* load the layers for the data at islice, of size dims[0] x dims[1]
+   and read with stride */
+static void load_layers(const settings *s, const int *islice,
+			const int *dims, const int *stride, layers *l)
+{
+     int changed = 0;
+
+     /* the layers were decimated for different data: reread them */
+     if (l->stride[0] != stride[0] || l->stride[1] != stride[1]
+	 || ((stride[0] > 1 || stride[1] > 1)
+	     && (l->data_dims[0] != dims[0] || l->data_dims[1] != dims[1]))) {
+	  if (l->contour_data.data)
+	       arrayh5_destroy(l->contour_data);
+	  if (l->overlay_data.data)
+	       arrayh5_destroy(l->overlay_data);
+	  l->contour_data.data = l->overlay_data.data = NULL;
+	  memcpy(l->data_dims, dims, 2 * sizeof(int));
+	  memcpy(l->stride, stride, 2 * sizeof(int));
+     }
+
+     if (s->contour_fname && !same_layer(&l->contour_data,
+					 l->contour_slicedim,
+					 l->contour_islice, islice)) {
+	  if (l->contour_data.data)
+	       arrayh5_destroy(l->contour_data);
+	  read_layer(s, s->contour_fname, "contour", islice, dims, stride,
+		     &l->contour_data, l->contour_slicedim);
+	  memcpy(l->contour_islice, islice, 4 * sizeof(int));
+	  changed = 1;
+	  l->mask_thresh = s->mask_thresh;
+	  l->cnx = l->contour_data.dims[0];
+	  l->cny = l->contour_data.rank >= 2 ? l->contour_data.dims[1] : 1;
+	  if (!s->mask_thresh_set) {
+               double c_min, c_max;
+               arrayh5_getrange(l->contour_data, &c_min, &c_max);
+	       l->mask_thresh = (c_min + c_max) * 0.5;
+	  }
+     }
+
+     if (s->overlay_fname && !same_layer(&l->overlay_data,
+					 l->overlay_slicedim,
+					 l->overlay_islice, islice)) {
+	  if (l->overlay_data.data)
+	       arrayh5_destroy(l->overlay_data);
+	  read_layer(s, s->overlay_fname, "overlay", islice, dims, stride,
+		     &l->overlay_data, l->overlay_slicedim);
+	  memcpy(l->overlay_islice, islice, 4 * sizeof(int));
+	  changed = 1;
+	  l->onx = l->overlay_data.dims[0];
+	  l->ony = l->overlay_data.rank >= 2 ? l->overlay_data.dims[1] : 1;
+     }
+
+     /* the layers rendered by writepng can be reused until they change,
+	but that is only worth it once they are actually used again (and
+	not for a single image, or for layers that change every frame) */
+     if (changed) {
+	  writepng_cache_layers(0);
+	  l->cached = 0;
+     }
+     else if (!l->cached && (s->contour_fname || s->overlay_fname)) {
+	  writepng_cache_layers(1);
+	  l->cached = 1;
+     }
+}
+
+/* the colormap range of a frame whose data ranges from a_min to a_max,
+   where fq is a sketch of its data (only needed for -P) */
+static void frame_range(const settings *s, double a_min, double a_max,
+			qsketch *fq, double *min_, double *max_)
+{
+     if (s->percentiles && !(s->min_set && s->max_set)) {
+	  a_min = qsketch_quantile(fq, s->plo);
+	  a_max = qsketch_quantile(fq, s->phi);
+	  if (s->verbose)
+	       printf("percentiles %g%% to %g%% range from %g to %g.\n",
+		      s->plo * 100, s->phi * 100,
+		      s->min_set ? s->min : a_min, s->max_set ? s->max : a_max);
+     }
+     colormap_range(a_min, a_max, s->min, s->min_set, s->max, s->max_set,
+		    s->zero_center, min_, max_);
+}
+
+/* parse the -e argument <name>[:<key>=<value>,...] into v */
+static void parse_variant(const char *arg, variant *v)
+{
+     char *opts, *opt;
+
+     memset(v, 0, sizeof(variant));
+     v->name = my_strdup(arg); /* the other strings point into it */
+     opts = strchr(v->name, ':');
+     if (opts)
+	  *opts++ = 0;
+     CHECK(v->name[0] && !strchr(v->name, '/'), "invalid name for -e");
+     for (opt = opts ? strtok(opts, ",") : NULL; opt;
+	  opt = strtok(NULL, ",")) {
+	  char *val = strchr(opt, '=');
+	  CHECK(val && val - opt == 1 && val[1], "invalid -e setting");
+	  ++val;
+	  switch (opt[0]) {
+	      case 'o': v->fname = val; break;
+	      case 'c': v->colormap = val; break;
+	      case 'X': v->scalex = atof(val); break;
+	      case 'Y': v->scaley = atof(val); break;
+	      case 'S': v->scalex = v->scaley = atof(val); break;
+	      case 'm': v->min = atof(val); v->min_set = 1; break;
+	      case 'M': v->max = atof(val); v->max_set = 1; break;
+	      default: CHECK(0, "invalid -e setting");
+	  }
+	  if (strchr("XYS", opt[0]))
+	       CHECK(atof(val) > 0, "-e scale must be positive");
+     }
+}
+
+/* the settings for writing the -e variant i of an image, or s itself
+   for i < 0 */
+static void variant_settings(const settings *s, int i, settings *vs)
+{
+     const variant *v;
+
+     *vs = *s;
+     if (i < 0)
+	  return;
+     v = s->variants + i;
+     if (v->fname)
+	  vs->png_fname = v->fname;
+     if (v->cmap.rgba)
+	  vs->cmap = v->cmap;
+     if (v->scalex > 0)
+	  vs->scalex = v->scalex;
+     if (v->scaley > 0)
+	  vs->scaley = v->scaley;
+     if (v->min_set) {
+	  vs->min = v->min;
+	  vs->min_set = 1;
+     }
+     if (v->max_set) {
+	  vs->max = v->max;
+	  vs->max_set = 1;
+     }
+}
+
+/* whether the colormap range of any image of a frame (including the -e
+   variants) needs the quantiles of its data */
+static int need_quantiles(const settings *s)
+{
+     int i;
+
+     if (!s->percentiles)
+	  return 0;
+     for (i = -1; i < s->nvariants; ++i) {
+	  settings vs;
+	  variant_settings(s, i, &vs);
+	  if (!(vs.min_set && vs.max_set))
+	       return 1;
+     }
+     return 0;
+}
+
+/* the output file name for frame iframe, read from h5_fname, or for
+   its plane view ("xy" etc.) with -3 or its -e variant if view is not
+   NULL */
+static char *frame_fname(const settings *s, int iframe, const int *islice,
+			 const char *h5_fname, const char *view)
+{
+     char dimname[] = "xyzt", suff[1024] = "";
+     int dim;
+
+     if (s->png_fname && (iframe == 0 || !strcmp(s->png_fname, "-"))) {
+	  if (view && strcmp(s->png_fname, "-")) {
+	       sprintf(suff, ".%s%s", view, s->suffix);
+	       return replace_suffix(s->png_fname, s->suffix, suff);
+	  }
+	  return my_strdup(s->png_fname);
+     }
+     for (dim = 0; dim < 4; ++dim)
+	  if (s->islice_max[dim] >=
+	      s->islice_min[dim] + s->islice_step[dim]) {
+	       char str[128];
+	       sprintf(str, ".%c%0*d", dimname[dim],
+		       1 + ilog10(imax(iabs(s->islice_min[dim]),
+				       iabs(s->islice_max[dim]))),
+		       islice[dim]);
+	       strcat(suff, str);
+	  }
+     if (view) {
+	  strcat(suff, ".");
+	  strcat(suff, view);
+     }
+     strcat(suff, s->suffix);
+     return replace_suffix(h5_fname, ".h5", suff);
+}
+
+/***********************************************************************/
+/* With -B, a 2d slice bigger than the memory budget is not read all at
+   once: instead, writepng_stream asks for the rows of the image that it
+   needs for each band of the PNG, and we read just the corresponding
+   rows (or columns) of the slice, and of the contour and overlay slices.
+   This means reading the data twice if we need its range first. */
+
+/* A slice that is read in bands of elements along dimension banddim,
+   which is the dimension along the rows of the image.  Contour and
+   overlay layers repeat periodically to the size of the data, so their
+   row r is row r % p of the layer. */
+typedef struct {
+     char *fname, *dname;
+     int slicedim[4];
+     const int *islice, *center_slice;
+     int banddim;
+     int p, q; /* size along banddim and along the other dimension */
+     arrayh5 whole; /* the whole slice, if it is small enough */
+} stream_layer;
+
+/* Open the slice at islice of fname (with dataset dname), of rank <=
+   max_rank, finding its size without reading it, unless it is smaller
+   than max_bytes (or one dimensional) in which case it is read whole.
+   Returns an arrayh5_read error code, or -1 if the rank is too big. */
+static int open_stream_layer(stream_layer *L, const char *fname,
+			     const char *dname, const int *slicedim,
+			     const int *islice, const int *center_slice,
+			     int banddim, int max_rank, double max_bytes)
+{
+     arrayh5 a;
+     int n, err;
+
+     L->fname = my_strdup(fname);
+     L->dname = dname ? my_strdup(dname) : NULL;
+     memcpy(L->slicedim, slicedim, 4 * sizeof(int));
+     L->islice = islice;
+     L->center_slice = center_slice;
+     L->banddim = banddim;
+     L->whole.data = NULL;
+
+     /* the first element along dimension 0 tells us the rank and size */
+     err = arrayh5_read_band(&a, L->fname, L->dname, 4, L->slicedim,
+			     islice, center_slice, 0, 0, 1, &n);
+     if (err)
+	  return err;
+     if (a.rank < 1 || a.rank > max_rank) {
+	  arrayh5_destroy(a);
+	  return -1;
+     }
+     if (a.rank == 1) {
+	  L->p = banddim ? 1 : n;
+	  L->q = banddim ? n : 1;
+     }
+     else {
+	  L->p = banddim ? a.dims[1] : n;
+	  L->q = banddim ? n : a.dims[1];
+     }
+     arrayh5_destroy(a);
+
+     if (L->q == 1 || L->p == 1 || L->p * (double) L->q * sizeof(REAL)
+	 <= max_bytes)
+	  return arrayh5_read(&L->whole, L->fname, L->dname, NULL, 4,
+			      L->slicedim, islice, center_slice);
+     return 0;
+}
+
+static void close_stream_layer(stream_layer *L)
+{
+     if (L->whole.data)
+	  arrayh5_destroy(L->whole);
+     L->whole.data = NULL;
+     free(L->dname);
+     free(L->fname);
+}
+
+/* read rows k0..k1-1 of the layer into a (or return the whole layer) */
+static const REAL *read_stream_band(const stream_layer *L, int k0, int k1,
+				    arrayh5 *a, int *nb)
+{
+     int n, err;
+     if (L->whole.data) {
+	  *nb = L->p;
+	  return L->whole.data + (L->banddim ? (size_t) k0 : k0 * (size_t) L->q);
+     }
+     err = arrayh5_read_band(a, L->fname, L->dname, 4, L->slicedim,
+			     L->islice, L->center_slice,
+			     L->banddim, k0, k1, &n);
+     CHECK(!err, arrayh5_read_strerror[err]);
+     *nb = k1 - k0;
+     return a->data;
+}
+
+/* the range of the layer, read chunk rows at a time, adding the data to
+   the sketch q if it is not NULL */
+static void stream_layer_range(const stream_layer *L, int chunk,
+			       double *min, double *max, qsketch *q)
+{
+     int k0;
+     if (L->whole.data) {
+	  arrayh5_getrange(L->whole, min, max);
+	  if (q)
+	       CHECK(!qsketch_add(q, L->whole.data, L->whole.N),
+		     "out of memory");
+	  return;
+     }
+     for (k0 = 0; k0 < L->p; k0 += chunk) {
+	  arrayh5 a;
+	  double amin, amax;
+	  int nb;
+	  read_stream_band(L, k0, k0 + chunk, &a, &nb);
+	  arrayh5_getrange(a, &amin, &amax);
+	  if (k0 == 0 || amin < *min)
+	       *min = amin;
+	  if (k0 == 0 || amax > *max)
+	       *max = amax;
+	  if (q)
+	       CHECK(!qsketch_add(q, a.data, a.N), "out of memory");
+	  arrayh5_destroy(a);
+     }
+}
+
+/* store rows n0..n1-1 of the (periodically repeated) layer as rows of
+   width elements in out */
+static void fill_stream_rows(const stream_layer *L, int n0, int n1,
+			     int width, REAL *out)
+{
+     int r = n0;
+     while (r < n1) {
+	  int k0 = r % L->p, k1 = k0 + (n1 - r) < L->p ? k0 + (n1 - r) : L->p;
+	  int k, c, nb;
+	  arrayh5 a;
+	  const REAL *d = read_stream_band(L, k0, k1, &a, &nb);
+
+	  for (k = 0; k < k1 - k0; ++k, ++r) {
+	       REAL *row = out + (r - n0) * (size_t) width;
+	       if (L->banddim) /* transpose the columns into rows */
+		    for (c = 0; c < width; ++c)
+			 row[c] = d[(c % L->q) * (size_t) nb + k];
+	       else
+		    for (c = 0; c < width; ++c)
+			 row[c] = d[k * (size_t) L->q + c % L->q];
+	  }
+	  if (!L->whole.data)
+	       arrayh5_destroy(a);
+     }
+}
+
+typedef struct {
+     stream_layer data, contour, overlay;
+     int have_contour, have_overlay;
+     double min, max; /* the range of the rows read so far */
+     int have_range; /* whether any values have been read */
+} stream_ctx;
+
+static int read_stream_rows(void *ctx_, int n0, int n1, REAL *data,
+			    REAL *mask, REAL *overlay)
+{
+     stream_ctx *ctx = (stream_ctx *) ctx_;
+     int i, width = ctx->data.q;
+
+     fill_stream_rows(&ctx->data, n0, n1, width, data);
+     for (i = 0; i < (n1 - n0) * width; ++i) {
+	  if (!ctx->have_range) {
+	       ctx->min = ctx->max = data[i];
+	       ctx->have_range = 1;
+	  }
+	  else if (data[i] < ctx->min)
+	       ctx->min = data[i];
+	  else if (data[i] > ctx->max)
+	       ctx->max = data[i];
+     }
+     if (mask)
+	  fill_stream_rows(&ctx->contour, n0, n1, width, mask);
+     if (overlay)
+	  fill_stream_rows(&ctx->overlay, n0, n1, width, overlay);
+     return 0;
+}
+
+static void open_layer_stream(const settings *s, char *layer_fname,
+			      const char *what, const int *islice,
+			      int banddim, stream_layer *L)
+{
+     char *fname, *dname;
+     int slicedim[4], rank, err;
+
+     fname = split_fname(layer_fname, &dname);
+     if (!dname[0])
+	  dname = NULL;
+     if (s->verbose)
+	  printf("reading %s data from \"%s\".\n", what, fname);
+     err = arrayh5_read_rank(fname, dname, &rank);
+     CHECK(!err, arrayh5_read_strerror[err]);
+     memcpy(slicedim, s->slicedim, 4 * sizeof(int));
+     if (slicedim[3] == LAST_SLICE_DIM && s->data_rank > rank)
+	  slicedim[3] = NO_SLICE_DIM;
+     err = open_stream_layer(L, fname, dname, slicedim, islice,
+			     s->center_slice, banddim, 2,
+			     s->band_budget / 4);
+     CHECK(err >= 0, "contour/overlay slice must be one or two dimensional");
+     CHECK(!err, arrayh5_read_strerror[err]);
+     free(fname);
+}
+
+/* Process frame iframe (as in process_frame) by streaming, if the slice
+   is two dimensional and bigger than the -B budget, with the scale
+   factors scalex and scaley; returns 0 (having done nothing) otherwise. */
+static int stream_frame(const settings *s, int iframe, const int *islice,
+			int collect_range, const char *h5_fname,
+			const char *dname, double scalex, double scaley,
+			double *a_min, double *a_max, qsketch *q)
+{
+     stream_ctx ctx;
+     /* the image rows are along dimension 1 of the data unless -T */
+     int banddim = s->transpose ? 0 : 1;
+     int nx, ny, rows, chunk;
+     double min, max, omin = 0, omax = 0;
+     REAL mask_thresh = s->mask_thresh;
+     qsketch fq;
+     char *png_fname;
+
+     if (s->band_budget <= 0)
+	  return 0;
+     if (open_stream_layer(&ctx.data, h5_fname, dname, s->slicedim,
+			   islice, s->center_slice, banddim, 2,
+			   s->band_budget) || ctx.data.whole.data) {
+	  close_stream_layer(&ctx.data);
+	  return 0;
+     }
+     nx = banddim ? ctx.data.q : ctx.data.p;
+     ny = banddim ? ctx.data.p : ctx.data.q;
+
+     /* rows that fit in the budget, counting the band being read as well
+	as the rows that it is copied into */
+     ctx.have_contour = !collect_range && s->contour_fname;
+     ctx.have_overlay = !collect_range && s->overlay_fname;
+     rows = s->band_budget / (2.0 * sizeof(REAL) * ctx.data.q
+			      * (1 + ctx.have_contour + ctx.have_overlay));
+     rows = rows < 1 ? 1 : rows;
+     chunk = s->band_budget / (2.0 * sizeof(REAL) * ctx.data.q);
+     chunk = chunk < 1 ? 1 : chunk;
+     if (s->verbose)
+	  printf("streaming %dx%d input data, %d rows at a time.\n",
+		 nx, ny, rows);
+
+     ctx.have_range = 0;
+     qsketch_init(&fq);
+     if (collect_range || q || !(s->min_set && s->max_set)) {
+	  stream_layer_range(&ctx.data, chunk, a_min, a_max,
+			     q || s->percentiles ? &fq : NULL);
+	  if (s->verbose)
+	       printf("data ranges from %g to %g.\n", *a_min, *a_max);
+	  if (q)
+	       CHECK(!qsketch_merge(q, &fq), "out of memory");
+     }
+
+     if (!collect_range) {
+	  if (ctx.have_contour) {
+	       open_layer_stream(s, s->contour_fname, "contour", islice,
+				 banddim, &ctx.contour);
+	       if (!s->mask_thresh_set) {
+		    double c_min, c_max;
+		    stream_layer_range(&ctx.contour, chunk, &c_min, &c_max,
+				       NULL);
+		    mask_thresh = (c_min + c_max) * 0.5;
+	       }
+	  }
+	  if (ctx.have_overlay) {
+	       open_layer_stream(s, s->overlay_fname, "overlay", islice,
+				 banddim, &ctx.overlay);
+	       stream_layer_range(&ctx.overlay, chunk, &omin, &omax, NULL);
+	  }
+
+	  frame_range(s, *a_min, *a_max, &fq, &min, &max);
+	  png_fname = frame_fname(s, iframe, islice, h5_fname, NULL);
+	  if (s->verbose && s->apng_fname)
+	       printf("adding frame to \"%s\" from %dx%d input data.\n",
+		      s->apng_fname, nx, ny);
+	  else if (s->verbose && s->montage_fname)
+	       printf("adding tile to \"%s\" from %dx%d input data.\n",
+		      s->montage_fname, nx, ny);
+	  else if (s->verbose)
+	       printf("writing \"%s\" from %dx%d input data.\n",
+		      png_fname, nx, ny);
+
+	  writepng_stream(png_fname, ctx.data.p, ctx.data.q, s->skew,
+			  scaley, scalex, read_stream_rows, &ctx, rows,
+			  ctx.have_contour, mask_thresh,
+			  ctx.have_overlay, s->overlay_cmap, omin, omax,
+			  min, max, s->cmap, s->eight_bit);
+	  free(png_fname);
+	  if (s->min_set && s->max_set && ctx.have_range) {
+	       /* we skipped the range pass */
+	       *a_min = ctx.min;
+	       *a_max = ctx.max;
+	  }
+	  if (ctx.have_contour)
+	       close_stream_layer(&ctx.contour);
+	  if (ctx.have_overlay)
+	       close_stream_layer(&ctx.overlay);
+     }
+     qsketch_destroy(&fq);
+     close_stream_layer(&ctx.data);
+     return 1;
+}
+
+/* With -3, read the xy, xz and yz planes through the point islice of
+   frame iframe from h5_fname, returning the range of all three in
+   a_min and a_max (and adding them to the sketch q, if not NULL), and
+   (unless collect_range) write them as three images with the same
+   colormap range. */
+static void process_ortho(const settings *s, int iframe, int collect_range,
+			  const int *islice, const char *h5_fname,
+			  const char *dname, double *a_min, double *a_max,
+			  qsketch *q)
+{
+     static const char *view[3] = { "xy", "xz", "yz" };
+     arrayh5 a[3];
+     int i, err;
+     double min, max;
+
+     err = arrayh5_read_orthogonal(a, h5_fname, dname, 4, s->slicedim,
+				   islice, s->center_slice);
+     CHECK(!err, arrayh5_read_strerror[err]);
+     if (s->verbose) {
+	  /* the size of the data is that of the xy and xz planes */
+	  int n[3], point[3];
+	  n[0] = a[0].dims[0];
+	  n[1] = a[0].dims[1];
+	  n[2] = a[1].dims[1];
+	  for (i = 0; i < 3; ++i)
+	       point[i] = islice[i] + (s->center_slice[i] ? n[i] / 2 : 0);
+	  printf("planes through the point x=%d, y=%d, z=%d.\n",
+		 point[0], point[1], point[2]);
+     }
+
+     for (i = 0; i < 3; ++i) {
+	  arrayh5_getrange(a[i], &min, &max);
+	  if (i == 0 || min < *a_min)
+	       *a_min = min;
+	  if (i == 0 || max > *a_max)
+	       *a_max = max;
+	  if (q)
+	       CHECK(!qsketch_add(q, a[i].data, a[i].N), "out of memory");
+     }
+     if (s->verbose)
+	  printf("data ranges from %g to %g.\n", *a_min, *a_max);
+
+     if (!collect_range) {
+	  qsketch fq;
+
+	  qsketch_init(&fq);
+	  if (s->percentiles && !(s->min_set && s->max_set))
+	       for (i = 0; i < 3; ++i)
+		    CHECK(!qsketch_add(&fq, a[i].data, a[i].N),
+			  "out of memory");
+	  frame_range(s, *a_min, *a_max, &fq, &min, &max);
+	  qsketch_destroy(&fq);
+
+	  for (i = 0; i < 3; ++i) {
+	       char *png_fname = frame_fname(s, iframe, islice, h5_fname,
+					     view[i]);
+	       int nx = a[i].dims[0], ny = a[i].dims[1];
+
+	       if (s->verbose && s->montage_fname)
+		    printf("adding %s tile to \"%s\" from %dx%d input data.\n",
+			   view[i], s->montage_fname, nx, ny);
+	       else if (s->verbose)
+		    printf("writing \"%s\" from %dx%d input data.\n",
+			   png_fname, nx, ny);
+
+	       writepng(png_fname, nx, ny, !s->transpose, s->skew,
+			s->scaley, s->scalex, a[i].data, NULL, 0, 1, 1,
+			NULL, s->overlay_cmap, 1, 1,
+			min, max, s->cmap, s->eight_bit);
+	       free(png_fname);
+	  }
+     }
+
+     for (i = 0; i < 3; ++i)
+	  arrayh5_destroy(a[i]);
+}
+
+/* the size of the biggest of the -3 images of the first frame, which
+   is the size of the tiles of a -G montage of them */
+static void ortho_tile_size(const settings *s, int *width, int *height)
+{
+     int slicedim[4], xy[2], yz[2], i;
+     char *dname, *h5_fname;
+
+     h5_fname = split_fname(s->fnames[0], &dname);
+     if (!dname[0])
+	  dname = s->data_name;
+     memcpy(slicedim, s->slicedim, 4 * sizeof(int));
+     slicedim[0] = slicedim[1] = NO_SLICE_DIM;
+     slice_dims(h5_fname, dname, slicedim, s->islice_min, s->center_slice, xy);
+     memcpy(slicedim, s->slicedim, 4 * sizeof(int));
+     slicedim[1] = slicedim[2] = NO_SLICE_DIM;
+     slice_dims(h5_fname, dname, slicedim, s->islice_min, s->center_slice, yz);
+     free(h5_fname);
+
+     *width = *height = 0;
+     for (i = 0; i < 3; ++i) {
+	  int w, h;
+	  writepng_image_size(i < 2 ? xy[0] : xy[1], i ? yz[1] : xy[1],
+			      !s->transpose, s->skew, s->scaley, s->scalex,
+			      &w, &h);
+	  *width = imax(*width, w);
+	  *height = imax(*height, h);
+     }
+}
+
+/* With -I, the data of a frame is the projection of the sliced data
+   along an axis, which is read in slabs along the axis of about
+   band_budget (-B) bytes, or PROJECT_BYTES by default: each slab is
+   reduced (with threads) while the next is read. */
+#define PROJECT_BYTES (64 * 1048576.0)
+
+static void project_frame(const settings *s, const int *islice,
+			  const char *h5_fname, const char *dname, arrayh5 *a)
+{
+     int dim, banddim, n, k, k0, i, err, dims[2];
+     int pdim = s->project_dim == 3 ? s->data_rank - 1 : s->project_dim;
+     double budget = s->band_budget > 0 ? s->band_budget : PROJECT_BYTES, kmax;
+     int nthreads = writepng_get_nthreads();
+     size_t before = 1, after = 1;
+     arrayh5 slab[2];
+     projection pr;
+
+     /* the axis is dimension banddim of the sliced data */
+     banddim = pdim;
+     for (dim = 0; dim < 4; ++dim)
+	  if (s->slicedim[dim] != NO_SLICE_DIM) {
+	       int sdim = s->slicedim[dim] == LAST_SLICE_DIM
+		    ? s->data_rank - 1 : s->slicedim[dim];
+	       CHECK(sdim != pdim, "cannot take a slice along the -I axis");
+	       if (sdim < pdim)
+		    --banddim;
+	  }
+
+     /* the first element along the axis, which gives the sizes */
+     err = arrayh5_read_band(&slab[0], h5_fname, dname, 4, s->slicedim,
+			     islice, s->center_slice, banddim, 0, 1, &n);
+     CHECK(!err, arrayh5_read_strerror[err]);
+     CHECK(slab[0].rank >= 2 && slab[0].rank <= 3,
+	   "data can have at most two dimensions after -I (try specifying a slice)");
+     for (dim = i = 0; dim < slab[0].rank; ++dim)
+	  if (dim != banddim) {
+	       dims[i++] = slab[0].dims[dim];
+	       if (dim < banddim)
+		    before *= slab[0].dims[dim];
+	       else
+		    after *= slab[0].dims[dim];
+	  }
+     CHECK(!project_init(&pr, s->project_op, before, after), "out of memory");
+
+     /* the number of elements per slab, with two slabs in memory at once */
+     kmax = budget / (2.0 * before * after * sizeof(double));
+     k = kmax < 1 ? 1 : kmax >= n ? n : (int) kmax;
+     if (s->verbose)
+	  printf("projecting %d elements along dimension %d, %d at a time.\n",
+		 n, pdim, k);
+
+     project_add(&pr, slab[0].data, 1, nthreads);
+     for (k0 = 1, i = 0; k0 < n; k0 += k) {
+	  i = 1 - i;
+	  err = arrayh5_read_band(&slab[i], h5_fname, dname, 4, s->slicedim,
+				  islice, s->center_slice, banddim,
+				  k0, k0 + k, &n);
+	  CHECK(!err, arrayh5_read_strerror[err]);
+	  project_wait(&pr);
+	  arrayh5_destroy(slab[1 - i]);
+	  project_add(&pr, slab[i].data, slab[i].dims[banddim], nthreads);
+     }
+     *a = arrayh5_create_withdata(slab[i].rank - 1, dims, project_result(&pr));
+     arrayh5_destroy(slab[i]);
+     project_destroy(&pr);
+}
+
+/* Read frame iframe, returning the range of its data in a_min and a_max
+   (and adding the data to the sketch q, if q is not NULL), and (unless
+   collect_range) write it as a PNG file. */
+static void process_frame(const settings *s, int iframe, int collect_range,
+			  layers *l, double *a_min, double *a_max, qsketch *q)
+{
+     arrayh5 a;
+     float *fdata = NULL;
+     int islice[4], islice_index, ifile, err;
+     int dims[2] = {1, 1}, stride[2] = {1, 1};
+     char *dname, *h5_fname, *png_fname;
+     double min, max, scalex = s->scalex, scaley = s->scaley;
+     /* the quantile sketches take double-precision data */
+     int sketch = q || (!collect_range && need_quantiles(s));
+
+     get_frame(s, iframe, islice, &islice_index, &ifile);
+
+     if (s->verbose && ifile == 0)
+	  printf("------\n");
+
+     h5_fname = split_fname(s->fnames[ifile], &dname);
+     if (!dname[0])
+	  dname = s->data_name;
+
+     if (s->verbose) {
+	  int i;
+	  printf("reading from \"%s\"", h5_fname);
+	  for (i = 0; i < 4; ++i)
+	       /* (the -3 point is printed by process_ortho) */
+	       if (s->slicedim[i] != NO_SLICE_DIM && !(s->ortho && i < 3))
+		    printf(", slice at %d in %c dimension", islice[i],
+			   s->slicedim[i] == LAST_SLICE_DIM ? 't'
+			   : s->slicedim[i] + 'x');
+	  printf(".\n");
+     }
+
+     if (s->ortho) {
+	  process_ortho(s, iframe, collect_range, islice, h5_fname, dname,
+			a_min, a_max, q);
+	  free(h5_fname);
+	  return;
+     }
+
+     if (s->max_width > 0 || s->max_height > 0) {
+	  CHECK(slice_dims(h5_fname, dname, s->slicedim, islice,
+			   s->center_slice, dims) <= 2,
+		"data can have at most two dimensions (try specifying a slice)");
+	  decimate(s, dims, stride, &scalex, &scaley);
+	  if (s->verbose && (stride[0] > 1 || stride[1] > 1))
+	       printf("reading every %d x %d element of %dx%d input data.\n",
+		      stride[0], stride[1], dims[0], dims[1]);
+     }
+
+     /* (a decimated slice is small enough to read at once, and with -e
+	the slice is read once for all of the images) */
+     if (stride[0] == 1 && stride[1] == 1 && s->project_op < 0
+	 && !s->nvariants
+	 && stream_frame(s, iframe, islice, collect_range, h5_fname, dname,
+			 scalex, scaley, a_min, a_max, q)) {
+	  free(h5_fname);
+	  return;
+     }
+
+     if (!collect_range)
+	  load_layers(s, islice, dims, stride, l);
+
+     if (s->project_op >= 0)
+	  project_frame(s, islice, h5_fname, dname, &a);
+     else {
+	  /* read single-precision data as is, unless we need doubles */
+	  err = arrayh5_read_strided(&a, sketch ? NULL : &fdata, h5_fname,
+				     dname, 4, s->slicedim, islice,
+				     s->center_slice,
+				     stride[0] > 1 || stride[1] > 1 ? stride
+				     : NULL);
+	  CHECK(!err, arrayh5_read_strerror[err]);
+     }
+     CHECK(a.rank >= 1, "data must have at least one dimension");
+     CHECK(a.rank <= 2, "data can have at most two dimensions (try specifying a slice)");
+
+     if (fdata) {
+	  CHECK(a.N > 0, "no elements in array");
+	  float_range(fdata, a.N, a_min, a_max);
+     }
+     else
+	  arrayh5_getrange(a, a_min, a_max);
+     if (s->verbose)
+	  printf("data ranges from %g to %g.\n", *a_min, *a_max);
+     if (q)
+	  CHECK(!qsketch_add(q, a.data, a.N), "out of memory");
+
+     if (!collect_range) {
+	  int nx = a.dims[0], ny = a.rank < 2 ? 1 : a.dims[1], i;
+	  int printed = 0; /* whether the -P range was printed (with -v) */
+	  qsketch fq;
+
+	  qsketch_init(&fq);
+	  if (need_quantiles(s))
+	       CHECK(!qsketch_add(&fq, a.data, a.N), "out of memory");
+
+	  /* the image, and then its -e variants from the same data */
+	  for (i = -1; i < s->nvariants; ++i) {
+	       settings vs;
+
+	       variant_settings(s, i, &vs);
+	       if (i >= 0) {
+		    scalex = vs.scalex;
+		    scaley = vs.scaley;
+	       }
+	       vs.verbose = s->verbose && !printed;
+	       frame_range(&vs, *a_min, *a_max, &fq, &min, &max);
+	       printed = printed || (vs.percentiles
+				     && !(vs.min_set && vs.max_set));
+	       png_fname = frame_fname(&vs, iframe, islice, h5_fname,
+				       i < 0 || (iframe == 0
+						 && s->variants[i].fname)
+				       ? NULL : s->variants[i].name);
+
+	       if (s->verbose && s->apng_fname)
+		    printf("adding frame to \"%s\" from %dx%d input data.\n",
+			   s->apng_fname, nx, ny);
+	       else if (s->verbose && s->montage_fname)
+		    printf("adding tile to \"%s\" from %dx%d input data.\n",
+			   s->montage_fname, nx, ny);
+	       else if (s->verbose)
+		    printf("writing \"%s\" from %dx%d input data.\n",
+			   png_fname, nx, ny);
+
+	       if (fdata)
+		    writepng_float(png_fname, nx, ny, !s->transpose, s->skew,
+				   scaley, scalex, fdata,
+				   s->contour_fname
+				   ? l->contour_data.data : NULL,
+				   l->mask_thresh, l->cnx, l->cny,
+				   s->overlay_fname
+				   ? l->overlay_data.data : NULL,
+				   s->overlay_cmap, l->onx, l->ony,
+				   min, max, vs.cmap, s->eight_bit);
+	       else
+		    writepng(png_fname, nx, ny, !s->transpose, s->skew,
+			     scaley, scalex, a.data,
+			     s->contour_fname ? l->contour_data.data : NULL,
+			     l->mask_thresh, l->cnx, l->cny,
+			     s->overlay_fname ? l->overlay_data.data : NULL,
+			     s->overlay_cmap, l->onx, l->ony,
+			     min, max, vs.cmap, s->eight_bit);
+	       free(png_fname);
+	  }
+	  qsketch_destroy(&fq);
+     }
+
+     arrayh5_destroy(a);
+     free(fdata);
+     free(h5_fname);
+}
+
+/***********************************************************************/
+/* Frames are independent, so with -j we process them in parallel.  The
+   HDF5 library is generally not thread-safe, so rather than threads we
+   use a pool of worker processes, which each take the next unprocessed
+   frame from a shared queue (a pipe) as soon as they are idle, and send
+   the range of each frame back to the parent.  (Colormapping and PNG
+   output within each frame can additionally use threads.) */
+
+#if defined(HAVE_FORK) && defined(HAVE_SYS_WAIT_H)
+#  include <sys/types.h>
+#  include <sys/wait.h>
+#  include <signal.h>
+#  define USE_WORKERS 1
+#endif
+
+/* The range of a frame, and (for -P with -R) its quantile sketch, which
+   a worker sends in pieces of at most RESULT_CENTROIDS centroids, so
+   that each message fits in PIPE_BUF bytes (at least 512) and is thus
+   written to the pipe atomically. */
+#define RESULT_CENTROIDS 24
+typedef struct {
+     int iframe;
+     double min, max;
+     double qmin, qmax; /* range of the sketch */
+     int ncentroids, first, n; /* this message has centroids first..+n-1 */
+     qsketch_centroid c[RESULT_CENTROIDS];
+} frame_result;
+
+static void merge_range(frame_result r, double *allmin, double *allmax,
+			int *num_processed)
+{
+     if (!*num_processed || r.min < *allmin)
+	  *allmin = r.min;
+     if (!*num_processed || r.max > *allmax)
+	  *allmax = r.max;
+     ++*num_processed;
+}
+
+#ifdef USE_WORKERS
+/* send the result r of a frame, with its sketch q (if not NULL), from
+   a worker to the parent */
+static void send_result(int fd, frame_result *r, qsketch *q)
+{
+     r->ncentroids = 0;
+     if (q) {
+	  CHECK(!qsketch_compress(q), "out of memory");
+	  r->ncentroids = q->n;
+	  r->qmin = q->min;
+	  r->qmax = q->max;
+     }
+     r->first = 0;
+     do {
+	  r->n = r->ncentroids - r->first;
+	  if (r->n > RESULT_CENTROIDS)
+	       r->n = RESULT_CENTROIDS;
+	  if (r->n)
+	       memcpy(r->c, q->c + r->first, r->n * sizeof(qsketch_centroid));
+	  CHECK(write(fd, r, sizeof(*r)) == sizeof(*r),
+		"error communicating with parent process");
+	  r->first += r->n;
+     } while (r->first < r->ncentroids);
+}
+
+/* the sketches received from the workers, which are merged into the
+   sketch of all of the data in frame order, so that the result does not
+   depend on which worker finished first */
+typedef struct {
+     qsketch_centroid *c;
+     int n, received, done;
+     double min, max;
+} frame_sketch;
+
+static int run_workers(const settings *s, int collect_range, int nframes,
+		       int njobs, double *allmin, double *allmax,
+		       int *num_processed, qsketch *all)
+{
+     int work[2], results[2], j, status, ok = 1;
+     int nsent = 0, nreceived = 0, nmerged = 0;
+     pid_t *pids;
+     frame_sketch *fs = NULL;
+     void (*sigpipe)(int);
+
+     CHECK(!pipe(work) && !pipe(results), "couldn't create pipes for -j");
+     pids = (pid_t *) malloc(njobs * sizeof(pid_t));
+     CHECK(pids, "out of memory");
+     if (all) {
+	  fs = (frame_sketch *) calloc(nframes, sizeof(frame_sketch));
+	  CHECK(fs, "out of memory");
+     }
+
+     fflush(stdout);
+     fflush(stderr);
+     for (j = 0; j < njobs; ++j) {
+	  pids[j] = fork();
+	  CHECK(pids[j] >= 0, "couldn't create worker processes for -j");
+	  if (pids[j] == 0) { /* worker */
+	       layers l;
+	       frame_result r;
+	       close(work[1]);
+	       close(results[0]);
+	       init_layers(&l);
+	       while (read(work[0], &r.iframe, sizeof(int)) == sizeof(int)) {
+		    qsketch q;
+		    qsketch_init(&q);
+		    process_frame(s, r.iframe, collect_range, &l,
+				  &r.min, &r.max, all ? &q : NULL);
+		    fflush(stdout);
+		    send_result(results[1], &r, all ? &q : NULL);
+		    qsketch_destroy(&q);
+	       }
+	       destroy_layers(&l);
+	       exit(writepng_failures() ? EXIT_FAILURE : EXIT_SUCCESS);
+	  }
+     }
+     close(work[0]);
+     close(results[1]);
+
+     /* keep a few frames queued per worker, without letting either pipe
+	fill up (which could deadlock) */
+     sigpipe = signal(SIGPIPE, SIG_IGN);
+     while (nreceived < nframes) {
+	  frame_result r;
+	  while (nsent < nframes && nsent - nreceived < 2 * njobs) {
+	       if (write(work[1], &nsent, sizeof(int)) != sizeof(int))
+		    break;
+	       ++nsent;
+	  }
+	  if (nsent == nframes)
+	       close(work[1]); /* tell idle workers to exit */
+	  if (read(results[0], &r, sizeof(r)) != sizeof(r))
+	       break; /* all of the workers died */
+	  if (fs) {
+	       frame_sketch *f = fs + r.iframe;
+	       if (!f->c) {
+		    f->c = (qsketch_centroid *)
+			 malloc((r.ncentroids + 1) * sizeof(qsketch_centroid));
+		    CHECK(f->c, "out of memory");
+	       }
+	       memcpy(f->c + r.first, r.c, r.n * sizeof(qsketch_centroid));
+	       f->received += r.n;
+	       if (f->received < r.ncentroids)
+		    continue; /* wait for the rest of the sketch */
+	       f->n = r.ncentroids;
+	       f->min = r.qmin;
+	       f->max = r.qmax;
+	       f->done = 1;
+	       for (; nmerged < nframes && fs[nmerged].done; ++nmerged) {
+		    f = fs + nmerged;
+		    CHECK(!qsketch_add_centroids(all, f->c, f->n,
+						 f->min, f->max),
+			  "out of memory");
+		    free(f->c);
+		    f->c = NULL;
+	       }
+	  }
+	  merge_range(r, allmin, allmax, num_processed);
+	  ++nreceived;
+     }
+     if (nsent < nframes)
+	  close(work[1]);
+     close(results[0]);
+     signal(SIGPIPE, sigpipe);
+
+     for (j = 0; j < njobs; ++j)
+	  if (waitpid(pids[j], &status, 0) != pids[j]
+	      || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+	       ok = 0;
+     if (fs)
+	  for (j = 0; j < nframes; ++j)
+	       free(fs[j].c);
+     free(fs);
+     free(pids);
+     return ok && nreceived == nframes;
+}
+#endif /* USE_WORKERS */
+
+/* process all of the frames, using njobs processes, and return the
+   range of the data over all of them (and, if all is not NULL, merge
+   the sketches of their data into all) */
+static void run_frames(const settings *s, int collect_range, int njobs,
+		       double *allmin, double *allmax, int *num_processed,
+		       qsketch *all)
+{
+     int nframes = num_frames(s);
+
+     *num_processed = 0;
+#ifdef USE_WORKERS
+     if (njobs > 1 && nframes > 1) {
+	  CHECK(run_workers(s, collect_range, nframes,
+			    njobs < nframes ? njobs : nframes,
+			    allmin, allmax, num_processed, all),
+		"a worker process failed");
+	  return;
+     }
+#endif
+     {
+	  layers l;
+	  frame_result r;
+	  init_layers(&l);
+	  for (r.iframe = 0; r.iframe < nframes; ++r.iframe) {
+	       qsketch q;
+	       qsketch_init(&q);
+	       process_frame(s, r.iframe, collect_range, &l, &r.min, &r.max,
+			     all ? &q : NULL);
+	       merge_range(r, allmin, allmax, num_processed);
+	       if (all)
+		    CHECK(!qsketch_merge(all, &q), "out of memory");
+	       qsketch_destroy(&q);
+	  }
+	  destroy_layers(&l);
+     }
+}
+
+/***********************************************************************/
+/* With --serve, rather than writing image files, we answer requests
+   (see serve.h) for images of slices of the input files, e.g. so that
+   a huge data set can be browsed interactively:
+
+     /info?<params>   the size and range of the slice (as text)
+     /slice?<params>  the image of the whole slice
+     /tile?<params>&level=<k>&col=<i>&row=<j>[&size=<n>]
+                      the tile i,j (from the top left) of level k of a
+                      Deep Zoom pyramid of the slice: the slice itself
+                      at the last level, and every 2nd, 4th, ... element
+                      of it along each dimension at the levels before,
+                      down to a single element at level 0, in tiles of
+                      n x n elements (default 256)
+
+   where the optional <params> are file (one of the input files, as
+   given on the command line; default: the first), x, y, z and t (the
+   slice, overriding -x etc.), and c (a built-in colormap), m, M, Z,
+   S and T, as for the command-line options (with Z=1 and T=1).
+
+   The data sets are kept open, and the slices (with the levels of
+   their pyramids) that were used most recently are kept in memory, up
+   to the -B budget, so that panning around a slice or going back and
+   forth between slices doesn't touch the disk.  The colormap range of
+   a slice is that of its biggest level of at most SERVE_RANGE_ELEMENTS
+   elements, so that it is the same for all of its tiles without having
+   to read all of a huge slice. */
+
+#define SERVE_CACHE_BYTES (256 * 1048576.0)
+#define SERVE_RANGE_ELEMENTS (1 << 20)
+#define SERVE_TILE_SIZE 256
+#define SERVE_MAX_LEVELS 33 /* enough for any int size */
+/* the biggest image that we render (for a whole slice at S=1, or a
+   tile), since a single huge request would keep everyone else waiting */
+#define SERVE_MAX_PIXELS (64 * 1048576.0)
+
+/* a slice, with the levels of its pyramid that have been read so far
+   (whose data is NULL otherwise) */
+typedef struct served_slice_s {
+     int ifile, slicedim[4], islice[4];
+     int rank, dims[2], nlevels;
+     double min, max;
+     arrayh5 level[SERVE_MAX_LEVELS];
+     double bytes;
+     struct served_slice_s *next;
+} served_slice;
+
+typedef struct served_cmap_s {
+     char *name;
+     colormap_t cmap;
+     struct served_cmap_s *next;
+} served_cmap;
+
+typedef struct {
+     const settings *s;
+     arrayh5_dataset **data; /* the data set of each input file */
+     served_slice *slices; /* most recently used first */
+     double bytes, budget; /* memory used by the slices, and the limit */
+     served_cmap *cmaps; /* the colormaps requested so far */
+} server;
+
+/* every stride-th element of the slice along each dimension is in
+   level k of its pyramid */
+static int level_stride(const served_slice *sl, int k)
+{
+     int stride = 1, n = imax(sl->dims[0], sl->dims[1]);
+     for (; k < sl->nlevels - 1 && stride < n; ++k)
+	  stride *= 2;
+     return stride;
+}
+
+/* the size of level k of the slice */
+static void level_dims(const served_slice *sl, int k, int *dims)
+{
+     int stride = level_stride(sl, k);
+     dims[0] = (sl->dims[0] + stride - 1) / stride;
+     dims[1] = (sl->dims[1] + stride - 1) / stride;
+}
+
+static void destroy_slice(served_slice *sl)
+{
+     int k;
+     for (k = 0; k < sl->nlevels; ++k)
+	  if (sl->level[k].data)
+	       arrayh5_destroy(sl->level[k]);
+     free(sl);
+}
+
+/* read level k of the slice, if it hasn't been read yet, returning an
+   arrayh5_read_strerror index on failure */
+static int read_level(server *sv, served_slice *sl, int k)
+{
+     int stride[2], err;
+
+     if (sl->level[k].data)
+	  return 0;
+     stride[0] = stride[1] = level_stride(sl, k);
+     err = arrayh5_read_dataset(sv->data[sl->ifile], &sl->level[k], NULL,
+				4, sl->slicedim, sl->islice,
+				sv->s->center_slice,
+				stride[0] > 1 ? stride : NULL, -1, 0, 0, NULL);
+     if (err) {
+	  memset(&sl->level[k], 0, sizeof(arrayh5));
+	  return err;
+     }
+     sl->bytes += sl->level[k].N * sizeof(double);
+     sv->bytes += sl->level[k].N * sizeof(double);
+     return 0;
+}
+
+/* drop the least recently used slices (but not the most recent one)
+   while we are over the budget */
+static void trim_slices(server *sv)
+{
+     while (sv->bytes > sv->budget && sv->slices && sv->slices->next) {
+	  served_slice **p = &sv->slices;
+	  while ((*p)->next)
+	       p = &(*p)->next;
+	  sv->bytes -= (*p)->bytes;
+	  destroy_slice(*p);
+	  *p = NULL;
+     }
+}
+
+/* the slice of file ifile at islice, which becomes the most recently
+   used, or NULL on failure (with an arrayh5_read_strerror index in
+   *err) */
+static served_slice *get_slice(server *sv, int ifile, const int *slicedim,
+			       const int *islice, int *err)
+{
+     served_slice **p, *sl;
+     arrayh5 a;
+     int n, k, dims[2];
+     double size;
+
+     for (p = &sv->slices; *p; p = &(*p)->next)
+	  if ((*p)->ifile == ifile
+	      && !memcmp((*p)->slicedim, slicedim, 4 * sizeof(int))
+	      && !memcmp((*p)->islice, islice, 4 * sizeof(int)))
+	       break;
+     if (*p) {
+	  sl = *p;
+	  *p = sl->next;
+	  sl->next = sv->slices;
+	  sv->slices = sl;
+	  return sl;
+     }
+
+     sl = (served_slice *) calloc(1, sizeof(served_slice));
+     CHECK(sl, "out of memory");
+     sl->ifile = ifile;
+     memcpy(sl->slicedim, slicedim, 4 * sizeof(int));
+     memcpy(sl->islice, islice, 4 * sizeof(int));
+
+     /* the size of the slice, from its first row */
+     *err = arrayh5_read_dataset(sv->data[ifile], &a, NULL, 4, slicedim,
+				 islice, sv->s->center_slice, NULL,
+				 0, 0, 1, &n);
+     if (*err) {
+	  free(sl);
+	  return NULL;
+     }
+     sl->rank = a.rank;
+     sl->dims[0] = n;
+     sl->dims[1] = a.rank >= 2 ? a.dims[1] : 1;
+     arrayh5_destroy(a);
+     for (sl->nlevels = 1, size = 1;
+	  size < sl->dims[0] || size < sl->dims[1]; size *= 2)
+	  ++sl->nlevels;
+
+     if (sl->rank <= 2) {
+	  /* the range, from the biggest level that is small enough */
+	  for (k = sl->nlevels - 1; k > 0; --k) {
+	       level_dims(sl, k, dims);
+	       if (dims[0] * (double) dims[1] <= SERVE_RANGE_ELEMENTS)
+		    break;
+	  }
+	  if ((*err = read_level(sv, sl, k))) {
+	       destroy_slice(sl);
+	       return NULL;
+	  }
+	  arrayh5_getrange(sl->level[k], &sl->min, &sl->max);
+     }
+
+     sl->next = sv->slices;
+     sv->slices = sl;
+     return sl;
+}
+
+/* the built-in colormap name (reversed if it starts with "-"), or NULL
+   if there is no such colormap */
+static const colormap_t *get_served_cmap(server *sv, const char *name)
+{
+     served_cmap *c;
+
+     for (c = sv->cmaps; c; c = c->next)
+	  if (!strcmp(c->name, name))
+	       return &c->cmap;
+     if (!find_builtin_cmap(name[0] == '-' ? name + 1 : name))
+	  return NULL;
+     c = (served_cmap *) malloc(sizeof(served_cmap));
+     CHECK(c, "out of memory");
+     c->name = my_strdup(name);
+     c->cmap = get_cmap(name, 0, 1.0, 0);
+     c->next = sv->cmaps;
+     sv->cmaps = c;
+     return &c->cmap;
+}
+
+/* set *i (or *x, and *set) to the value of the query parameter name, if
+   any, returning nonzero if it is not a valid number */
+static int int_param(const char *query, const char *name, int *i)
+{
+     char val[64], *end;
+     long l;
+
+     if (!serve_param(query, name, val, sizeof(val)))
+	  return 0;
+     l = strtol(val, &end, 10);
+     if (end == val || *end || l != (int) l)
+	  return 1;
+     *i = (int) l;
+     return 0;
+}
+
+static int real_param(const char *query, const char *name, double *x,
+		      int *set)
+{
+     char val[64], *end;
+     double d;
+
+     if (!serve_param(query, name, val, sizeof(val)))
+	  return 0;
+     d = strtod(val, &end);
+     if (end == val || *end || !(d - d == 0)) /* not finite */
+	  return 1;
+     *x = d;
+     if (set)
+	  *set = 1;
+     return 0;
+}
+
+/* write the image of the nx x ny data to out */
+static int serve_image(const settings *s, FILE *out,
+		       const char **content_type,
+		       int nx, int ny, REAL skew, REAL *data,
+		       double min, double max, colormap_t cmap)
+{
+     char fname[] = "-";
+     writepng_set_stdout(out);
+     writepng(fname, nx, ny, !s->transpose, skew, s->scaley, s->scalex, data,
+	      NULL, 0, 0, 0, NULL, s->overlay_cmap, 0, 0,
+	      min, max, cmap, s->eight_bit);
+     writepng_set_stdout(NULL);
+     if (fflush(out) || ftell(out) <= 0) {
+	  fprintf(out, "error writing image\n");
+	  return 500;
+     }
+     if (!strcmp(s->suffix, ".qoi"))
+	  *content_type = "image/qoi";
+     else if (!strcmp(s->suffix, ".ppm"))
+	  *content_type = "image/x-portable-pixmap";
+     else
+	  *content_type = "image/png";
+     return 200;
+}
+
+/* whether the image of nx x ny data (at most this many pixels) is too
+   big for us to render */
+static int too_big(const settings *s, double nx, double ny, REAL skew)
+{
+     return nx * ny * s->scalex * s->scaley * (1.0 + fabs(sin(skew)))
+	  > SERVE_MAX_PIXELS;
+}
+
+static int answer_request(server *sv, const char *path, const char *query,
+			  FILE *out, const char **content_type)
+{
+     static const char *dim_names[4] = { "x", "y", "z", "t" };
+     settings rs = *sv->s; /* the settings for this request */
+     int ifile = 0, islice[4], slicedim[4], dim, err = 0;
+     int level = -1, col = 0, row = 0, size = SERVE_TILE_SIZE;
+     double scale = 0, min, max;
+     colormap_t cmap = rs.cmap;
+     served_slice *sl;
+     char val[256];
+
+     if (strcmp(path, "/info") && strcmp(path, "/slice")
+	 && strcmp(path, "/tile")) {
+	  fprintf(out, "unknown request %s (try /info, /slice or /tile)\n",
+		  path);
+	  return 404;
+     }
+
+     if (serve_param(query, "file", val, sizeof(val))) {
+	  for (ifile = 0; ifile < rs.nfiles; ++ifile)
+	       if (!strcmp(val, rs.fnames[ifile]))
+		    break;
+	  if (ifile == rs.nfiles) {
+	       fprintf(out, "unknown file %s\n", val);
+	       return 404;
+	  }
+     }
+     if (serve_param(query, "c", val, sizeof(val))) {
+	  const colormap_t *c = get_served_cmap(sv, val);
+	  if (!c) {
+	       fprintf(out, "unknown colormap %s\n", val);
+	       return 404;
+	  }
+	  cmap = *c;
+     }
+     for (dim = 0; dim < 4; ++dim) {
+	  slicedim[dim] = rs.slicedim[dim];
+	  islice[dim] = rs.islice_min[dim];
+	  if (serve_param(query, dim_names[dim], val, sizeof(val))) {
+	       err = err || int_param(query, dim_names[dim], islice + dim);
+	       slicedim[dim] = dim < 3 ? dim : LAST_SLICE_DIM;
+	  }
+     }
+     err = err || real_param(query, "m", &rs.min, &rs.min_set)
+	  || real_param(query, "M", &rs.max, &rs.max_set)
+	  || int_param(query, "Z", &rs.zero_center)
+	  || int_param(query, "T", &rs.transpose)
+	  || real_param(query, "S", &scale, NULL)
+	  || int_param(query, "level", &level)
+	  || int_param(query, "col", &col)
+	  || int_param(query, "row", &row)
+	  || int_param(query, "size", &size)
+	  || size < 1;
+     if (scale != 0) {
+	  err = err || scale < 0;
+	  rs.scalex = rs.scaley = scale;
+     }
+     if (err) {
+	  fprintf(out, "invalid parameters %s\n", query);
+	  return 400;
+     }
+
+     if (!(sl = get_slice(sv, ifile, slicedim, islice, &err))) {
+	  fprintf(out, "%s\n", arrayh5_read_strerror[err]);
+	  return 400;
+     }
+     trim_slices(sv);
+     if (sl->rank < 1 || sl->rank > 2) {
+	  fprintf(out, "the slice has %d dimensions (slice it with x, y, z "
+		  "or t)\n", sl->rank);
+	  return 400;
+     }
+     frame_range(&rs, sl->min, sl->max, NULL, &min, &max);
+
+     if (!strcmp(path, "/info")) {
+	  fprintf(out, "file: %s\n", rs.fnames[ifile]);
+	  if (sl->rank == 1)
+	       fprintf(out, "size: %d\n", sl->dims[0]);
+	  else
+	       fprintf(out, "size: %d x %d\n", sl->dims[0], sl->dims[1]);
+	  fprintf(out, "range: %g to %g\n", min, max);
+	  fprintf(out, "levels: %d\n", sl->nlevels);
+	  return 200;
+     }
+     else if (!strcmp(path, "/slice")) {
+	  if (too_big(&rs, sl->dims[0], sl->dims[1], rs.skew)) {
+	       fprintf(out, "the image would be too big (try a smaller S, "
+		       "or /tile)\n");
+	       return 400;
+	  }
+	  if ((err = read_level(sv, sl, sl->nlevels - 1))) {
+	       fprintf(out, "%s\n", arrayh5_read_strerror[err]);
+	       return 500;
+	  }
+	  trim_slices(sv);
+	  return serve_image(&rs, out, content_type, sl->dims[0], sl->dims[1],
+			     rs.skew, sl->level[sl->nlevels - 1].data,
+			     min, max, cmap);
+     }
+     else { /* tile */
+	  int m[2], lo[2], hi[2], tdims[2], i, j;
+	  int wdim = rs.transpose ? 1 : 0, hdim = 1 - wdim; /* see decimate */
+	  arrayh5 *a, t;
+	  int status;
+
+	  if (too_big(&rs, size, size, 0.0)) {
+	       fprintf(out, "the tile would be too big (try a smaller S "
+		       "or size)\n");
+	       return 400;
+	  }
+	  if (level < 0 || level >= sl->nlevels) {
+	       fprintf(out, "no level %d (there are %d)\n", level,
+		       sl->nlevels);
+	       return 404;
+	  }
+	  level_dims(sl, level, m);
+	  /* the image rows go from the top, i.e. the end of hdim */
+	  lo[wdim] = col * (double) size < m[wdim] ? col * size : -1;
+	  hi[wdim] = imin(m[wdim], lo[wdim] + size);
+	  hi[hdim] = row * (double) size < m[hdim] ? m[hdim] - row * size : -1;
+	  lo[hdim] = imax(0, hi[hdim] - size);
+	  if (col < 0 || row < 0 || lo[wdim] < 0 || hi[hdim] < 0) {
+	       fprintf(out, "no tile %d,%d at level %d\n", col, row, level);
+	       return 404;
+	  }
+	  if ((err = read_level(sv, sl, level))) {
+	       fprintf(out, "%s\n", arrayh5_read_strerror[err]);
+	       return 500;
+	  }
+	  trim_slices(sv);
+	  a = &sl->level[level];
+
+	  tdims[0] = hi[0] - lo[0];
+	  tdims[1] = hi[1] - lo[1];
+	  t = arrayh5_create(2, tdims);
+	  for (i = 0; i < tdims[0]; ++i)
+	       for (j = 0; j < tdims[1]; ++j)
+		    t.data[i * tdims[1] + j] =
+			 a->data[(lo[0] + i) * m[1] + lo[1] + j];
+	  status = serve_image(&rs, out, content_type, tdims[0], tdims[1],
+			       0.0, t.data, min, max, cmap);
+	  arrayh5_destroy(t);
+	  return status;
+     }
+}
+
+static int serve_request(void *ctx, const char *path, const char *query,
+			 FILE *out, const char **content_type)
+{
+     server *sv = (server *) ctx;
+     int status = answer_request(sv, path, query, out, content_type);
+     if (sv->s->verbose) {
+	  printf("%s%s%s: %d\n", path, *query ? "?" : "", query, status);
+	  fflush(stdout);
+     }
+     return status;
+}
+
+/* answer requests for images of the input files at addr (see serve.h),
+   returning only on failure */
+static int serve_files(const settings *s, const char *addr)
+{
+     server sv;
+     int i, fd;
+
+     CHECK(!s->percentiles || (s->min_set && s->max_set),
+	   "-P is only supported with -u range files for --serve");
+     memset(&sv, 0, sizeof(server));
+     sv.s = s;
+     sv.budget = s->band_budget > 0 ? s->band_budget : SERVE_CACHE_BYTES;
+     sv.data = (arrayh5_dataset **) malloc(sizeof(arrayh5_dataset *)
+					   * s->nfiles);
+     CHECK(sv.data, "out of memory");
+     for (i = 0; i < s->nfiles; ++i) {
+	  char *dname, *h5_fname = split_fname(s->fnames[i], &dname);
+	  sv.data[i] = arrayh5_open_dataset(h5_fname,
+					    dname[0] ? dname : s->data_name);
+	  if (!sv.data[i])
+	       fprintf(stderr, "h5topng error: could not open data in %s\n",
+		       s->fnames[i]);
+	  free(h5_fname);
+	  if (!sv.data[i])
+	       return 1;
+     }
+
+     if ((fd = serve_listen(addr)) < 0)
+	  return 1;
+     if (s->verbose)
+	  printf("serving %d file(s) at %s\n", s->nfiles, addr);
+     return serve_run(fd, serve_request, &sv);
+}
+
 int main(int argc, char **argv)
 {
-     arrayh5 a, contour_data, overlay_data;
-     char *png_fname = NULL, *contour_fname = NULL, *data_name = NULL;
-     char *overlay_fname = NULL;
-     REAL mask_thresh = 0;
-     int mask_thresh_set = 0;
-     double min = 0, max = 0, allmin = 0, allmax = 0;
-     int min_set = 0, max_set = 0, collect_range = 0;
+     settings s;
+     double allmin = 0, allmax = 0;
+     int collect_range = 0;
      extern char *optarg;
      extern int optind;
-     int c;
-     int slicedim[4] = {NO_SLICE_DIM,NO_SLICE_DIM,NO_SLICE_DIM,NO_SLICE_DIM};
-     int islice[4], center_slice[4] = {0,0,0,0};
-     int islice_min[4] = {0,0,0,0}, islice_max[4] = {0,0,0,0}, islice_step[4] = {1,1,1,1};
+     int c, dim, i;
      int err;
-     int nx, ny;
-     char *colormap = NULL, *overlay_colormap = NULL, *cmap_dir = NULL;
+     char *colormap = NULL, *overlay_colormap = NULL;
      int overlay_invert = 0;
-     colormap_t cmap = { 0, NULL };
-     colormap_t overlay_cmap = { 0, NULL };
      double overlay_opacity = OVERLAY_OPACITY_DEFAULT;
-     int verbose = 0;
-     int transpose = 0;
-     int zero_center = 0;
-     double scalex = 1.0, scaley = 1.0;
      int invert = 0;
-     double skew = 0.0;
-     int eight_bit = 0;
-     int ifile, num_processed;
-     int data_rank, slicedim3;
+     int njobs = 1;
+     int num_processed;
+     char *range_fname = NULL;
+     int nranges = 0; /* number of -u range files read */
+     qsketch all;
+     double fps = 10;
+     int delta = 0;
+     int to_stdout;
+     int tiles = 0; /* -O dzi */
+     int montage_cols = 0;
+     char *serve_addr = NULL; /* -L */
+     REAL levels[MAX_LEVELS]; /* -b contour levels */
+     int nlevels = 0;
+
+     memset(&s, 0, sizeof(settings));
+     qsketch_init(&all);
+     s.scalex = s.scaley = 1.0;
+     s.suffix = ".png";
+     s.project_op = -1;
+     for (dim = 0; dim < 4; ++dim) {
+	  s.slicedim[dim] = NO_SLICE_DIM;
+	  s.islice_step[dim] = 1;
+     }
 
      colormap = my_strdup(CMAP_DEFAULT);
      overlay_colormap = my_strdup(OVERLAY_CMAP_DEFAULT);
 
-     /* do tilde and $foo expansion on CMAP_DIR */
-     cmap_dir = shell_expand(CMAP_DIR);
-
-     while ((c = getopt(argc, argv, "ho:x:y:z:t:0c:m:M:RC:b:d:vX:Y:S:TrZs:Va:A:8")) != -1)
+     while ((c = GETOPT(argc, argv, "ho:x:y:z:t:03c:m:M:RP:w:u:C:b:d:vX:Y:S:TrZs:Va:A:8B:W:H:j:p:F:f:DG:g:O:I:L:e:")) != -1)
 	  switch (c) {
 	      case 'h':
 		   usage(stdout);
@@ -292,61 +1984,111 @@ int main(int argc, char **argv)
 			  COPYRIGHT);
 		   return EXIT_SUCCESS;
 	      case 'v':
-		   verbose = 1;
+		   s.verbose = 1;
 		   break;
 	      case 'T':
-		   transpose = 1;
+		   s.transpose = 1;
 		   break;
 	      case 'r':
 		   invert = 1;
 		   break;
 	      case '8':
-		   eight_bit = 1;
+		   s.eight_bit = 1;
+		   break;
+	      case 'B':
+		   s.band_budget = atof(optarg) * 1048576;
+		   CHECK(s.band_budget > 0, "invalid -B memory budget");
+		   break;
+	      case 'W':
+		   s.max_width = atoi(optarg);
+		   CHECK(s.max_width > 0, "invalid -W maximum width");
+		   break;
+	      case 'H':
+		   s.max_height = atoi(optarg);
+		   CHECK(s.max_height > 0, "invalid -H maximum height");
 		   break;
 	      case 'Z':
-		   zero_center = 1;
+		   s.zero_center = 1;
 		   break;
 	      case 'R':
 		   collect_range = 1;
 		   break;
+	      case 'P': {
+		   double lo, hi;
+		   int n = sscanf(optarg, "%lf:%lf", &lo, &hi);
+		   if (n == 1)
+			hi = 100 - lo;
+		   if (n < 1 || !(0 <= lo && lo < hi && hi <= 100)) {
+			fprintf(stderr, "h5topng: invalid percentiles -P %s\n",
+				optarg);
+			return EXIT_FAILURE;
+		   }
+		   s.percentiles = 1;
+		   s.plo = lo * 0.01;
+		   s.phi = hi * 0.01;
+		   break;
+	      }
+	      case 'w':
+		   free(range_fname);
+		   range_fname = my_strdup(optarg);
+		   break;
+	      case 'u':
+		   CHECK(!rangefile_read(optarg, &nranges, &allmin, &allmax,
+					 &all), "error reading range file");
+		   break;
 	      case 'o':
-		   free(png_fname);
-		   png_fname = my_strdup(optarg);
+		   free(s.png_fname);
+		   s.png_fname = my_strdup(optarg);
 		   break;
 	      case 'd':
-		   free(data_name);
-		   data_name = my_strdup(optarg);
+		   free(s.data_name);
+		   s.data_name = my_strdup(optarg);
 		   break;
 	      case 'C':
-		   free(contour_fname);
-		   contour_fname = my_strdup(optarg);
+		   free(s.contour_fname);
+		   s.contour_fname = my_strdup(optarg);
 		   break;
 	      case 'A':
-		   free(overlay_fname);
-		   overlay_fname = my_strdup(optarg);
+		   free(s.overlay_fname);
+		   s.overlay_fname = my_strdup(optarg);
 		   break;
 	      case 'x':
-		   get_islice(optarg, &islice_min[0], &islice_max[0],
-			      &islice_step[0]);
-		   slicedim[0] = 0;
+		   get_islice(optarg, &s.islice_min[0], &s.islice_max[0],
+			      &s.islice_step[0]);
+		   s.slicedim[0] = 0;
 		   break;
 	      case 'y':
-		   get_islice(optarg, &islice_min[1], &islice_max[1],
-			      &islice_step[1]);
-		   slicedim[1] = 1;
+		   get_islice(optarg, &s.islice_min[1], &s.islice_max[1],
+			      &s.islice_step[1]);
+		   s.slicedim[1] = 1;
 		   break;
 	      case 'z':
-		   get_islice(optarg, &islice_min[2], &islice_max[2],
-			      &islice_step[2]);
-		   slicedim[2] = 2;
+		   get_islice(optarg, &s.islice_min[2], &s.islice_max[2],
+			      &s.islice_step[2]);
+		   s.slicedim[2] = 2;
 		   break;
 	      case 't':
-		   get_islice(optarg, &islice_min[3], &islice_max[3],
-			      &islice_step[3]);
-		   slicedim[3] = LAST_SLICE_DIM;
+		   get_islice(optarg, &s.islice_min[3], &s.islice_max[3],
+			      &s.islice_step[3]);
+		   s.slicedim[3] = LAST_SLICE_DIM;
+		   break;
+	      case '3':
+		   s.ortho = 1;
+		   break;
+	      case 'I': {
+		   char *colon = strchr(optarg, ':');
+		   CHECK(colon && colon[1] && !colon[2]
+			 && strchr("xyzt", colon[1]),
+			 "invalid -I axis: must be x, y, z or t");
+		   s.project_dim = (int) (strchr("xyzt", colon[1]) - "xyzt");
+		   *colon = 0;
+		   s.project_op = project_op(optarg);
+		   CHECK(s.project_op >= 0, "invalid -I projection");
 		   break;
+	      }
               case '0':
-                   center_slice[0] = center_slice[1] = center_slice[2] = 1;
+                   s.center_slice[0] = s.center_slice[1]
+			= s.center_slice[2] = 1;
                    break;
 	      case 'c':
 		   free(colormap);
@@ -363,28 +2105,108 @@ int main(int argc, char **argv)
 		   }
 		   break;
 	      case 'm':
-		   min = atof(optarg);
-		   min_set = 1;
+		   s.min = atof(optarg);
+		   s.min_set = 1;
 		   break;
 	      case 'M':
-		   max = atof(optarg);
-		   max_set = 1;
+		   s.max = atof(optarg);
+		   s.max_set = 1;
 		   break;
-	      case 'b':
-		   mask_thresh = atof(optarg);
-		   mask_thresh_set = 1;
+	      case 'b': {
+		   char *start = optarg, *end;
+		   nlevels = 0;
+		   for (;;) {
+			CHECK(nlevels < MAX_LEVELS, "too many contour levels for -b");
+			levels[nlevels++] = strtod(start, &end);
+			CHECK(end != start, "invalid contour level for -b");
+			if (*end != ',')
+			     break;
+			start = end + 1;
+		   }
+		   CHECK(!*end, "invalid contour level for -b");
+		   s.mask_thresh = levels[0];
+		   s.mask_thresh_set = 1;
 		   break;
+	      }
 	      case 'X':
-		   scalex = atof(optarg);
+		   s.scalex = atof(optarg);
 		   break;
 	      case 'Y':
-		   scaley = atof(optarg);
+		   s.scaley = atof(optarg);
 		   break;
 	      case 'S':
-		   scalex = scaley = atof(optarg);
+		   s.scalex = s.scaley = atof(optarg);
+		   break;
+	      case 'e':
+		   s.variants = (variant *) realloc(s.variants,
+						    (s.nvariants + 1)
+						    * sizeof(variant));
+		   CHECK(s.variants, "out of memory");
+		   parse_variant(optarg, &s.variants[s.nvariants++]);
 		   break;
 	      case 's':
-		   skew = atof(optarg) * 3.14159265358979323846 / 180.0;
+		   s.skew = atof(optarg) * 3.14159265358979323846 / 180.0;
+		   break;
+	      case 'j':
+		   njobs = atoi(optarg);
+		   CHECK(njobs >= 0, "invalid number of jobs for -j");
+		   break;
+	      case 'p':
+		   CHECK(!writepng_set_compression(optarg),
+			 "invalid compression settings for -p");
+		   break;
+	      case 'F':
+		   free(s.apng_fname);
+		   s.apng_fname = my_strdup(optarg);
+		   break;
+	      case 'f':
+		   fps = atof(optarg);
+		   CHECK(fps > 0, "invalid frame rate for -f");
+		   break;
+	      case 'D':
+		   delta = 1;
+		   break;
+	      case 'G':
+		   free(s.montage_fname);
+		   s.montage_fname = my_strdup(optarg);
+		   break;
+	      case 'g':
+		   montage_cols = atoi(optarg);
+		   CHECK(montage_cols > 0, "invalid number of columns for -g");
+		   break;
+	      case 'L':
+		   free(serve_addr);
+		   serve_addr = my_strdup(optarg);
+		   break;
+	      case 'O':
+		   if (!strcmp(optarg, "png")) {
+			writepng_set_format(WRITEPNG_PNG);
+			s.suffix = ".png";
+		   }
+		   else if (!strcmp(optarg, "qoi")) {
+			writepng_set_format(WRITEPNG_QOI);
+			s.suffix = ".qoi";
+		   }
+		   else if (!strcmp(optarg, "ppm")) {
+			writepng_set_format(WRITEPNG_PPM);
+			s.suffix = ".ppm";
+		   }
+		   else if (!strcmp(optarg, "rgb")) {
+			writepng_set_format(WRITEPNG_RGB);
+			s.suffix = ".rgb";
+		   }
+		   else if (!strncmp(optarg, "dzi", 3)) {
+			int size = 256;
+			CHECK(!optarg[3] || (sscanf(optarg + 3, ":%d", &size) == 1
+					     && size >= 16),
+			      "invalid tile size for -O dzi");
+			writepng_set_format(WRITEPNG_DZI);
+			writepng_set_tile_size(size);
+			s.suffix = ".dzi";
+			tiles = 1;
+		   }
+		   else
+			CHECK(0, "invalid output format for -O");
 		   break;
 	      default:
 		   fprintf(stderr, "Invalid argument -%c\n", c);
@@ -392,229 +2214,222 @@ int main(int argc, char **argv)
 		   return EXIT_FAILURE;
 	  }
 
-     CHECK(!overlay_fname || !eight_bit,
+     CHECK(!s.overlay_fname || !s.eight_bit,
 	   "-8 option is not currently supported with -A");
+     for (dim = 0; dim < 4; ++dim)
+	  CHECK(s.islice_step[dim] > 0, "slice step must be positive");
 
-     cmap = get_cmap(cmap_dir, colormap, invert, 1.0, verbose);
-     if (overlay_fname)
-	  overlay_cmap = get_cmap(cmap_dir, overlay_colormap, overlay_invert,
-				  overlay_opacity, verbose);
+     /* with -o -, stdout is reserved for the images */
+     to_stdout = s.png_fname && !strcmp(s.png_fname, "-");
+     CHECK(!to_stdout || !s.verbose, "-v cannot be used with -o -");
+     CHECK(!to_stdout || !s.apng_fname, "-F cannot be used with -o -");
+     CHECK(!to_stdout || !tiles, "-O dzi cannot be used with -o -");
+     CHECK(!tiles || !s.png_fname || (strlen(s.png_fname) > 4
+	   && !strcmp(s.png_fname + strlen(s.png_fname) - 4, ".dzi")),
+	   "with -O dzi, the -o file name must end in .dzi");
+     CHECK(!tiles || !s.apng_fname, "-O dzi cannot be used with -F");
+     CHECK(!to_stdout || !s.montage_fname, "-G cannot be used with -o -");
+     CHECK(!tiles || !s.montage_fname, "-O dzi cannot be used with -G");
+     CHECK(!s.apng_fname || !s.montage_fname, "-F cannot be used with -G");
+     CHECK(!s.apng_fname || !strcmp(s.suffix, ".png"),
+	   "-O cannot be used with -F (which writes an animated PNG)");
+     if (s.ortho) {
+	  CHECK(!s.contour_fname && !s.overlay_fname,
+		"-C and -A are not currently supported with -3");
+	  CHECK(!s.max_width && !s.max_height,
+		"-W and -H are not currently supported with -3");
+	  CHECK(!s.apng_fname, "-F cannot be used with -3");
+	  /* the point defaults to the center */
+	  for (dim = 0; dim < 3; ++dim)
+	       if (s.slicedim[dim] == NO_SLICE_DIM) {
+		    s.slicedim[dim] = dim;
+		    s.center_slice[dim] = 1;
+	       }
+	  if (!montage_cols)
+	       montage_cols = 3;
+     }
+     if (s.project_op >= 0) {
+	  CHECK(!s.ortho, "-I cannot be used with -3");
+	  CHECK(!s.contour_fname && !s.overlay_fname,
+		"-C and -A are not currently supported with -I");
+	  CHECK(!s.max_width && !s.max_height,
+		"-W and -H are not currently supported with -I");
+     }
+     if (s.nvariants) {
+	  CHECK(!s.ortho, "-e is not currently supported with -3");
+	  CHECK(!s.max_width && !s.max_height,
+		"-W and -H are not currently supported with -e");
+	  CHECK(!s.apng_fname && !s.montage_fname && !tiles && !serve_addr,
+		"-F, -G, -O dzi and --serve cannot be used with -e");
+     }
+     if (serve_addr) {
+	  CHECK(!s.contour_fname && !s.overlay_fname,
+		"-C and -A are not currently supported with --serve");
+	  CHECK(!s.ortho && s.project_op < 0,
+		"-3 and -I are not currently supported with --serve");
+	  CHECK(!s.max_width && !s.max_height,
+		"-W and -H cannot be used with --serve (try /tile)");
+	  CHECK(!s.png_fname && !s.apng_fname && !s.montage_fname && !tiles
+		&& !collect_range && !range_fname,
+		"-o, -F, -G, -O dzi, -R and -w cannot be used with --serve");
+	  CHECK(strcmp(s.suffix, ".rgb"), "-O rgb cannot be used with --serve");
+     }
+     /* the tiles of a montage share a colormap range */
+     if (s.montage_fname && !(s.min_set && s.max_set))
+	  collect_range = 1;
+
+     /* with only -u and -w, just merge the range files */
+     if (optind == argc && nranges && range_fname) {
+	  CHECK(!rangefile_write(range_fname, allmin, allmax, &all),
+		"error writing range file");
+	  qsketch_destroy(&all);
+	  free(range_fname);
+	  return EXIT_SUCCESS;
+     }
+
+     s.cmap = get_cmap(colormap, invert, 1.0, s.verbose);
+     if (s.overlay_fname)
+	  s.overlay_cmap = get_cmap(overlay_colormap, overlay_invert,
+				    overlay_opacity, s.verbose);
+     for (i = 0; i < s.nvariants; ++i)
+	  if (s.variants[i].colormap)
+	       s.variants[i].cmap = get_cmap(s.variants[i].colormap, 0, 1.0,
+					     s.verbose);
+
+     /* several contour levels are drawn in the Matlab line colors, in
+	increasing order of the levels (whatever order they were given in) */
+     if (nlevels > 1) {
+	  const builtin_colormap *lines = find_builtin_cmap("lines");
+	  rgba_t colors[MAX_LEVELS];
+	  CHECK(lines, "missing lines colormap for -b");
+	  qsort(levels, nlevels, sizeof(REAL), cmp_levels);
+	  for (i = 0; i < nlevels; ++i)
+	       colors[i] = lines->cmap.rgba[i % lines->cmap.n];
+	  CHECK(!writepng_set_contour_levels(nlevels, levels, colors),
+		"out of memory");
+     }
 
      if (optind == argc) {  /* no parameters left */
 	  usage(stderr);
 	  return EXIT_FAILURE;
      }
+     s.fnames = argv + optind;
+     s.nfiles = argc - optind;
 
-     contour_data.data = overlay_data.data = NULL;
-
-     slicedim3 = slicedim[3];
      {
           char *dname, *h5_fname;
           h5_fname = split_fname(argv[optind], &dname);
           if (!dname[0])
-               dname = data_name;
-	  err = arrayh5_read_rank(h5_fname, dname, &data_rank);
+               dname = s.data_name;
+	  err = arrayh5_read_rank(h5_fname, dname, &s.data_rank);
 	  CHECK(!err, arrayh5_read_strerror[err]);
 	  free(h5_fname);
-	  if (verbose)
-	       printf("data rank = %d\n", data_rank);
+	  if (s.verbose)
+	       printf("data rank = %d\n", s.data_rank);
+	  CHECK(!s.ortho || s.data_rank - (s.slicedim[3] != NO_SLICE_DIM) == 3,
+		"-3 requires three-dimensional data (after any -t slice)");
      }
 
- process_files:
-
-     num_processed = 0;
-
-     for (islice[0] = islice_min[0]; islice[0] <= islice_max[0];
-	  islice[0] += islice_step[0])
-     for (islice[1] = islice_min[1]; islice[1] <= islice_max[1];
-	  islice[1] += islice_step[1])
-     for (islice[2] = islice_min[2]; islice[2] <= islice_max[2];
-	  islice[2] += islice_step[2])
-     for (islice[3] = islice_min[3]; islice[3] <= islice_max[3];
-	  islice[3] += islice_step[3]) {
-
-     int onx = 1, ony = 1;
-     int cnx = 1, cny = 1;
-
-     if (contour_fname && !collect_range) {
-	  int rank;
-	  char *fname, *dname;
-
-	  fname = split_fname(contour_fname, &dname);
-	  if (!dname[0])
-	       dname = NULL;
+     /* share the processors between the -j processes */
+     if (njobs == 0)
+	  njobs = writepng_get_nthreads();
+     if (njobs > 1)
+	  writepng_set_nthreads(imax(1, writepng_get_nthreads() / njobs));
 
-	  if (verbose)
-	       printf("reading contour data from \"%s\".\n", fname);
-
-	  err = arrayh5_read_rank(fname, dname, &rank);
-          CHECK(!err, arrayh5_read_strerror[err]);
-	  if (slicedim3 == LAST_SLICE_DIM && data_rank > rank)
-	       slicedim[3] = NO_SLICE_DIM;
-
-	  err = arrayh5_read(&contour_data, fname, dname, NULL,
-			     4, slicedim, islice, center_slice);
-	  slicedim[3] = slicedim3;
-	  CHECK(!err, arrayh5_read_strerror[err]);
-	  CHECK(contour_data.rank == 1 || contour_data.rank == 2,
-	       "contour slice must be one or two dimensional");
-
-	  cnx = contour_data.dims[0];
-	  cny = contour_data.rank >= 2 ? contour_data.dims[1] : 1;
-
-	  if (!mask_thresh_set) {
-               double c_min, c_max;
-               arrayh5_getrange(contour_data, &c_min, &c_max);
-	       mask_thresh = (c_min + c_max) * 0.5;
+     /* the range pass, whose result is merged with the -u range files */
+     if (collect_range || range_fname) {
+	  double dmin, dmax;
+	  run_frames(&s, 1, njobs, &dmin, &dmax, &num_processed,
+		     range_fname || (s.percentiles && !(s.min_set && s.max_set))
+		     ? &all : NULL);
+	  if (s.verbose && num_processed)
+	       printf("all data range from %g to %g.\n", dmin, dmax);
+	  if (num_processed) {
+	       if (!nranges || dmin < allmin)
+		    allmin = dmin;
+	       if (!nranges || dmax > allmax)
+		    allmax = dmax;
+	       ++nranges;
+	  }
+	  if (range_fname) {
+	       CHECK(!rangefile_write(range_fname, allmin, allmax, &all),
+		     "error writing range file");
+	       if (!collect_range)
+		    goto done;
 	  }
-
-	  free(fname);
      }
 
-     if (overlay_fname && !collect_range) {
-	  int rank;
-	  char *fname, *dname;
-
-	  fname = split_fname(overlay_fname, &dname);
-	  if (!dname[0])
-	       dname = NULL;
-
-	  if (verbose)
-	       printf("reading overlay data from \"%s\".\n", fname);
-
-	  err = arrayh5_read_rank(fname, dname, &rank);
-          CHECK(!err, arrayh5_read_strerror[err]);
-	  if (slicedim3 == LAST_SLICE_DIM && data_rank > rank)
-	       slicedim[3] = NO_SLICE_DIM;
-
-	  err = arrayh5_read(&overlay_data, fname, dname, NULL,
-			     4, slicedim, islice, center_slice);
-	  slicedim[3] = slicedim3;
-	  CHECK(!err, arrayh5_read_strerror[err]);
-	  CHECK(overlay_data.rank == 1 || overlay_data.rank == 2,
-	       "overlay slice must be one or two dimensional");
+     if (nranges) {
+	  if (s.percentiles && !(s.min_set && s.max_set)) {
+	       allmin = qsketch_quantile(&all, s.plo);
+	       allmax = qsketch_quantile(&all, s.phi);
+	       if (s.verbose)
+		    printf("percentiles %g%% to %g%% range from %g to %g.\n",
+			   s.plo * 100, s.phi * 100, allmin, allmax);
+	  }
+	  if (!s.min_set)
+	       s.min = allmin;
+	  if (!s.max_set)
+	       s.max = allmax;
+	  s.min_set = s.max_set = 1;
+     }
 
-	  onx = overlay_data.dims[0];
-	  ony = overlay_data.rank >= 2 ? overlay_data.dims[1] : 1;
+     if (serve_addr) {
+	  CHECK(!serve_files(&s, serve_addr), "could not serve images");
+	  goto done;
+     }
 
-	  free(fname);
+     if (s.apng_fname || s.montage_fname || to_stdout) {
+	  /* the frames must be written in order, so just render each
+	     frame in parallel (with all of the processors) */
+	  njobs = 1;
+	  writepng_set_nthreads(0);
+     }
+     if (s.apng_fname)
+	  CHECK(!writepng_anim_begin(s.apng_fname, num_frames(&s), fps, delta),
+		"error creating animated PNG");
+     if (s.montage_fname) {
+	  int tile_width = 0, tile_height = 0; /* size of the first image */
+	  if (s.ortho)
+	       ortho_tile_size(&s, &tile_width, &tile_height);
+	  CHECK(!writepng_montage_begin(s.montage_fname,
+					num_frames(&s) * (s.ortho ? 3 : 1),
+					montage_cols, tile_width, tile_height),
+		"error creating montage");
      }
 
-     if (verbose)
-	  printf("------\n");
-     for (ifile = optind; ifile < argc; ++ifile) {
-          char *dname, *h5_fname;
-          h5_fname = split_fname(argv[ifile], &dname);
-          if (!dname[0])
-               dname = data_name;
-
-          if (verbose) {
-               int i;
-               printf("reading from \"%s\"", h5_fname);
-               for (i = 0; i < 4; ++i)
-                    if (slicedim[i] != NO_SLICE_DIM)
-                         printf(", slice at %d in %c dimension", islice[i],
-                                slicedim[i] == LAST_SLICE_DIM ? 't'
-                                : slicedim[i] + 'x');
-               printf(".\n");
-          }
-
-	  err = arrayh5_read(&a, h5_fname, dname, NULL,
-			     4, slicedim, islice, center_slice);
-	  CHECK(!err, arrayh5_read_strerror[err]);
-	  CHECK(a.rank >= 1, "data must have at least one dimension");
-	  CHECK(a.rank <= 2, "data can have at most two dimensions (try specifying a slice)");
-
-	  if (!png_fname) {
-	       char dimname[] = "xyzt", suff[1024] = "";
-	       int dim;
-	       for (dim = 0; dim < 4; ++dim)
-		    if (islice_max[dim] >= islice_min[dim]+islice_step[dim]) {
-			 char s[128];
-			 sprintf(s, ".%c%0*d", dimname[dim],
-				 1 + ilog10(imax(iabs(islice_min[dim]),
-						 iabs(islice_max[dim]))),
-				 islice[dim]);
-			 strcat(suff, s);
-		    }
-	       strcat(suff, ".png");
-	       png_fname = replace_suffix(h5_fname, ".h5", suff);
-	  }
-
-	  {
-	       double a_min, a_max;
-	       arrayh5_getrange(a, &a_min, &a_max);
-	       if (verbose)
-		    printf("data ranges from %g to %g.\n", a_min, a_max);
-	       if (!min_set)
-		    min = a_min;
-	       if (!max_set)
-		    max = a_max;
-	       if (!num_processed || a_min < allmin)
-		    allmin = a_min;
-	       if (!num_processed || a_max > allmax)
-		    allmax = a_max;
-	       if (min > max) {
-		    a_min = min;
-		    min = max;
-		    max = a_min;
-	       }
-	       if (zero_center) {
-		    if (!max_set || min_set || max <= 0)
-			 max = fabs(max) > fabs(min) ? fabs(max) : fabs(min);
-		    min = -max;
-	       }
-	  }
+     run_frames(&s, 0, njobs, &allmin, &allmax, &num_processed, NULL);
+     if (s.verbose && num_processed)
+	  printf("all data range from %g to %g.\n", allmin, allmax);
 
-	  if (!collect_range) {
-	       nx = a.dims[0];
-	       ny = a.rank < 2 ? 1 : a.dims[1];
+     if (s.apng_fname)
+	  CHECK(!writepng_anim_end(), "error writing animated PNG");
+     if (s.montage_fname)
+	  CHECK(!writepng_montage_end(), "error writing montage");
 
-	       if (verbose)
-		    printf("writing \"%s\" from %dx%d input data.\n",
-			   png_fname, nx, ny);
+done:
+     qsketch_destroy(&all);
+     free(range_fname);
+     free(serve_addr);
+     free(s.apng_fname);
+     free(s.montage_fname);
+     free(s.png_fname);
+     free(s.contour_fname);
+     free(s.overlay_fname);
+     free(s.data_name);
 
-	       writepng(png_fname, nx, ny, !transpose, skew,
-			scaley, scalex, a.data,
-			contour_fname ? contour_data.data : NULL, mask_thresh,
-			cnx, cny,
-			overlay_fname ? overlay_data.data : NULL,overlay_cmap,
-			onx, ony,
-			min, max, cmap, eight_bit);
-	  }
-	  arrayh5_destroy(a);
-	  free(png_fname); png_fname = NULL;
-	  free(h5_fname);
-	  ++num_processed;
+     free(s.cmap.rgba);
+     free(s.overlay_cmap.rgba);
+     for (i = 0; i < s.nvariants; ++i) {
+	  free(s.variants[i].name);
+	  free(s.variants[i].cmap.rgba);
      }
-
-     if (contour_data.data)
-	  arrayh5_destroy(contour_data);
-     if (overlay_data.data)
-	  arrayh5_destroy(overlay_data);
-     contour_data.data = overlay_data.data = NULL;
-
-     } /* islice loop */
-
-     if (verbose && num_processed)
-	  printf("all data range from %g to %g.\n", allmin, allmax);
-     if (collect_range) {
-	  if (!min_set)
-	       min = allmin;
-	  if (!max_set)
-	       max = allmax;
-	  min_set = max_set = 1;
-	  collect_range = 0;
-	  goto process_files;
-     }
-
-     free(contour_fname);
-     free(overlay_fname);
-     free(data_name);
-
-     if (cmap.rgba != gray_colors)
-	  free(cmap.rgba);
+     free(s.variants);
      free(colormap);
-     free(cmap_dir);
+     if (writepng_failures()) {
+	  fprintf(stderr, "h5topng error: %d image(s) could not be written\n",
+		  writepng_failures());
+	  return EXIT_FAILURE;
+     }
      return EXIT_SUCCESS;
 }
@@ -0,0 +1,100 @@
+/* Copyright (c) 1999-2023 Massachusetts Institute of Technology
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef H5TOPNG_H
+#define H5TOPNG_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/***********************************************************************/
+
+/* In-situ rendering: the images that h5topng makes of 1d and 2d data,
+   written directly from arrays in memory, e.g. by a simulation every so
+   many time steps, rather than by writing HDF5 files for h5topng.  This
+   is the libh5topng library (link with -lh5topng -lpng -lz -lm, and
+   -lpthread if it uses threads).  The calls are not thread-safe, but
+   each image is rendered with several threads. */
+
+/* The options, which correspond to those of h5topng: */
+typedef struct {
+     const char *colormap; /* -c: a built-in colormap, or a colormap
+			      file, reversed if it starts with "-"
+			      (default: "gray") */
+     double min, max; /* -m and -M: the colormap range, if min_set and */
+     int min_set, max_set; /* max_set (default: the range of the data) */
+     double plo, phi; /* -P: if percentiles, the range is from the plo
+			 and phi quantiles (0-1) of the data */
+     int percentiles;
+     int zero_center; /* -Z */
+     double scalex, scaley; /* -X and -Y (default: 1) */
+     double skew; /* -s, in degrees */
+     int transpose; /* -T */
+     int eight_bit; /* -8 */
+     /* -C and -b: contours of mask (if not NULL), an array laid out like
+	the data, around mask_thresh if mask_thresh_set (or else around
+	the middle of the range of the mask) */
+     const double *mask;
+     double mask_thresh;
+     int mask_thresh_set;
+     /* -A and -a: overlay (if not NULL), an array laid out like the data,
+	in overlay_colormap (default: "yellow") with opacity
+	overlay_opacity (0-1) */
+     const double *overlay;
+     const char *overlay_colormap;
+     double overlay_opacity;
+     const char *format; /* -O: "png" (the default), "qoi", "ppm" or "rgb" */
+     const char *compression; /* -p: PNG compression (default: "default") */
+     int nthreads; /* threads to use (default, or <= 0: all processors) */
+} h5topng_options;
+
+/* initialize o to the defaults, i.e. h5topng without any options */
+extern void h5topng_init_options(h5topng_options *o);
+
+/* Write the image of data, of rank 1 or 2 and size dims[0] (x dims[1]),
+   to filename ("-" for stdout), where element i,j of the data is
+   data[i*strides[0] + j*strides[1]] (strides in elements, e.g. 1 and
+   dims[0] for a Fortran array), or if strides is NULL the array is
+   contiguous in row-major (C and HDF5) order.  The options are the
+   defaults if o is NULL.  Returns nonzero, with a message on stderr, if
+   the options are invalid or if we run out of memory.  (Errors writing
+   the file are only reported on stderr, as for h5topng.) */
+extern int h5topng_write(const char *filename, const double *data,
+			 int rank, const int *dims, const ptrdiff_t *strides,
+			 const h5topng_options *o);
+
+/* the same, for single-precision data */
+extern int h5topng_write_float(const char *filename, const float *data,
+			       int rank, const int *dims,
+			       const ptrdiff_t *strides,
+			       const h5topng_options *o);
+
+/***********************************************************************/
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif /* __cplusplus */
+
+#endif /* H5TOPNG_H */
@@ -46,6 +46,7 @@
 #include "arrayh5.h"
 #include "copyright.h"
 #include "h5utils.h"
+#include "rangefile.h"
 
 #ifdef HAVE_UINT16_T
 typedef uint16_t my_uint16_t;
@@ -77,6 +78,10 @@ void usage(FILE *f)
 	     "   -m <min> : set bottom of scale for 1/2 byte encoding\n"
 	     "   -M <max> : set top of scale for 1/2 byte encoding\n"
 	     "         -Z : center scale at zero for 1/2 byte encoding\n"
+	     "  -u <file> : set scale for 1/2 byte encoding from a range file\n"
+	     "              (as written by -w, or by h5topng -w)\n"
+	     "  -w <file> : write the range of all the data to a range file,\n"
+	     "              instead of converting it\n"
 	     "         -r : invert scale & data values\n"
 	     "    -x <ix> : take x=<ix> slice of data\n"
 	     "    -y <iy> : take y=<iy> slice of data\n"
@@ -183,13 +188,18 @@ int main(int argc, char **argv)
      int invert = 0;
      double min = 0, max = 0;
      int min_set = 0, max_set = 0;
+     char *range_fname = NULL;
+     int nranges = 0; /* number of -u range files read */
+     double range_min = 0, range_max = 0;
+     qsketch all;
      int verbose = 0, combine = 0;
      int slicedim[4] = {NO_SLICE_DIM,NO_SLICE_DIM,NO_SLICE_DIM,NO_SLICE_DIM};
      int islice[4], center_slice[4] = {0,0,0,0};
      int nx = 0, ny = 0, nz = 0, na;
      int store_bytes = 4, fix_byte_order = 1;
 
-     while ((c = getopt(argc, argv, "ho:d:vV124mMZranx:y:z:t:0")) != -1)
+     qsketch_init(&all);
+     while ((c = getopt(argc, argv, "ho:d:vV124m:M:Zranx:y:z:t:0u:w:")) != -1)
 	  switch (c) {
 	      case 'h':
 		   usage(stdout);
@@ -256,15 +266,39 @@ int main(int argc, char **argv)
 	      case 'd':
 		   data_name = my_strdup(optarg);
 		   break;		   
+	      case 'u':
+		   CHECK(!rangefile_read(optarg, &nranges,
+					 &range_min, &range_max, &all),
+			 "error reading range file");
+		   break;
+	      case 'w':
+		   free(range_fname);
+		   range_fname = my_strdup(optarg);
+		   break;
 	      default:
 		   fprintf(stderr, "Invalid argument -%c\n", c);
 		   usage(stderr);
 		   return EXIT_FAILURE;
 	  }
+     /* with only -u and -w, just merge the range files */
+     if (optind == argc && nranges && range_fname) {
+	  CHECK(!rangefile_write(range_fname, range_min, range_max, &all),
+		"error writing range file");
+	  qsketch_destroy(&all);
+	  free(range_fname);
+	  return EXIT_SUCCESS;
+     }
      if (optind == argc) {  /* no parameters left */
 	  usage(stderr);
 	  return EXIT_FAILURE;
      }
+     if (nranges && !range_fname) {
+	  if (!min_set)
+	       min = range_min;
+	  if (!max_set)
+	       max = range_max;
+	  min_set = max_set = 1;
+     }
 
      CHECK(store_bytes != 4 || sizeof(float) == 4, 
 	   "'float' is wrong size for -4");
@@ -290,6 +324,24 @@ int main(int argc, char **argv)
 	  CHECK(!err, arrayh5_read_strerror[err]);
 	  CHECK(a[ia].rank >= 1, "data must have at least one dimension");
 	  CHECK(a[ia].rank <= 3, "data can have at most 3 dimensions (try taking a slice");
+
+	  if (range_fname) { /* just collect the range for -w */
+	       double a_min, a_max;
+	       arrayh5_getrange(a[ia], &a_min, &a_max);
+	       if (verbose)
+		    printf("data in %s ranges from %g to %g.\n",
+			   h5_fname, a_min, a_max);
+	       if (!nranges || a_min < range_min)
+		    range_min = a_min;
+	       if (!nranges || a_max > range_max)
+		    range_max = a_max;
+	       ++nranges;
+	       CHECK(!qsketch_add(&all, a[ia].data, a[ia].N), "out of memory");
+	       arrayh5_destroy(a[ia]);
+	       free(found_dname);
+	       free(h5_fname);
+	       continue;
+	  }
 	  
 	  CHECK(!combine || !ia || arrayh5_conformant(a[ia], a[0]),
 		"all arrays must be conformant to combine them");
@@ -363,7 +415,14 @@ int main(int argc, char **argv)
 	  free(h5_fname);
      }
 
-     if (combine) {
+     if (range_fname) {
+	  if (verbose)
+	       printf("writing range from %g to %g to \"%s\".\n",
+		      range_min, range_max, range_fname);
+	  CHECK(!rangefile_write(range_fname, range_min, range_max, &all),
+		"error writing range file");
+     }
+     else if (combine) {
 	  FILE *f;
 	  int ix, iy, iz, N = nx * ny * nz;
 
@@ -413,6 +472,8 @@ int main(int argc, char **argv)
      }
 
      free(a);
+     qsketch_destroy(&all);
+     free(range_fname);
 
      if (data_name)
 	  free(data_name);
@@ -0,0 +1,258 @@
+/* Copyright (c) 1999-2023 Massachusetts Institute of Technology
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/* The in-situ rendering library (see h5topng.h): h5topng, minus HDF5,
+   for arrays in memory. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "config.h"
+#include "h5topng.h"
+#include "writepng.h"
+#include "colormap.h"
+#include "qsketch.h"
+
+#define OVERLAY_CMAP_DEFAULT "yellow"
+#define OVERLAY_OPACITY_DEFAULT 0.2
+
+void h5topng_init_options(h5topng_options *o)
+{
+     memset(o, 0, sizeof(h5topng_options));
+     o->colormap = "gray";
+     o->plo = 0.0; o->phi = 1.0;
+     o->scalex = o->scaley = 1.0;
+     o->overlay_colormap = OVERLAY_CMAP_DEFAULT;
+     o->overlay_opacity = OVERLAY_OPACITY_DEFAULT;
+     o->format = "png";
+     o->compression = "default";
+}
+
+/* copy the nx x ny array data, with element i,j at i*s0 + j*s1, to a
+   new contiguous array (or NULL if out of memory); either d or f is
+   the data, in double or single precision */
+static REAL *copy_data(const double *d, const float *f, int nx, int ny,
+		       ptrdiff_t s0, ptrdiff_t s1)
+{
+     REAL *a = (REAL *) malloc(sizeof(REAL) * nx * (size_t) ny);
+     int i, j;
+
+     if (!a)
+	  return NULL;
+     for (i = 0; i < nx; ++i)
+	  for (j = 0; j < ny; ++j)
+	       a[i * (size_t) ny + j] = d ? d[i * s0 + j * s1]
+		    : f[i * s0 + j * s1];
+     return a;
+}
+
+static void get_range(const REAL *a, size_t n, double *min, double *max)
+{
+     size_t i;
+
+     *min = *max = a[0];
+     for (i = 1; i < n; ++i) {
+	  if (a[i] < *min)
+	       *min = a[i];
+	  if (a[i] > *max)
+	       *max = a[i];
+     }
+}
+
+/* add the n values of a (either r, or f in single precision) to the
+   sketch q, all at once (converting them to double if need be), since
+   the sketch depends on how the data is batched and should be the same
+   as h5topng's; returns nonzero if out of memory */
+static int sketch_add(qsketch *q, const REAL *r, const float *f, size_t n)
+{
+     double *buf;
+     size_t i;
+     int err;
+
+     if (r && sizeof(REAL) == sizeof(double))
+	  return qsketch_add(q, (const double *) r, n);
+     if (!(buf = (double *) malloc(sizeof(double) * n)))
+	  return 1;
+     for (i = 0; i < n; ++i)
+	  buf[i] = r ? r[i] : f[i];
+     err = qsketch_add(q, buf, n);
+     free(buf);
+     return err;
+}
+
+static int set_format(const char *format)
+{
+     if (!strcmp(format, "png"))
+	  writepng_set_format(WRITEPNG_PNG);
+     else if (!strcmp(format, "qoi"))
+	  writepng_set_format(WRITEPNG_QOI);
+     else if (!strcmp(format, "ppm"))
+	  writepng_set_format(WRITEPNG_PPM);
+     else if (!strcmp(format, "rgb"))
+	  writepng_set_format(WRITEPNG_RGB);
+     else
+	  return 1;
+     return 0;
+}
+
+/* h5topng_write, for the data d or (in single precision) f */
+static int write_image(const char *filename, const double *d, const float *f,
+		       int rank, const int *dims, const ptrdiff_t *strides,
+		       const h5topng_options *o_)
+{
+     h5topng_options o;
+     int nx, ny, ret = 1;
+     ptrdiff_t s0, s1;
+     size_t n;
+     REAL *data = NULL, *mask = NULL, *overlay = NULL;
+     REAL mask_thresh = 0;
+     colormap_t cmap = {0, NULL}, overlay_cmap = {0, NULL};
+     double a_min, a_max, min, max;
+     char *fname = NULL;
+
+     if (o_)
+	  o = *o_;
+     else
+	  h5topng_init_options(&o);
+
+     if (rank != 1 && rank != 2) {
+	  fprintf(stderr, "h5topng: data must be one or two dimensional\n");
+	  return 1;
+     }
+     nx = dims[0];
+     ny = rank < 2 ? 1 : dims[1];
+     if (nx < 1 || ny < 1) {
+	  fprintf(stderr, "h5topng: no elements in array\n");
+	  return 1;
+     }
+     n = nx * (size_t) ny;
+     s0 = strides ? strides[0] : ny;
+     s1 = strides && rank == 2 ? strides[1] : 1;
+     if (o.eight_bit && o.overlay) {
+	  fprintf(stderr, "h5topng: eight_bit is not currently supported "
+		  "with an overlay\n");
+	  return 1;
+     }
+     if (set_format(o.format ? o.format : "png")) {
+	  fprintf(stderr, "h5topng: invalid output format \"%s\"\n", o.format);
+	  return 1;
+     }
+     if (writepng_set_compression(o.compression ? o.compression
+				  : "default")) {
+	  fprintf(stderr, "h5topng: invalid compression settings \"%s\"\n",
+		  o.compression);
+	  return 1;
+     }
+     writepng_set_nthreads(o.nthreads);
+     /* the mask and overlay are copied anew each time, so their rendered
+	layers cannot be kept (the copies may even reuse the addresses of
+	the last ones) */
+     writepng_cache_layers(0);
+
+     /* single-precision data is rendered in place if it is contiguous */
+     if (!f || (s0 != ny || s1 != 1)) {
+	  if (!(data = copy_data(d, f, nx, ny, s0, s1)))
+	       goto nomem;
+	  get_range(data, n, &a_min, &a_max);
+     }
+     else
+	  float_range(f, n, &a_min, &a_max);
+     if (o.percentiles && !(o.min_set && o.max_set)) {
+	  qsketch q;
+	  qsketch_init(&q);
+	  if (sketch_add(&q, data, f, n)) {
+	       qsketch_destroy(&q);
+	       goto nomem;
+	  }
+	  a_min = qsketch_quantile(&q, o.plo);
+	  a_max = qsketch_quantile(&q, o.phi);
+	  qsketch_destroy(&q);
+     }
+     colormap_range(a_min, a_max, o.min, o.min_set, o.max, o.max_set,
+		    o.zero_center, &min, &max);
+
+     if (o.mask) {
+	  if (!(mask = copy_data(o.mask, NULL, nx, ny, s0, s1)))
+	       goto nomem;
+	  mask_thresh = o.mask_thresh;
+	  if (!o.mask_thresh_set) {
+	       double c_min, c_max;
+	       get_range(mask, n, &c_min, &c_max);
+	       mask_thresh = (c_min + c_max) * 0.5;
+	  }
+     }
+     if (o.overlay
+	 && !(overlay = copy_data(o.overlay, NULL, nx, ny, s0, s1)))
+	  goto nomem;
+
+     if (get_colormap(&cmap, o.colormap ? o.colormap : "gray", 0, 1.0, 0))
+	  goto done;
+     if (o.overlay && get_colormap(&overlay_cmap, o.overlay_colormap
+				   ? o.overlay_colormap : OVERLAY_CMAP_DEFAULT,
+				   0, o.overlay_opacity, 0))
+	  goto done;
+
+     /* writepng takes a non-const filename, which it does not modify */
+     if (!(fname = (char *) malloc(strlen(filename) + 1)))
+	  goto nomem;
+     strcpy(fname, filename);
+     if (data)
+	  writepng(fname, nx, ny, !o.transpose,
+		   o.skew * 3.14159265358979323846 / 180.0,
+		   o.scaley, o.scalex, data, mask, mask_thresh, nx, ny,
+		   overlay, overlay_cmap, nx, ny,
+		   min, max, cmap, o.eight_bit);
+     else
+	  writepng_float(fname, nx, ny, !o.transpose,
+			 o.skew * 3.14159265358979323846 / 180.0,
+			 o.scaley, o.scalex, f, mask, mask_thresh, nx, ny,
+			 overlay, overlay_cmap, nx, ny,
+			 min, max, cmap, o.eight_bit);
+     ret = 0;
+     goto done;
+
+nomem:
+     fprintf(stderr, "h5topng: out of memory\n");
+done:
+     free(fname);
+     free(cmap.rgba);
+     free(overlay_cmap.rgba);
+     free(overlay);
+     free(mask);
+     free(data);
+     return ret;
+}
+
+int h5topng_write(const char *filename, const double *data,
+		  int rank, const int *dims, const ptrdiff_t *strides,
+		  const h5topng_options *o)
+{
+     return write_image(filename, data, NULL, rank, dims, strides, o);
+}
+
+int h5topng_write_float(const char *filename, const float *data,
+			int rank, const int *dims, const ptrdiff_t *strides,
+			const h5topng_options *o)
+{
+     return write_image(filename, NULL, data, rank, dims, strides, o);
+}
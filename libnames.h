@@ -0,0 +1,80 @@
+/* Copyright (c) 1999-2023 Massachusetts Institute of Technology
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef LIBNAMES_H
+#define LIBNAMES_H
+
+/* The internal functions and variables of libh5topng (see h5topng.h),
+   renamed with an h5topng_ prefix so that they cannot clash with those
+   of the programs (e.g. simulations) that link it.  The headers that
+   declare them include this, so the rest of the code uses the short
+   names. */
+
+#define builtin_colormaps h5topng_builtin_colormaps
+#define cmap_lookup h5topng_cmap_lookup
+#define colormap_kernels_all h5topng_colormap_kernels_all
+#define colormap_range h5topng_colormap_range
+#define colormap_row_overlay h5topng_colormap_row_overlay
+#define destroy_lut h5topng_destroy_lut
+#define find_builtin_cmap h5topng_find_builtin_cmap
+#define float_range h5topng_float_range
+#define get_colormap h5topng_get_colormap
+#define get_colormap_kernels h5topng_get_colormap_kernels
+#define init_lut h5topng_init_lut
+#define pngzip_band h5topng_pngzip_band
+#define pngzip_bound h5topng_pngzip_bound
+#define pngzip_defaults h5topng_pngzip_defaults
+#define pngzip_destroy h5topng_pngzip_destroy
+#define pngzip_header h5topng_pngzip_header
+#define pngzip_init h5topng_pngzip_init
+#define pngzip_parse h5topng_pngzip_parse
+#define qoi_begin h5topng_qoi_begin
+#define qoi_encode h5topng_qoi_encode
+#define qoi_end h5topng_qoi_end
+#define qsketch_add h5topng_qsketch_add
+#define qsketch_add_centroids h5topng_qsketch_add_centroids
+#define qsketch_compress h5topng_qsketch_compress
+#define qsketch_destroy h5topng_qsketch_destroy
+#define qsketch_init h5topng_qsketch_init
+#define qsketch_merge h5topng_qsketch_merge
+#define qsketch_quantile h5topng_qsketch_quantile
+#define range_scale h5topng_range_scale
+#define writepng h5topng_writepng
+#define writepng_anim_begin h5topng_writepng_anim_begin
+#define writepng_anim_end h5topng_writepng_anim_end
+#define writepng_autorange h5topng_writepng_autorange
+#define writepng_cache_layers h5topng_writepng_cache_layers
+#define writepng_failures h5topng_writepng_failures
+#define writepng_float h5topng_writepng_float
+#define writepng_get_nthreads h5topng_writepng_get_nthreads
+#define writepng_image_size h5topng_writepng_image_size
+#define writepng_montage_begin h5topng_writepng_montage_begin
+#define writepng_montage_end h5topng_writepng_montage_end
+#define writepng_set_compression h5topng_writepng_set_compression
+#define writepng_set_contour_levels h5topng_writepng_set_contour_levels
+#define writepng_set_format h5topng_writepng_set_format
+#define writepng_set_nthreads h5topng_writepng_set_nthreads
+#define writepng_set_stdout h5topng_writepng_set_stdout
+#define writepng_set_tile_size h5topng_writepng_set_tile_size
+#define writepng_stream h5topng_writepng_stream
+
+#endif /* LIBNAMES_H */
@@ -0,0 +1,280 @@
+/* Copyright (c) 1999-2023 Massachusetts Institute of Technology
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "config.h"
+#include "pngzip.h"
+
+/* libpng's defaults: adaptive filtering (except for palette images),
+   and the Z_FILTERED strategy for filtered data */
+const pngzip_settings pngzip_defaults = {
+     0, Z_DEFAULT_COMPRESSION, PNGZIP_FILTER_ADAPTIVE, Z_FILTERED
+};
+
+typedef struct {
+     const char *name;
+     pngzip_settings s;
+} pngzip_preset;
+
+/* The presets were chosen by timing a smooth 2000x2000 field (typical of
+   h5topng images): the sub filter at low zlib levels is several times
+   faster than libpng's defaults (adaptive filtering at level 6), and at
+   level 9 it gives the smallest files. */
+static const pngzip_preset presets[] = {
+     { "fastest", { 1, 1, PNGZIP_FILTER_SUB, Z_DEFAULT_STRATEGY } },
+     { "fast", { 1, 3, PNGZIP_FILTER_SUB, Z_FILTERED } },
+     { "small", { 1, 6, PNGZIP_FILTER_ADAPTIVE, Z_FILTERED } },
+     { "smallest", { 1, 9, PNGZIP_FILTER_SUB, Z_DEFAULT_STRATEGY } },
+     { NULL, { 0, 0, 0, 0 } }
+};
+
+static const char *filter_names[] = {
+     "none", "sub", "up", "avg", "paeth", "adaptive", NULL
+};
+
+static const struct { const char *name; int strategy; } strategies[] = {
+     { "filtered", Z_FILTERED },
+     { "huffman", Z_HUFFMAN_ONLY },
+     { "rle", Z_RLE },
+     { "fixed", Z_FIXED },
+     { NULL, 0 }
+};
+
+int pngzip_parse(pngzip_settings *s, const char *spec)
+{
+     char *buf, *item;
+     int i, err = 0;
+
+     buf = (char *) malloc(strlen(spec) + 1);
+     if (!buf)
+	  return 1;
+     strcpy(buf, spec);
+     for (item = strtok(buf, ","); item && !err; item = strtok(NULL, ",")) {
+	  if (!strcmp(item, "default")) {
+	       *s = pngzip_defaults;
+	       continue;
+	  }
+	  if (item[0] >= '0' && item[0] <= '9' && !item[1]) {
+	       s->level = item[0] - '0';
+	       s->banded = 1;
+	       continue;
+	  }
+	  for (i = 0; presets[i].name && strcmp(item, presets[i].name); ++i)
+	       ;
+	  if (presets[i].name) {
+	       *s = presets[i].s;
+	       continue;
+	  }
+	  for (i = 0; filter_names[i] && strcmp(item, filter_names[i]); ++i)
+	       ;
+	  if (filter_names[i]) {
+	       s->filter = i;
+	       s->banded = 1;
+	       continue;
+	  }
+	  for (i = 0; strategies[i].name && strcmp(item, strategies[i].name);
+	       ++i)
+	       ;
+	  if (strategies[i].name) {
+	       s->strategy = strategies[i].strategy;
+	       s->banded = 1;
+	       continue;
+	  }
+	  err = 1;
+     }
+     free(buf);
+     return err;
+}
+
+void pngzip_header(const pngzip_settings *s, unsigned char *out)
+{
+     /* 32k window, and the FLEVEL hint from the compression level */
+     int level = s->level < 0 ? 6 : s->level;
+     int flevel = level < 2 ? 0 : (level < 6 ? 1 : (level == 6 ? 2 : 3));
+     int cmf = 0x78, flg = flevel << 6;
+     flg += 31 - (cmf * 256 + flg) % 31;
+     out[0] = cmf;
+     out[1] = flg;
+}
+
+int pngzip_init(pngzip_stream *zs, const pngzip_settings *s,
+		int rowbytes, int bpp, int palette)
+{
+     memset(zs, 0, sizeof(pngzip_stream));
+     zs->filter = s->filter;
+     /* like libpng, and as the PNG spec recommends, don't filter
+	palette images unless a filter is requested explicitly */
+     if (palette && zs->filter == PNGZIP_FILTER_ADAPTIVE)
+	  zs->filter = PNGZIP_FILTER_NONE;
+     zs->bpp = bpp;
+     zs->rowbytes = rowbytes;
+     zs->filtered = (unsigned char *)
+	  calloc((zs->filter == PNGZIP_FILTER_ADAPTIVE ? 6 : 2),
+		 rowbytes + 1);
+     if (!zs->filtered)
+	  return 1;
+     /* raw deflate data (no zlib header/checksum), since we
+	concatenate the bands ourselves */
+     if (deflateInit2(&zs->z, s->level, Z_DEFLATED, -15, 8, s->strategy)
+	 != Z_OK) {
+	  free(zs->filtered);
+	  zs->filtered = NULL;
+	  return 1;
+     }
+     return 0;
+}
+
+void pngzip_destroy(pngzip_stream *zs)
+{
+     if (zs->filtered)
+	  deflateEnd(&zs->z);
+     free(zs->filtered);
+     zs->filtered = NULL;
+}
+
+size_t pngzip_bound(int rowbytes, int nrows)
+{
+     /* zlib's conservative deflateBound, plus the sync flush */
+     size_t n = (rowbytes + (size_t) 1) * nrows;
+     return n + ((n + 7) >> 3) + ((n + 63) >> 6) + 5 + 16;
+}
+
+static int paeth(int a, int b, int c)
+{
+     int pa = abs(b - c), pb = abs(a - c), pc = abs(a + b - 2*c);
+     if (pa <= pb && pa <= pc)
+	  return a;
+     return pb <= pc ? b : c;
+}
+
+/* apply filter type f to row, given the previous row prev, writing the
+   filter type byte followed by the filtered row to out */
+static void filter_row(int f, const unsigned char *row,
+		       const unsigned char *prev, int n, int bpp,
+		       unsigned char *out)
+{
+     int i;
+     *out++ = f;
+     switch (f) {
+	 case PNGZIP_FILTER_NONE:
+	      memcpy(out, row, n);
+	      break;
+	 case PNGZIP_FILTER_SUB:
+	      for (i = 0; i < bpp; ++i)
+		   out[i] = row[i];
+	      for (; i < n; ++i)
+		   out[i] = row[i] - row[i - bpp];
+	      break;
+	 case PNGZIP_FILTER_UP:
+	      for (i = 0; i < n; ++i)
+		   out[i] = row[i] - prev[i];
+	      break;
+	 case PNGZIP_FILTER_AVG:
+	      for (i = 0; i < bpp; ++i)
+		   out[i] = row[i] - (prev[i] >> 1);
+	      for (; i < n; ++i)
+		   out[i] = row[i] - ((row[i - bpp] + prev[i]) >> 1);
+	      break;
+	 case PNGZIP_FILTER_PAETH:
+	      for (i = 0; i < bpp; ++i)
+		   out[i] = row[i] - prev[i];
+	      for (; i < n; ++i)
+		   out[i] = row[i] - paeth(row[i - bpp], prev[i],
+					   prev[i - bpp]);
+	      break;
+     }
+}
+
+/* sum of the absolute values of the filtered bytes, as signed bytes
+   (stopping once it exceeds limit) */
+static unsigned long filter_cost(const unsigned char *f, int n,
+				 unsigned long limit)
+{
+     int i;
+     unsigned long sum = 0;
+     for (i = 0; i < n && sum <= limit; ++i)
+	  sum += f[i] < 128 ? f[i] : 256 - f[i];
+     return sum;
+}
+
+/* filter row, returning the filter type byte + filtered row (n+1 bytes) */
+static unsigned char *filter(pngzip_stream *zs, const unsigned char *row,
+			     const unsigned char *prev)
+{
+     int n = zs->rowbytes, f, best = 0;
+     unsigned long cost, best_cost = 0;
+     unsigned char *out = zs->filtered + (n + 1);
+
+     if (!prev) /* the row above the image is all zero */
+	  prev = zs->filtered;
+
+     if (zs->filter != PNGZIP_FILTER_ADAPTIVE) {
+	  filter_row(zs->filter, row, prev, n, zs->bpp, out);
+	  return out;
+     }
+     for (f = PNGZIP_FILTER_NONE; f <= PNGZIP_FILTER_PAETH; ++f) {
+	  filter_row(f, row, prev, n, zs->bpp, out + f * (n + 1));
+	  cost = filter_cost(out + f * (n + 1) + 1, n,
+			     f == PNGZIP_FILTER_NONE ? ULONG_MAX : best_cost);
+	  if (f == PNGZIP_FILTER_NONE || cost < best_cost) {
+	       best = f;
+	       best_cost = cost;
+	  }
+     }
+     return out + best * (n + 1);
+}
+
+long pngzip_band(pngzip_stream *zs,
+		 const unsigned char *rows, int nrows,
+		 const unsigned char *prev, int last,
+		 unsigned char *out, uLong *adler)
+{
+     int k;
+     size_t n = zs->rowbytes;
+     uLong a = adler32(0L, Z_NULL, 0);
+
+     if (deflateReset(&zs->z) != Z_OK)
+	  return -1;
+     zs->z.next_out = out;
+     zs->z.avail_out = pngzip_bound(zs->rowbytes, nrows);
+     for (k = 0; k < nrows; ++k) {
+	  const unsigned char *row = rows + k * n;
+	  unsigned char *f = filter(zs, row, k ? row - n : prev);
+	  int flush = k < nrows - 1 ? Z_NO_FLUSH
+	       : (last ? Z_FINISH : Z_SYNC_FLUSH);
+	  int ret;
+
+	  a = adler32(a, f, n + 1);
+	  zs->z.next_in = f;
+	  zs->z.avail_in = n + 1;
+	  ret = deflate(&zs->z, flush);
+	  if (ret == Z_STREAM_ERROR || zs->z.avail_in
+	      || (flush == Z_FINISH && ret != Z_STREAM_END))
+	       return -1;
+     }
+     *adler = a;
+     return zs->z.total_out;
+}
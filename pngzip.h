@@ -0,0 +1,102 @@
+/* Copyright (c) 1999-2023 Massachusetts Institute of Technology
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PNGZIP_H
+#define PNGZIP_H
+
+#include <stddef.h>
+#include <zlib.h>
+
+#include "libnames.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/***********************************************************************/
+
+/* PNG image data is a single zlib stream of the filtered rows.  To
+   compress it in parallel, we split the image into bands of rows, and
+   compress each band independently as raw deflate data ending with a
+   sync flush (so that it ends on a byte boundary), which can simply be
+   concatenated between a zlib header and the combined adler32 checksum
+   of the bands. */
+
+/* PNG row filter types, plus per-row adaptive selection (by the
+   minimum sum of absolute differences heuristic, as in libpng) */
+#define PNGZIP_FILTER_NONE 0
+#define PNGZIP_FILTER_SUB 1
+#define PNGZIP_FILTER_UP 2
+#define PNGZIP_FILTER_AVG 3
+#define PNGZIP_FILTER_PAETH 4
+#define PNGZIP_FILTER_ADAPTIVE 5
+
+typedef struct {
+     int banded; /* 0 to use libpng's own (serial) compression */
+     int level; /* zlib compression level, 0-9 */
+     int filter; /* PNGZIP_FILTER_xxx */
+     int strategy; /* zlib strategy, e.g. Z_FILTERED */
+} pngzip_settings;
+
+/* the default settings: libpng's compression, unchanged */
+extern const pngzip_settings pngzip_defaults;
+
+/* Parse a comma-separated list of presets (fastest, fast, default, small,
+   smallest), levels (0-9), filters (none, sub, up, avg, paeth, adaptive)
+   and strategies (filtered, huffman, rle, fixed) into s, each item
+   overriding the preceding ones.  Returns nonzero for an invalid spec. */
+extern int pngzip_parse(pngzip_settings *s, const char *spec);
+
+/* the zlib header of the compressed data (2 bytes) */
+extern void pngzip_header(const pngzip_settings *s, unsigned char *out);
+
+/* per-thread compression state */
+typedef struct {
+     z_stream z;
+     int filter, bpp, rowbytes;
+     unsigned char *filtered; /* filtered rows, one per filter type */
+} pngzip_stream;
+
+extern int pngzip_init(pngzip_stream *zs, const pngzip_settings *s,
+		       int rowbytes, int bpp, int palette);
+extern void pngzip_destroy(pngzip_stream *zs);
+
+/* upper bound on the compressed size of nrows rows */
+extern size_t pngzip_bound(int rowbytes, int nrows);
+
+/* Filter and compress the nrows rows (each zs->rowbytes long) at rows,
+   where prev is the row preceding them in the image (NULL for the first
+   row), into out (pngzip_bound bytes), finishing the stream if last.
+   Returns the compressed size, and the adler32 checksum of the filtered
+   data in *adler, or -1 on error. */
+extern long pngzip_band(pngzip_stream *zs,
+			const unsigned char *rows, int nrows,
+			const unsigned char *prev, int last,
+			unsigned char *out, uLong *adler);
+
+/***********************************************************************/
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif /* __cplusplus */
+
+#endif /* PNGZIP_H */
@@ -0,0 +1,217 @@
+/* Copyright (c) 1999-2023 Massachusetts Institute of Technology
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "config.h"
+#include "project.h"
+
+#if defined(HAVE_PTHREAD_H) && defined(HAVE_LIBPTHREAD)
+#  include <pthread.h>
+#  define USE_THREADS 1
+#endif
+
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+
+/* don't bother with threads for fewer outputs per thread than this */
+#define MIN_PER_THREAD 16384
+
+int project_op(const char *name)
+{
+     static const char *names[] = { "max", "min", "mean", "maxabs" };
+     int i;
+     for (i = 0; i < 4; ++i)
+	  if (!strcmp(name, names[i]))
+	       return i;
+     return -1;
+}
+
+int project_init(projection *p, int op, size_t before, size_t after)
+{
+     p->op = op;
+     p->before = before;
+     p->after = after;
+     p->n = 0;
+     p->pending = NULL;
+     p->result = (double *) malloc(sizeof(double) * before * after);
+     return !p->result;
+}
+
+void project_destroy(projection *p)
+{
+     project_wait(p);
+     free(p->result);
+     p->result = NULL;
+}
+
+/* the reduction of the outputs o0..o1-1 (indices into p->result) of a
+   slab with k elements along the axis */
+typedef struct {
+     const projection *p;
+     const double *slab;
+     size_t k, o0, o1;
+     int first; /* the first slab, which initializes the result */
+} reduce_job;
+
+static void *reduce(void *job_)
+{
+     const reduce_job *job = (const reduce_job *) job_;
+     const projection *p = job->p;
+     size_t P = p->after, k = job->k, a, b, j;
+
+     for (a = job->o0 / P; a * P < job->o1; ++a) {
+	  size_t b0 = a * P < job->o0 ? job->o0 - a * P : 0;
+	  size_t b1 = MIN(P, job->o1 - a * P);
+	  double *out = p->result + a * P;
+	  const double *in = job->slab + a * k * P;
+
+	  j = 0;
+	  if (job->first) {
+	       for (b = b0; b < b1; ++b)
+		    out[b] = p->op == PROJECT_MAXABS ? fabs(in[b]) : in[b];
+	       j = 1;
+	       in += P;
+	  }
+	  for (; j < k; ++j, in += P)
+	       switch (p->op) {
+		   case PROJECT_MAX:
+			for (b = b0; b < b1; ++b)
+			     if (in[b] > out[b])
+				  out[b] = in[b];
+			break;
+		   case PROJECT_MIN:
+			for (b = b0; b < b1; ++b)
+			     if (in[b] < out[b])
+				  out[b] = in[b];
+			break;
+		   case PROJECT_MEAN: /* (divided by n in project_result) */
+			for (b = b0; b < b1; ++b)
+			     out[b] += in[b];
+			break;
+		   case PROJECT_MAXABS:
+			for (b = b0; b < b1; ++b)
+			     if (fabs(in[b]) > out[b])
+				  out[b] = fabs(in[b]);
+			break;
+	       }
+     }
+     return NULL;
+}
+
+#ifdef USE_THREADS
+typedef struct {
+     int nstarted;
+     pthread_t *threads;
+     reduce_job *jobs;
+} pending_jobs;
+#endif
+
+void project_add(projection *p, const double *slab, size_t k, int nthreads)
+{
+     size_t nout = p->before * p->after;
+     reduce_job job;
+
+     project_wait(p);
+     if (k == 0)
+	  return;
+     job.p = p;
+     job.slab = slab;
+     job.k = k;
+     job.o0 = 0;
+     job.o1 = nout;
+     job.first = p->n == 0;
+     p->n += k;
+
+     if (nout / MIN_PER_THREAD < (size_t) nthreads)
+	  nthreads = (int) (nout / MIN_PER_THREAD);
+#ifdef USE_THREADS
+     if (nthreads > 1) {
+	  pending_jobs *pj = (pending_jobs *) malloc(sizeof(pending_jobs));
+	  int i;
+
+	  if (pj) {
+	       pj->threads = (pthread_t *) malloc(nthreads * sizeof(pthread_t));
+	       pj->jobs = (reduce_job *) malloc(nthreads * sizeof(reduce_job));
+	  }
+	  if (!pj || !pj->threads || !pj->jobs) {
+	       if (pj) {
+		    free(pj->threads);
+		    free(pj->jobs);
+		    free(pj);
+	       }
+	       reduce(&job);
+	       return;
+	  }
+	  pj->nstarted = 0;
+	  for (i = 0; i < nthreads; ++i) {
+	       pj->jobs[i] = job;
+	       pj->jobs[i].o0 = nout * i / nthreads;
+	       pj->jobs[i].o1 = nout * (i + 1) / nthreads;
+	  }
+	  for (i = 0; i < nthreads; ++i)
+	       if (pthread_create(&pj->threads[pj->nstarted], NULL, reduce,
+				  &pj->jobs[i]))
+		    reduce(&pj->jobs[i]); /* couldn't start a thread */
+	       else
+		    ++pj->nstarted;
+	  p->pending = pj;
+	  return;
+     }
+#endif
+     reduce(&job);
+}
+
+void project_wait(projection *p)
+{
+#ifdef USE_THREADS
+     pending_jobs *pj = (pending_jobs *) p->pending;
+     int i;
+
+     if (!pj)
+	  return;
+     for (i = 0; i < pj->nstarted; ++i)
+	  pthread_join(pj->threads[i], NULL);
+     free(pj->threads);
+     free(pj->jobs);
+     free(pj);
+     p->pending = NULL;
+#else
+     (void) p;
+#endif
+}
+
+double *project_result(projection *p)
+{
+     double *result;
+
+     project_wait(p);
+     result = p->result;
+     p->result = NULL;
+     if (result && p->op == PROJECT_MEAN && p->n > 0) {
+	  size_t i, nout = p->before * p->after;
+	  for (i = 0; i < nout; ++i)
+	       result[i] /= p->n;
+     }
+     return result;
+}
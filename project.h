@@ -0,0 +1,80 @@
+/* Copyright (c) 1999-2023 Massachusetts Institute of Technology
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef PROJECT_H
+#define PROJECT_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/***********************************************************************/
+
+/* Projections of an array along one of its dimensions (the "axis"),
+   e.g. the maximum over z of a 3d array, computed as a running
+   reduction of slabs of the array (of any number of elements along the
+   axis) that are added one after another, so that the whole array need
+   never be in memory. */
+
+#define PROJECT_MAX 0
+#define PROJECT_MIN 1
+#define PROJECT_MEAN 2
+#define PROJECT_MAXABS 3 /* the maximum absolute value */
+
+/* the projection named name ("max", "min", "mean" or "maxabs"), or -1 */
+extern int project_op(const char *name);
+
+typedef struct {
+     int op;
+     size_t before, after; /* size of the dimensions before/after the axis */
+     size_t n; /* number of elements along the axis added so far */
+     double *result; /* before x after */
+     void *pending; /* the threads reducing the last slab, if any */
+} projection;
+
+/* returns nonzero if out of memory */
+extern int project_init(projection *p, int op, size_t before, size_t after);
+extern void project_destroy(projection *p);
+
+/* Add the slab of the array with the next k elements along the axis
+   (before x k x after, in row-major order), reduced with nthreads
+   threads.  With more than one thread, this can return before the slab
+   is reduced, which is useful to read the next slab in the meantime:
+   the slab must then be left as is until project_wait is called. */
+extern void project_add(projection *p, const double *slab, size_t k,
+			int nthreads);
+extern void project_wait(projection *p);
+
+/* the projection of the slabs added, which is the caller's to free
+   (and is no longer part of p) */
+extern double *project_result(projection *p);
+
+/***********************************************************************/
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif /* __cplusplus */
+
+#endif /* PROJECT_H */
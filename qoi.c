@@ -0,0 +1,151 @@
+/* Copyright (c) 1999-2023 Massachusetts Institute of Technology
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "config.h"
+#include "qoi.h"
+
+#define QOI_OP_INDEX 0x00 /* 00xxxxxx */
+#define QOI_OP_DIFF 0x40 /* 01xxxxxx */
+#define QOI_OP_LUMA 0x80 /* 10xxxxxx */
+#define QOI_OP_RUN 0xc0 /* 11xxxxxx */
+#define QOI_OP_RGB 0xfe /* 11111110 */
+
+#define QOI_MAX_RUN 62
+#define QOI_HASH(r,g,b) (((r) * 3 + (g) * 5 + (b) * 7 + 255 * 11) % 64)
+
+static int flush_buf(qoi_encoder *q)
+{
+     size_t n = q->n;
+     q->n = 0;
+     return fwrite(q->buf, 1, n, q->fp) != n;
+}
+
+static void put32(unsigned char *out, unsigned long x)
+{
+     out[0] = (x >> 24) & 0xff;
+     out[1] = (x >> 16) & 0xff;
+     out[2] = (x >> 8) & 0xff;
+     out[3] = x & 0xff;
+}
+
+int qoi_begin(qoi_encoder *q, FILE *fp, int width, int height)
+{
+     q->fp = fp;
+     memset(q->index, 0, sizeof(q->index));
+     memset(q->px, 0, sizeof(q->px)); /* black */
+     q->run = 0;
+     memcpy(q->buf, "qoif", 4);
+     put32(q->buf + 4, (unsigned long) width);
+     put32(q->buf + 8, (unsigned long) height);
+     q->buf[12] = 3; /* RGB */
+     q->buf[13] = 0; /* sRGB with linear alpha */
+     q->n = 14;
+     return 0;
+}
+
+int qoi_encode(qoi_encoder *q, const unsigned char *pixels, size_t npix)
+{
+     unsigned char *out = q->buf + q->n;
+     /* (a pixel can end a run and be written in full: 5 bytes) */
+     unsigned char *end = q->buf + QOI_BUFSIZE - 5;
+     unsigned char pr = q->px[0], pg = q->px[1], pb = q->px[2];
+     int run = q->run;
+     size_t i;
+
+     for (i = 0; i < npix; ++i, pixels += 3) {
+	  unsigned char r = pixels[0], g = pixels[1], b = pixels[2];
+	  unsigned char *ix;
+
+	  if (out >= end) {
+	       q->n = out - q->buf;
+	       if (flush_buf(q))
+		    return 1;
+	       out = q->buf;
+	  }
+	  if (r == pr && g == pg && b == pb) {
+	       if (++run == QOI_MAX_RUN) {
+		    *out++ = QOI_OP_RUN | (run - 1);
+		    run = 0;
+	       }
+	       continue;
+	  }
+	  if (run) {
+	       *out++ = QOI_OP_RUN | (run - 1);
+	       run = 0;
+	  }
+	  ix = q->index[QOI_HASH(r, g, b)];
+	  if (ix[0] == r && ix[1] == g && ix[2] == b && ix[3])
+	       *out++ = QOI_OP_INDEX | QOI_HASH(r, g, b);
+	  else {
+	       /* differences from the previous pixel, wrapping around */
+	       signed char vr = (signed char) (r - pr);
+	       signed char vg = (signed char) (g - pg);
+	       signed char vb = (signed char) (b - pb);
+	       signed char vg_r = (signed char) (vr - vg);
+	       signed char vg_b = (signed char) (vb - vg);
+
+	       ix[0] = r;
+	       ix[1] = g;
+	       ix[2] = b;
+	       ix[3] = 255;
+	       if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2)
+		    *out++ = QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2
+			 | (vb + 2);
+	       else if (vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32
+			&& vg_b > -9 && vg_b < 8) {
+		    *out++ = QOI_OP_LUMA | (vg + 32);
+		    *out++ = (vg_r + 8) << 4 | (vg_b + 8);
+	       }
+	       else {
+		    *out++ = QOI_OP_RGB;
+		    *out++ = r;
+		    *out++ = g;
+		    *out++ = b;
+	       }
+	  }
+	  pr = r;
+	  pg = g;
+	  pb = b;
+     }
+     q->px[0] = pr;
+     q->px[1] = pg;
+     q->px[2] = pb;
+     q->run = run;
+     q->n = out - q->buf;
+     return 0;
+}
+
+int qoi_end(qoi_encoder *q)
+{
+     static const unsigned char padding[8] = {0,0,0,0,0,0,0,1};
+
+     if (q->run)
+	  q->buf[q->n++] = QOI_OP_RUN | (q->run - 1);
+     q->run = 0;
+     if (q->n + sizeof(padding) > QOI_BUFSIZE && flush_buf(q))
+	  return 1;
+     memcpy(q->buf + q->n, padding, sizeof(padding));
+     q->n += sizeof(padding);
+     return flush_buf(q);
+}
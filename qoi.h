@@ -0,0 +1,73 @@
+/* Copyright (c) 1999-2023 Massachusetts Institute of Technology
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef QOI_H
+#define QOI_H
+
+#include <stdio.h>
+
+#include "libnames.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/***********************************************************************/
+
+/* An encoder for the QOI ("Quite OK Image") format of D. Szablewski
+   (https://qoiformat.org/), a simple lossless format that is much
+   faster to write than a deflate-compressed PNG.  Pixels are encoded in
+   a single pass, as runs of the previous pixel, references to a small
+   hash table of recent pixels, or small differences from the previous
+   pixel, so the image can be encoded a few rows at a time as they are
+   rendered.  Only 8-bit RGB (3 channels, no alpha) is supported. */
+
+#define QOI_BUFSIZE 65536
+
+typedef struct {
+     FILE *fp;
+     unsigned char index[64][4]; /* recent pixels, by hash, as r,g,b,a
+				    (where a = 0 for an unused entry) */
+     unsigned char px[3]; /* the previous pixel */
+     int run; /* the number of repeats of px not yet written */
+     size_t n; /* the number of bytes in buf */
+     unsigned char buf[QOI_BUFSIZE];
+} qoi_encoder;
+
+/* Start writing a width x height image to fp; returns nonzero on
+   failure (as do the others). */
+extern int qoi_begin(qoi_encoder *q, FILE *fp, int width, int height);
+
+/* encode the next npix pixels (3 bytes each, in row-major order) */
+extern int qoi_encode(qoi_encoder *q, const unsigned char *pixels,
+		      size_t npix);
+
+/* finish the image, after all of its pixels have been encoded */
+extern int qoi_end(qoi_encoder *q);
+
+/***********************************************************************/
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif /* __cplusplus */
+
+#endif /* QOI_H */
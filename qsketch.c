@@ -0,0 +1,396 @@
+/* Copyright (c) 1999-2023 Massachusetts Institute of Technology
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "qsketch.h"
+
+/* The compression parameter (delta) of the t-digest: the sketch has at
+   most about delta centroids, and its quantile estimates have a rank
+   error of order q(1-q)/delta.  Values (and merged centroids) are
+   buffered, and merged into the centroids in sorted batches. */
+#define DELTA 500
+#define NBUF 8192
+
+#define NBINS 4096
+#define MIN_BINNED (4 * NBINS)
+
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+
+#define K_PI 3.14159265358979323846
+
+/* the t-digest "k1" scale function, which limits a centroid to span at
+   most one unit of k(q), where q is the fraction of the data below it */
+static double k_scale(double q)
+{
+     return DELTA / (2 * K_PI) * asin(2 * q - 1);
+}
+
+static double k_inverse(double k)
+{
+     if (k >= DELTA / 4.0)
+	  return 1.0;
+     return (sin(k * (2 * K_PI) / DELTA) + 1) / 2;
+}
+
+void qsketch_init(qsketch *q)
+{
+     memset(q, 0, sizeof(qsketch));
+}
+
+void qsketch_destroy(qsketch *q)
+{
+     free(q->c);
+     free(q->vals);
+     free(q->buf);
+     memset(q, 0, sizeof(qsketch));
+}
+
+static int cmp_centroid(const void *a_, const void *b_)
+{
+     const qsketch_centroid *a = (const qsketch_centroid *) a_;
+     const qsketch_centroid *b = (const qsketch_centroid *) b_;
+     if (a->mean != b->mean)
+	  return a->mean < b->mean ? -1 : 1;
+     return a->weight < b->weight ? -1 : (a->weight > b->weight);
+}
+
+/* Sort the n values x (not NaN), using key (2n integers) as scratch
+   space.  Since this is most of the work of adding values to the
+   sketch, we use a radix sort on the IEEE bit patterns, mapped to
+   unsigned integers in the same order, skipping the bytes that are the
+   same for every value (e.g. the exponent bytes, for data of a similar
+   magnitude). */
+static void sort_values(double *x, uint64_t *key, int n)
+{
+     const uint64_t sign = (uint64_t) 1 << 63;
+     uint64_t *key2 = key + n, *swap;
+     size_t count[8][256];
+     int i, b;
+
+     if (n == 0)
+	  return;
+     memset(count, 0, sizeof(count));
+     for (i = 0; i < n; ++i) {
+	  uint64_t k;
+	  memcpy(&k, x + i, sizeof(uint64_t));
+	  key[i] = k = (k & sign) ? ~k : k ^ sign;
+	  for (b = 0; b < 8; ++b)
+	       ++count[b][(k >> (8 * b)) & 0xff];
+     }
+     for (b = 0; b < 8; ++b) {
+	  size_t sum = 0, c;
+	  if (count[b][(key[0] >> (8 * b)) & 0xff] == (size_t) n)
+	       continue; /* all the same */
+	  for (i = 0; i < 256; ++i) {
+	       c = count[b][i];
+	       count[b][i] = sum;
+	       sum += c;
+	  }
+	  for (i = 0; i < n; ++i)
+	       key2[count[b][(key[i] >> (8 * b)) & 0xff]++] = key[i];
+	  swap = key; key = key2; key2 = swap;
+     }
+     for (i = 0; i < n; ++i) {
+	  uint64_t k = (key[i] & sign) ? key[i] ^ sign : ~key[i];
+	  memcpy(x + i, &k, sizeof(uint64_t));
+     }
+}
+
+/* merge the sorted centroids a and b (or, if b is NULL, the sorted
+   values vb with weight 1) into out */
+static void merge_sorted(const qsketch_centroid *a, int na,
+			 const qsketch_centroid *b, const double *vb, int nb,
+			 qsketch_centroid *out)
+{
+     int i = 0, j = 0;
+     while (i < na || j < nb) {
+	  double mb = j < nb ? (b ? b[j].mean : vb[j]) : 0;
+	  if (j == nb || (i < na && a[i].mean <= mb))
+	       *out++ = a[i++];
+	  else {
+	       out->mean = mb;
+	       out->weight = b ? b[j].weight : 1;
+	       ++out;
+	       ++j;
+	  }
+     }
+}
+
+int qsketch_compress(qsketch *q)
+{
+     qsketch_centroid *all, *tmp, cur;
+     uint64_t *key;
+     double wsofar = 0, wlimit;
+     int i, m = 0, n = q->n + q->nvals + q->nbuf;
+
+     if (q->nvals == 0 && q->nbuf == 0)
+	  return 0;
+     all = (qsketch_centroid *) malloc(n * sizeof(qsketch_centroid));
+     tmp = (qsketch_centroid *) malloc(n * sizeof(qsketch_centroid));
+     key = (uint64_t *) malloc(2 * q->nvals * sizeof(uint64_t) + 1);
+     if (!all || !tmp || !key) {
+	  free(all);
+	  free(tmp);
+	  free(key);
+	  return 1;
+     }
+
+     /* all of the centroids and values, in sorted order */
+     sort_values(q->vals, key, q->nvals);
+     free(key);
+     if (q->nbuf) {
+	  qsort(q->buf, q->nbuf, sizeof(qsketch_centroid), cmp_centroid);
+	  merge_sorted(q->c, q->n, NULL, q->vals, q->nvals, tmp);
+	  merge_sorted(tmp, q->n + q->nvals, q->buf, NULL, q->nbuf, all);
+     }
+     else
+	  merge_sorted(q->c, q->n, NULL, q->vals, q->nvals, all);
+     free(tmp);
+     q->nvals = q->nbuf = 0;
+
+     /* greedily merge neighboring centroids (in place), as long as the
+	merged centroid stays within the size limit; wlimit is the limit
+	on the cumulative weight through the current centroid cur */
+     cur = all[0];
+     wlimit = k_inverse(k_scale(0) + 1) * q->total;
+     for (i = 1; i < n; ++i) {
+	  if (wsofar + cur.weight + all[i].weight <= wlimit) {
+	       cur.weight += all[i].weight;
+	       if (all[i].mean != cur.mean)
+		    cur.mean += (all[i].mean - cur.mean)
+			 * (all[i].weight / cur.weight);
+	  }
+	  else {
+	       wsofar += cur.weight;
+	       all[m++] = cur;
+	       wlimit = k_inverse(k_scale(wsofar / q->total) + 1) * q->total;
+	       cur = all[i];
+	  }
+     }
+     all[m++] = cur;
+
+     free(q->c);
+     q->c = (qsketch_centroid *) realloc(all, m * sizeof(qsketch_centroid));
+     if (!q->c)
+	  q->c = all;
+     q->n = m;
+     return 0;
+}
+
+/* buffer the centroid (mean, weight), returning nonzero if out of memory */
+static int add_centroid(qsketch *q, double mean, double weight)
+{
+     if (!q->buf) {
+	  q->buf = (qsketch_centroid *) malloc(NBUF * sizeof(qsketch_centroid));
+	  if (!q->buf)
+	       return 1;
+     }
+     q->buf[q->nbuf].mean = mean;
+     q->buf[q->nbuf].weight = weight;
+     q->total += weight;
+     return ++q->nbuf == NBUF && qsketch_compress(q);
+}
+
+/* buffer the n values x (not NaN), returning nonzero if out of memory */
+static int add_values(qsketch *q, const double *x, size_t n)
+{
+     size_t i;
+     if (!q->vals) {
+	  q->vals = (double *) malloc(NBUF * sizeof(double));
+	  if (!q->vals)
+	       return 1;
+     }
+     for (i = 0; i < n; ++i) {
+	  q->vals[q->nvals] = x[i];
+	  q->total += 1;
+	  if (++q->nvals == NBUF && qsketch_compress(q))
+	       return 1;
+     }
+     return 0;
+}
+
+/* Add the n values x (not NaN), whose ranks in the data being added
+   start at t0 out of ntot.  Sorting the values (in add_values) is
+   relatively slow, so instead we first count them in a histogram of
+   NBINS bins spanning their range, each of which becomes a centroid;
+   only the bins with too many values for a centroid at that position
+   in the distribution (e.g. with outliers far from the rest of the
+   data, which all fall into a few bins) are added recursively. */
+static int add_binned(qsketch *q, const double *x, size_t n,
+		      double t0, double ntot)
+{
+     size_t i, t, nheavy = 0, *count, *pos;
+     double min, max, scale, *sum, *heavy = NULL;
+     int b, err = 0;
+
+     if (n == 0)
+	  return 0;
+     min = max = x[0];
+     for (i = 1; i < n; ++i) {
+	  if (x[i] < min)
+	       min = x[i];
+	  if (x[i] > max)
+	       max = x[i];
+     }
+     if (q->total == 0 || min < q->min)
+	  q->min = min;
+     if (q->total == 0 || max > q->max)
+	  q->max = max;
+     if (n < MIN_BINNED || min == max || !(max - min < HUGE_VAL))
+	  return add_values(q, x, n);
+
+     count = (size_t *) calloc(NBINS, sizeof(size_t));
+     pos = (size_t *) malloc(NBINS * sizeof(size_t));
+     sum = (double *) calloc(NBINS, sizeof(double));
+     if (!count || !pos || !sum) {
+	  err = 1;
+	  goto done;
+     }
+     scale = NBINS / (max - min);
+#define BIN(x) MIN((int) (((x) - min) * scale), NBINS - 1)
+     for (i = 0; i < n; ++i) {
+	  b = BIN(x[i]);
+	  ++count[b];
+	  sum[b] += x[i];
+     }
+
+     /* add the bins as centroids, or mark them as heavy by setting pos
+	to the start of their values in the heavy array */
+     for (b = 0, t = 0; b < NBINS; t += count[b++]) {
+	  pos[b] = (size_t) -1;
+	  if (count[b] > 1
+	      && k_scale(MIN(1, (t0 + t + count[b]) / ntot))
+	      - k_scale((t0 + t) / ntot) > 1) {
+	       pos[b] = nheavy;
+	       nheavy += count[b];
+	  }
+	  else if (count[b] && (err = add_centroid(q, sum[b] / count[b],
+						   count[b])))
+	       goto done;
+     }
+
+     if (nheavy) {
+	  heavy = (double *) malloc(nheavy * sizeof(double));
+	  if (!heavy) {
+	       err = 1;
+	       goto done;
+	  }
+	  for (i = 0; i < n; ++i) {
+	       b = BIN(x[i]);
+	       if (pos[b] != (size_t) -1)
+		    heavy[pos[b]++] = x[i];
+	  }
+	  for (b = 0, t = 0; b < NBINS && !err; t += count[b++])
+	       if (pos[b] != (size_t) -1)
+		    err = add_binned(q, heavy + pos[b] - count[b], count[b],
+				     t0 + t, ntot);
+     }
+#undef BIN
+
+done:
+     free(heavy);
+     free(sum);
+     free(pos);
+     free(count);
+     return err;
+}
+
+int qsketch_add(qsketch *q, const double *x, size_t n)
+{
+     size_t i, m = 0;
+     double *y;
+     int err;
+
+     for (i = 0; i < n && x[i] == x[i]; ++i)
+	  ;
+     if (i == n) /* no NaNs */
+	  return add_binned(q, x, n, 0, n);
+     y = (double *) malloc(n * sizeof(double));
+     if (!y)
+	  return 1;
+     for (i = 0; i < n; ++i)
+	  if (x[i] == x[i])
+	       y[m++] = x[i];
+     err = add_binned(q, y, m, 0, m);
+     free(y);
+     return err;
+}
+
+int qsketch_add_centroids(qsketch *q, const qsketch_centroid *c, int n,
+			  double min, double max)
+{
+     int i;
+     if (n == 0)
+	  return 0;
+     if (q->total == 0 || min < q->min)
+	  q->min = min;
+     if (q->total == 0 || max > q->max)
+	  q->max = max;
+     for (i = 0; i < n; ++i)
+	  if (add_centroid(q, c[i].mean, c[i].weight))
+	       return 1;
+     return 0;
+}
+
+int qsketch_merge(qsketch *q, qsketch *r)
+{
+     return qsketch_compress(r)
+	  || qsketch_add_centroids(q, r->c, r->n, r->min, r->max);
+}
+
+double qsketch_quantile(qsketch *q, double p)
+{
+     double target, wsofar = 0, t0 = 0, x0, t1, x1;
+     int i;
+
+     if (qsketch_compress(q) || q->n == 0)
+	  return 0;
+     target = (p < 0 ? 0 : (p > 1 ? 1 : p)) * q->total;
+
+     /* interpolate linearly between the centroid means, placed at the
+	middle of their weights, and the min and max at the ends */
+     x0 = q->min;
+     for (i = 0; i <= q->n; ++i) {
+	  if (i < q->n) {
+	       t1 = wsofar + q->c[i].weight / 2;
+	       x1 = q->c[i].mean;
+	  }
+	  else {
+	       t1 = q->total;
+	       x1 = q->max;
+	  }
+	  if (target <= t1) {
+	       double f = t1 > t0 ? (target - t0) / (t1 - t0) : 1;
+	       return x0 * (1 - f) + x1 * f;
+	  }
+	  if (i < q->n)
+	       wsofar += q->c[i].weight;
+	  t0 = t1;
+	  x0 = x1;
+     }
+     return q->max;
+}
@@ -0,0 +1,85 @@
+/* Copyright (c) 1999-2023 Massachusetts Institute of Technology
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef QSKETCH_H
+#define QSKETCH_H
+
+#include <stddef.h>
+
+#include "libnames.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/***********************************************************************/
+
+/* A quantile sketch (a "merging t-digest", after T. Dunning): a
+   streaming summary of a data set, as a small sorted list of weighted
+   centroids, from which its percentiles can be estimated.  Centroids
+   are smallest near the ends of the distribution, so extreme
+   percentiles (e.g. 0.5% and 99.5%) are the most accurate.  Sketches
+   of different data (e.g. of several frames, computed in different
+   processes) can be merged into a sketch of all of the data. */
+
+typedef struct {
+     double mean, weight;
+} qsketch_centroid;
+
+typedef struct {
+     int n, nalloc; /* number of centroids, and allocated size */
+     qsketch_centroid *c; /* sorted by mean */
+     int nvals, nbuf; /* values and centroids added, but not yet merged */
+     double *vals;
+     qsketch_centroid *buf;
+     double total, min, max; /* total weight, and range of the data */
+} qsketch;
+
+extern void qsketch_init(qsketch *q);
+extern void qsketch_destroy(qsketch *q);
+
+/* add the n values in x (ignoring NaNs); returns nonzero if out of memory */
+extern int qsketch_add(qsketch *q, const double *x, size_t n);
+
+/* merge the sketch r (compressing it first) into q; returns nonzero if
+   out of memory */
+extern int qsketch_merge(qsketch *q, qsketch *r);
+
+/* add centroids (e.g. those of another sketch) to q, which spans the
+   range [min,max] of their data; returns nonzero if out of memory */
+extern int qsketch_add_centroids(qsketch *q, const qsketch_centroid *c,
+				 int n, double min, double max);
+
+/* merge any buffered values into the centroids; q->c then summarizes
+   all of the data.  Returns nonzero if out of memory. */
+extern int qsketch_compress(qsketch *q);
+
+/* the p-th quantile (0 <= p <= 1) of the data, or 0 if there is none */
+extern double qsketch_quantile(qsketch *q, double p);
+
+/***********************************************************************/
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif /* __cplusplus */
+
+#endif /* QSKETCH_H */
@@ -0,0 +1,97 @@
+/* Copyright (c) 1999-2023 Massachusetts Institute of Technology
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "config.h"
+#include "rangefile.h"
+
+/* The format is
+       h5utils-range 1
+       min <min>
+       max <max>
+       centroids <n> <min> <max>
+   followed by n lines of "<mean> <weight>" for the centroids of the
+   sketch and the range of its data (which excludes NaNs), where all of
+   the numbers are written with enough digits to be read back exactly. */
+
+#define RANGEFILE_VERSION 1
+
+int rangefile_write(const char *fname, double min, double max, qsketch *q)
+{
+     FILE *f;
+     int i, err;
+
+     if (q && qsketch_compress(q))
+	  return 1;
+     f = fopen(fname, "w");
+     if (!f)
+	  return 1;
+     fprintf(f, "h5utils-range %d\nmin %.17g\nmax %.17g\n",
+	     RANGEFILE_VERSION, min, max);
+     if (q) {
+	  fprintf(f, "centroids %d %.17g %.17g\n", q->n, q->min, q->max);
+	  for (i = 0; i < q->n; ++i)
+	       fprintf(f, "%.17g %.17g\n", q->c[i].mean, q->c[i].weight);
+     }
+     else
+	  fprintf(f, "centroids 0 0 0\n");
+     err = ferror(f);
+     return fclose(f) || err;
+}
+
+int rangefile_read(const char *fname, int *nread,
+		   double *min, double *max, qsketch *q)
+{
+     FILE *f;
+     int version, n, i, err = 1;
+     double fmin, fmax, qmin, qmax;
+     qsketch_centroid *c = NULL;
+
+     f = fopen(fname, "r");
+     if (!f)
+	  return 1;
+     if (fscanf(f, "h5utils-range %d min %lf max %lf centroids %d %lf %lf",
+		&version, &fmin, &fmax, &n, &qmin, &qmax) != 6
+	 || version != RANGEFILE_VERSION || n < 0)
+	  goto done;
+     c = (qsketch_centroid *) malloc((n + 1) * sizeof(qsketch_centroid));
+     if (!c)
+	  goto done;
+     for (i = 0; i < n; ++i)
+	  if (fscanf(f, "%lf %lf", &c[i].mean, &c[i].weight) != 2
+	      || !(c[i].weight > 0))
+	       goto done;
+     if (q && qsketch_add_centroids(q, c, n, qmin, qmax))
+	  goto done;
+     if (!*nread || fmin < *min)
+	  *min = fmin;
+     if (!*nread || fmax > *max)
+	  *max = fmax;
+     ++*nread;
+     err = 0;
+done:
+     free(c);
+     fclose(f);
+     return err;
+}
@@ -0,0 +1,57 @@
+/* Copyright (c) 1999-2023 Massachusetts Institute of Technology
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef RANGEFILE_H
+#define RANGEFILE_H
+
+#include "qsketch.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/***********************************************************************/
+
+/* A range file stores the range of some data, along with a quantile
+   sketch of it for percentile ranges, in a small text file.  This lets
+   the range pass over a data set be done once and shared between runs
+   (e.g. batch jobs that each render part of a movie), and the range
+   files of different parts of the data can simply be merged. */
+
+/* write the range [min,max] and the sketch q (if not NULL) to fname;
+   returns nonzero on error */
+extern int rangefile_write(const char *fname, double min, double max,
+			   qsketch *q);
+
+/* read the range file fname, merging its range into [*min,*max] (which
+   are just set if *nread is 0) and incrementing *nread, and merging its
+   sketch into q (if not NULL); returns nonzero on error */
+extern int rangefile_read(const char *fname, int *nread,
+			  double *min, double *max, qsketch *q);
+
+/***********************************************************************/
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif /* __cplusplus */
+
+#endif /* RANGEFILE_H */
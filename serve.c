@@ -0,0 +1,291 @@
+/* Copyright (c) 1999-2023 Massachusetts Institute of Technology
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "config.h"
+#include "serve.h"
+
+#if defined(HAVE_SYS_SOCKET_H) && defined(HAVE_NETINET_IN_H) \
+    && defined(HAVE_UNISTD_H)
+#  include <sys/types.h>
+#  include <sys/stat.h>
+#  include <sys/socket.h>
+#  include <sys/time.h>
+#  include <time.h>
+#  include <netinet/in.h>
+#  include <unistd.h>
+#  include <signal.h>
+#  include <errno.h>
+#  ifdef HAVE_SYS_UN_H
+#    include <sys/un.h>
+#  endif
+#  define USE_SOCKETS 1
+#endif
+
+/* the longest request (line and headers) that we accept */
+#define MAX_REQUEST 8192
+
+/* a client that has not sent its whole request after this long is
+   dropped, since it would otherwise keep everyone else waiting */
+#define REQUEST_TIMEOUT 10 /* seconds */
+
+static int hexval(int c)
+{
+     return isdigit(c) ? c - '0' : tolower(c) - 'a' + 10;
+}
+
+int serve_param(const char *query, const char *name, char *val, size_t n)
+{
+     size_t len = strlen(name);
+
+     while (*query) {
+	  if (!strncmp(query, name, len) && query[len] == '=') {
+	       size_t i = 0;
+	       for (query += len + 1; *query && *query != '&'; ++query)
+		    if (i + 1 < n) {
+			 if (*query == '+')
+			      val[i++] = ' ';
+			 else if (*query == '%' && isxdigit(query[1])
+				  && isxdigit(query[2])) {
+			      val[i++] = hexval(query[1]) * 16
+				   + hexval(query[2]);
+			      query += 2;
+			 }
+			 else
+			      val[i++] = *query;
+		    }
+	       if (n > 0)
+		    val[i] = 0;
+	       return 1;
+	  }
+	  query = strchr(query, '&');
+	  if (!query)
+	       break;
+	  ++query;
+     }
+     return 0;
+}
+
+#ifdef USE_SOCKETS
+
+int serve_listen(const char *addr)
+{
+     int fd, one = 1;
+     const char *s;
+
+     for (s = addr; isdigit(*s); ++s)
+	  ;
+     if (strchr(addr, ':')) {
+	  fprintf(stderr, "invalid address \"%s\": give just a port number "
+		  "(we only listen on localhost) or a socket path\n", addr);
+	  return -1;
+     }
+     if (!*s && s > addr) { /* a TCP port, on the loopback interface */
+	  struct sockaddr_in sa;
+	  memset(&sa, 0, sizeof(sa));
+	  sa.sin_family = AF_INET;
+	  sa.sin_port = htons(atoi(addr));
+	  sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	  fd = socket(AF_INET, SOCK_STREAM, 0);
+	  if (fd < 0)
+	       return -1;
+	  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	  if (bind(fd, (struct sockaddr *) &sa, sizeof(sa)))
+	       goto fail;
+     }
+     else {
+#ifdef HAVE_SYS_UN_H
+	  struct sockaddr_un sa;
+	  struct stat st;
+	  memset(&sa, 0, sizeof(sa));
+	  sa.sun_family = AF_UNIX;
+	  if (strlen(addr) >= sizeof(sa.sun_path)) {
+	       fprintf(stderr, "socket path \"%s\" is too long\n", addr);
+	       return -1;
+	  }
+	  strcpy(sa.sun_path, addr);
+	  /* replace a stale socket, but never any other kind of file */
+	  if (!lstat(addr, &st)) {
+	       if (!S_ISSOCK(st.st_mode)) {
+		    fprintf(stderr, "\"%s\" exists and is not a socket\n",
+			    addr);
+		    return -1;
+	       }
+	       unlink(addr);
+	  }
+	  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	  if (fd < 0)
+	       return -1;
+	  if (bind(fd, (struct sockaddr *) &sa, sizeof(sa)))
+	       goto fail;
+#else
+	  fprintf(stderr, "Unix-domain sockets are not supported\n");
+	  return -1;
+#endif
+     }
+     if (listen(fd, 16))
+	  goto fail;
+     return fd;
+
+fail:
+     perror("Error listening");
+     close(fd);
+     return -1;
+}
+
+static int write_all(int fd, const char *buf, size_t n)
+{
+     while (n > 0) {
+	  ssize_t k = write(fd, buf, n);
+	  if (k < 0 && errno == EINTR)
+	       continue;
+	  if (k <= 0)
+	       return 1;
+	  buf += k;
+	  n -= k;
+     }
+     return 0;
+}
+
+/* read the request line and headers (which we ignore) from fd into buf,
+   returning nonzero if the client hangs up, sends too much, or takes
+   longer than REQUEST_TIMEOUT in all (not just for each read) */
+static int read_request(int fd, char *buf)
+{
+     size_t n = 0;
+     time_t deadline = time(NULL) + REQUEST_TIMEOUT;
+
+     while (!strstr(buf, "\r\n\r\n") && !strstr(buf, "\n\n")) {
+	  ssize_t k;
+	  struct timeval tv;
+	  time_t now = time(NULL);
+	  if (n + 1 >= MAX_REQUEST || now >= deadline)
+	       return 1;
+	  tv.tv_sec = deadline - now;
+	  tv.tv_usec = 0;
+	  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	  k = read(fd, buf + n, MAX_REQUEST - 1 - n);
+	  if (k < 0 && errno == EINTR)
+	       continue;
+	  if (k <= 0)
+	       return 1;
+	  n += k;
+	  buf[n] = 0;
+     }
+     return 0;
+}
+
+static const char *status_text(int status)
+{
+     switch (status) {
+	 case 200: return "OK";
+	 case 400: return "Bad Request";
+	 case 404: return "Not Found";
+	 case 405: return "Method Not Allowed";
+	 default: return "Internal Server Error";
+     }
+}
+
+/* answer the request on the connection fd */
+static void answer(int fd, serve_handler handler, void *ctx)
+{
+     char buf[MAX_REQUEST], head[256], *path, *query, *end;
+     const char *content_type = "text/plain";
+     FILE *out;
+     long len;
+     int status;
+
+     buf[0] = 0;
+     if (read_request(fd, buf))
+	  return;
+     if (!(out = tmpfile()))
+	  return;
+
+     /* the request line: GET <path>[?<query>] HTTP/<version> */
+     path = buf + 4;
+     if (strncmp(buf, "GET ", 4) || !(end = strchr(path, ' '))) {
+	  status = 405;
+	  fprintf(out, "only GET requests are supported\n");
+     }
+     else {
+	  *end = 0;
+	  if ((query = strchr(path, '?')))
+	       *query++ = 0;
+	  else
+	       query = end;
+	  status = handler(ctx, path, query, out, &content_type);
+     }
+
+     fflush(out);
+     len = ftell(out);
+     rewind(out);
+     sprintf(head, "HTTP/1.0 %d %s\r\nContent-Type: %s\r\n"
+	     "Content-Length: %ld\r\nConnection: close\r\n\r\n",
+	     status, status_text(status), content_type, len);
+     if (!write_all(fd, head, strlen(head)))
+	  while (len > 0) {
+	       size_t k = fread(buf, 1, sizeof(buf), out);
+	       if (k == 0 || write_all(fd, buf, k))
+		    break;
+	       len -= k;
+	  }
+     fclose(out);
+}
+
+int serve_run(int fd, serve_handler handler, void *ctx)
+{
+     /* a client hanging up mid-response is not our problem */
+     signal(SIGPIPE, SIG_IGN);
+
+     for (;;) {
+	  int cfd = accept(fd, NULL, NULL);
+	  if (cfd < 0) {
+	       if (errno == EINTR || errno == ECONNABORTED)
+		    continue;
+	       perror("Error accepting connection");
+	       return 1;
+	  }
+	  answer(cfd, handler, ctx);
+	  close(cfd);
+     }
+}
+
+#else /* !USE_SOCKETS */
+
+int serve_listen(const char *addr)
+{
+     (void) addr;
+     fprintf(stderr, "sockets are not supported on this system\n");
+     return -1;
+}
+
+int serve_run(int fd, serve_handler handler, void *ctx)
+{
+     (void) fd; (void) handler; (void) ctx;
+     return 1;
+}
+
+#endif /* !USE_SOCKETS */
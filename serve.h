@@ -0,0 +1,68 @@
+/* Copyright (c) 1999-2023 Massachusetts Institute of Technology
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef SERVE_H
+#define SERVE_H
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/***********************************************************************/
+
+/* A minimal HTTP/1.0 server, for h5topng --serve: it only answers GET
+   requests, one connection at a time, and only listens locally, so
+   that it can be used from a browser or with curl, e.g.
+   curl 'http://localhost:8080/slice?z=10' > foo.png */
+
+/* Listen on addr: a TCP port on the loopback interface ("8080"), or
+   otherwise the path of a Unix-domain socket (replacing an old socket
+   there, but failing if it is any other kind of file).  An address with
+   a host ("host:port") is rejected.  Returns the listening socket, or
+   -1 on failure. */
+extern int serve_listen(const char *addr);
+
+/* Answer a GET request for path (e.g. "/slice") with the given query
+   string (the part of the URL after '?', or ""), writing the body of
+   the response to out and returning the HTTP status code (e.g. 200),
+   along with the *content_type of the body. */
+typedef int (*serve_handler)(void *ctx, const char *path, const char *query,
+			     FILE *out, const char **content_type);
+
+/* Answer the requests on the socket fd from serve_listen, forever, or
+   until there is an error accepting a connection (returning nonzero). */
+extern int serve_run(int fd, serve_handler handler, void *ctx);
+
+/* If the query string has the parameter name, copy its (URL-decoded)
+   value into val, of size n, and return 1; otherwise return 0. */
+extern int serve_param(const char *query, const char *name,
+		       char *val, size_t n);
+
+/***********************************************************************/
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif /* __cplusplus */
+
+#endif /* SERVE_H */
@@ -27,150 +27,29 @@
 
 #include <png.h>
 
+#include "config.h"
 #include "writepng.h"
+#include "colormap.h"
+#include "pngzip.h"
+#include "qoi.h"
+
+#if defined(HAVE_PTHREAD_H) && defined(HAVE_LIBPTHREAD)
+#  include <pthread.h>
+#  define USE_THREADS 1
+#endif
+#ifdef HAVE_UNISTD_H
+#  include <unistd.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+#  include <sys/types.h>
+#  include <sys/stat.h>
+#endif
 
 #define MAX(a,b) ((a) > (b) ? (a) : (b))
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
 
 #define PIN(min, x, max) MIN(MAX(min, x), max)
 
-/* convert a value val in [0,1] to a color from the colormap */
-static void cmap_lookup(REAL val, colormap_t cmap,
-			float *r, float *g, float *b, float *a)
-{
-     double w;
-     int i = val * (cmap.n - 1);
-     if (i > cmap.n - 2) i = cmap.n - 2;
-     if (i < 0) i = 0;
-     w = val * (cmap.n - 1) - i;
-     *r = cmap.rgba[i].r * (1 - w) + cmap.rgba[i+1].r * w;
-     *g = cmap.rgba[i].g * (1 - w) + cmap.rgba[i+1].g * w;
-     *b = cmap.rgba[i].b * (1 - w) + cmap.rgba[i+1].b * w;
-     *a = cmap.rgba[i].a * (1 - w) + cmap.rgba[i+1].a * w;
-}
-
-static void convert_row(int png_width, int data_width,
-			REAL scaley, REAL offsety,
-			REAL *datarow, REAL *datarow2, REAL weightrow,
-			int stride, REAL *maskrow, REAL *maskrow2,
-			REAL mask_thresh, REAL *mask_prev, int init_mask_prev,
-			png_byte mask_byte,
-			int mny, int mstride,
-			int overlay, REAL *olayrow, REAL *olayrow2,
-			colormap_t olay_cmap, REAL olaymin, REAL olaymax,
-			int ony, int ostride,
-			colormap_t cmap,
-			REAL minrange, REAL maxrange, REAL scale,
-			png_byte * row_pointer, int eight_bit)
-{
-     int i;
-
-     for (i = 0; i < png_width; ++i) {
-	  REAL y = i * scaley + offsety;
-	  int n = PIN(0, (int) (y + 0.5), data_width-1);
-	  double delta = y - n;
-	  REAL val, maskval = 0.0, olayval = olaymin;
-
-	  if (n < 0 || n > data_width) {
-	       if (eight_bit)
-		    row_pointer[i] = 255;
-	       else
-		    row_pointer[3*i]
-			 = row_pointer[3*i + 1]
-			 = row_pointer[3*i + 2] = mask_byte;
-	       continue;
-	  }
-
-	  if (delta == 0.0) {
-	       val = (datarow[n * stride] * weightrow +
-		      datarow2[n * stride] * (1 - weightrow));
-	       if (maskrow != NULL) {
-		    maskval = (maskrow[(n%mny) * mstride] * weightrow +
-			       maskrow2[(n%mny) * mstride] * (1 - weightrow));
-	       }
-	       if (overlay)
-		    olayval = (olayrow[(n%ony) * ostride] * weightrow +
-			       olayrow2[(n%ony) * ostride] * (1 - weightrow));
-	  }
-	  else {
-	       int n2 = PIN(0, n + (delta < 0.0 ? -1 : 1), data_width-1);
-	       REAL absdelta = fabs(delta);
-	       val =
-		    (datarow[n * stride] * (1 - absdelta) +
-		     datarow[n2 * stride] * absdelta) * weightrow +
-		    (datarow2[n * stride] * (1 - absdelta) +
-		     datarow2[n2 * stride] * absdelta) *
-		    (1 - weightrow);
-	       if (overlay)
-		    olayval =
-			 (olayrow[(n%ony) * ostride] * (1 - absdelta) +
-			  olayrow[(n2%ony) * ostride] * absdelta) * weightrow +
-			 (olayrow2[(n%ony) * ostride] * (1 - absdelta) +
-			  olayrow2[(n2%ony) * ostride] * absdelta) *
-		    (1 - weightrow);
-	       if (maskrow != NULL) {
-		    maskval =
-			 (maskrow[(n%mny) * mstride] * (1 - absdelta) +
-			  maskrow[(n2%mny) * mstride] * absdelta) * weightrow +
-			 (maskrow2[(n%mny) * mstride] * (1 - absdelta) +
-			  maskrow2[(n2%mny) * mstride] * absdelta) *
-			 (1 - weightrow);
-	       }
-	  }
-
-	  if (maskrow != NULL) {
-	       REAL maskmin, maskmax;
-	       if (init_mask_prev)
-		    maskmin = maskmax = maskval;
-	       else {
-		    maskmin = MIN(MIN(maskval, i ? mask_prev[i-1] : maskval),
-				  mask_prev[i]);
-		    maskmax = MAX(MAX(maskval, i ? mask_prev[i-1] : maskval),
-				  mask_prev[i]);
-	       }
-	       mask_prev[i] = maskval;
-	       if (maskmin <= mask_thresh && maskmax >= mask_thresh) {
-		    if (eight_bit)
-			 row_pointer[i] = 255;
-		    else
-			 row_pointer[3*i]
-			      = row_pointer[3*i + 1]
-			      = row_pointer[3*i + 2] = mask_byte;
-		    continue;
-	       }
-	  }
-
-	  if (val > maxrange)
-	       val = maxrange;
-	  else if (val < minrange)
-	       val = minrange;
-
-	  if (eight_bit)
-	       row_pointer[i] = (val - minrange) * scale;
-	  else if (overlay) {
-	       float r, g, b, a, ro, go, bo, ao;
-	       cmap_lookup((val - minrange) / (maxrange - minrange),
-			   cmap, &r, &g, &b, &a);
-	       cmap_lookup((olayval - olaymin) / (olaymax - olaymin),
-			   olay_cmap, &ro, &go, &bo, &ao);
-	       r = r * (1 - ao) + ro * ao;
-	       g = g * (1 - ao) + go * ao;
-	       b = b * (1 - ao) + bo * ao;
-	       row_pointer[3*i    ] = r * 255 + 0.5;
-	       row_pointer[3*i + 1] = g * 255 + 0.5;
-	       row_pointer[3*i + 2] = b * 255 + 0.5;
-	  }
-	  else {
-	       float r, g, b, a;
-	       cmap_lookup((val - minrange) / (maxrange - minrange),
-			   cmap, &r, &g, &b, &a);
-	       row_pointer[3*i    ] = r * 255 + 0.5;
-	       row_pointer[3*i + 1] = g * 255 + 0.5;
-	       row_pointer[3*i + 2] = b * 255 + 0.5;
-	  }
-     }
-}
-
 static void init_palette(png_colorp palette, colormap_t colormap,
 			 png_byte mask_byte)
 {
@@ -222,232 +101,2477 @@ static void init_alpha(png_structp png_ptr, png_infop info_ptr,
 }
 #endif
 
-void writepng(char *filename,
-	      int nx, int ny, int transpose,
-	      REAL skew, REAL scalex, REAL scaley,
-	      REAL * data,
-	      REAL *mask, REAL mask_thresh,
-	      int mnx, int mny,
-	      REAL *overlay, colormap_t overlay_cmap,
-	      int onx, int ony,
-	      REAL minrange, REAL maxrange,
-	      colormap_t colormap, int eight_bit)
-{
-     FILE *fp;
-     png_structp png_ptr;
-     png_infop info_ptr;
-     int height, width;
-     double skewsin = sin(skew), skewcos = cos(skew);
-     REAL minoverlay = 0, maxoverlay = 0;
+/***********************************************************************/
+/* Rendering pipeline.  Rows are rendered in bands by a pool of worker
+   threads into a ring of band buffers, while the calling thread hands
+   finished bands to libpng (which, along with zlib, is serial) in order.
+   The only dependency between rows is the contour mask_prev state, which
+   at the top of each band is recomputed from the preceding row (a
+   one-row "halo"), so the output is identical to rendering serially.
+   Unless libpng's default compression is requested, the workers also
+   filter and compress their bands (see pngzip.h), and the calling thread
+   just writes the compressed bands as IDAT chunks. */
+
+typedef struct tile_pyramid_s tile_pyramid; /* see write_dzi */
+
+/* contour and overlay layers rendered for an earlier image, which are
+   reused while they stay the same (see writepng_cache_layers) */
+typedef struct {
+     int valid;
+     /* the layers and the image geometry they were rendered for: */
+     const REAL *mask, *overlay;
+     REAL mask_thresh;
+     int mnx, mny, onx, ony;
+     int width, height, transpose, data_width, data_height;
+     REAL scalex, scaley;
+     double skewsin;
+     unsigned char *contour; /* height x width: nonzero on the contours
+				(the 1-based level, with several levels) */
+     REAL *overlayvals; /* height x width interpolated overlay values */
+} layer_cache;
+
+/* for writepng_stream: reads the rows of the data (etc.) as needed */
+typedef struct {
+     writepng_read_rows read_rows;
+     void *ctx;
+     int max_rows;
+} row_source;
+
+typedef struct {
+     ptrdiff_t *off, *off2; /* n*stride and n2*stride for each column */
+     REAL *w; /* weight of column n2 (0 if n2 is not used) */
+} col_table;
+
+typedef struct {
+     int width, height, transpose;
+     REAL scalex, scaley;
+     double skewsin;
+     REAL *data;
+     const float *fdata; /* if not NULL, the data (in single precision) */
+     int data_width, data_height;
+     REAL *mask, mask_thresh;
+     int mnx, mny;
+     /* if levels is not NULL, the mask is instead contoured at each of
+	the nlevels (sorted) levels, in the colors level_rgb */
+     int nlevels;
+     const REAL *levels;
+     const png_byte *level_rgb;
+     REAL *overlay;
+     int onx, ony;
+     cmap_lut lut, overlay_lut;
+     const colormap_kernels *kernels;
+     REAL minrange, maxrange, scale;
      png_byte mask_byte;
+     int eight_bit, bpp, rowbytes; /* bpp: bytes per pixel */
+     const pngzip_settings *zip; /* NULL to let libpng compress the rows */
+     png_byte *image; /* if not NULL, the rows are stored here instead */
+     FILE *raw; /* if not NULL, the rows are written here uncompressed */
+     qoi_encoder *qoi; /* if not NULL, the rows are encoded with this */
+     const png_byte *src; /* if not NULL, rows already rendered, to copy */
+     tile_pyramid *tiles; /* if not NULL, the rows are added to this */
+     const layer_cache *layers; /* if not NULL, the layers to draw */
 
-     /* we must use direct color for translucent overlays */
-     if (overlay)
-	  eight_bit = 0;
+     /* With writepng_stream, only data (and mask and overlay) rows row0
+	and up are in memory, read by render_rows as they are needed;
+	otherwise source is NULL and row0 is 0.  (For a montage, src
+	likewise only holds the rows from the top row0 up.) */
+     const row_source *source;
+     int row0;
 
-     /* compute png size from scaled (and possibly transposed) data size,
-      * and reverse the meaning of the scale factors; now they are what we
-      * multiply png coordinates by to get data coordinates: */
+     /* The data, mask and overlay columns to interpolate for each pixel
+	in a row, computed once per image (unless the image is skewed, in
+	which case they change from row to row). */
+     col_table cols, mask_cols, overlay_cols;
 
-     if (transpose) {
-	  height = MAX(1, ny * scalex * skewcos);
-	  width = MAX(1, nx * scaley * (1.0 + fabs(skewsin)));
-	  scalex = height==1 ? 0 : (1.0 * (ny-1)) / (height-1);
-	  scaley = width==1 ? 0 : ((1.0 + fabs(skewsin)) * (nx-1)) / (width-1);
-     } else {
-	  height = MAX(1, nx * scalex * skewcos);
-	  width = MAX(1, ny * scaley * (1.0 + fabs(skewsin)));
-	  scalex = height==1 ? 0 : (1.0 * (nx-1)) / (height-1);
-	  scaley = width==1 ? 0 : ((1.0 + fabs(skewsin)) * (ny-1)) / (width-1);
+     /* no mask, overlay, skew, or rescaling: each pixel is just the
+	colormapped data value */
+     int unit;
+
+     /* if nonzero, the (transposed) data rows needed for each band are
+	first copied into a tile with this many rows (see render_rows) */
+     int tile_rows;
+} render_params;
+
+/* the stride between the columns of transposed data */
+#define DATA_STRIDE(p) ((p)->tile_rows ? (p)->tile_rows : (p)->data_height)
+
+/* per-thread scratch space for rendering rows */
+typedef struct {
+     void *tile; /* if p->tile_rows: data rows tile_n0.. of this band,
+		    as REAL or (if p->fdata) float */
+     int tile_n0;
+     REAL *vals, *maskvals, *overlayvals;
+     REAL *mask_prev; /* contour state: mask values of the previous row */
+     col_table cols, mask_cols, overlay_cols; /* for skewed images */
+} render_scratch;
+
+static int alloc_col_table(col_table *t, int width)
+{
+     t->off = (ptrdiff_t *) malloc(width * sizeof(ptrdiff_t));
+     t->off2 = (ptrdiff_t *) malloc(width * sizeof(ptrdiff_t));
+     t->w = (REAL *) malloc(width * sizeof(REAL));
+     return !t->off || !t->off2 || !t->w;
+}
+
+static void destroy_col_table(col_table *t)
+{
+     free(t->off);
+     free(t->off2);
+     free(t->w);
+     t->off = t->off2 = NULL;
+     t->w = NULL;
+}
+
+/* Compute the columns to interpolate, for pixel column i at data
+   coordinate i*scaley + offsety, in the data (t), mask (mt) and overlay
+   (ot) rows.  The mask and overlay are periodic with periods mp and op
+   and column strides ms and os, respectively. */
+static void init_col_tables(const render_params *p, REAL offsety,
+			    col_table *t, col_table *mt, col_table *ot)
+{
+     int i, stride = p->transpose ? DATA_STRIDE(p) : 1;
+     int mp = p->transpose ? p->mnx : p->mny, ms = p->transpose ? p->mny : 1;
+     int op = p->transpose ? p->onx : p->ony, os = p->transpose ? p->ony : 1;
+
+     for (i = 0; i < p->width; ++i) {
+	  REAL y = i * p->scaley + offsety;
+	  int n = PIN(0, (int) (y + 0.5), p->data_width-1);
+	  double delta = y - n;
+	  int n2 = PIN(0, n + (delta < 0.0 ? -1 : 1), p->data_width-1);
+	  REAL w = fabs(delta);
+
+	  t->off[i] = n * (ptrdiff_t) stride;
+	  t->off2[i] = n2 * (ptrdiff_t) stride;
+	  t->w[i] = w;
+	  if (p->mask) {
+	       mt->off[i] = (n % mp) * (ptrdiff_t) ms;
+	       mt->off2[i] = (n2 % mp) * (ptrdiff_t) ms;
+	       mt->w[i] = w;
+	  }
+	  if (p->overlay) {
+	       ot->off[i] = (n % op) * (ptrdiff_t) os;
+	       ot->off2[i] = (n2 % op) * (ptrdiff_t) os;
+	       ot->w[i] = w;
+	  }
      }
+}
 
-     if (overlay) {
-	  int i;
-	  minoverlay = maxoverlay = overlay[0];
-	  for (i = 1; i < onx * ony; ++i) {
-	       if (minoverlay > overlay[i])
-		    minoverlay = overlay[i];
-	       if (maxoverlay < overlay[i])
-		    maxoverlay = overlay[i];
+/* allocate the column tables in t, mt, ot (as needed for p) */
+static int alloc_col_tables(const render_params *p,
+			    col_table *t, col_table *mt, col_table *ot)
+{
+     memset(t, 0, sizeof(col_table));
+     memset(mt, 0, sizeof(col_table));
+     memset(ot, 0, sizeof(col_table));
+     return alloc_col_table(t, p->width)
+	  || (p->mask && alloc_col_table(mt, p->width))
+	  || (p->overlay && alloc_col_table(ot, p->width));
+}
+
+static void destroy_col_tables(col_table *t, col_table *mt, col_table *ot)
+{
+     destroy_col_table(t);
+     destroy_col_table(mt);
+     destroy_col_table(ot);
+}
+
+static int alloc_scratch(const render_params *p, render_scratch *sc)
+{
+     int err;
+     memset(sc, 0, sizeof(render_scratch));
+     sc->vals = (REAL *) malloc(p->width * sizeof(REAL));
+     err = !sc->vals;
+     if (p->tile_rows) {
+	  sc->tile = malloc(p->tile_rows * (size_t) p->data_width
+			    * (p->fdata ? sizeof(float) : sizeof(REAL)));
+	  err = err || !sc->tile;
+     }
+     if (p->mask) {
+	  sc->maskvals = (REAL *) malloc(p->width * sizeof(REAL));
+	  sc->mask_prev = (REAL *) malloc(p->width * sizeof(REAL));
+	  err = err || !sc->maskvals || !sc->mask_prev;
+     }
+     if (p->overlay) {
+	  sc->overlayvals = (REAL *) malloc(p->width * sizeof(REAL));
+	  err = err || !sc->overlayvals;
+     }
+     if (p->skewsin != 0.0)
+	  err = err || alloc_col_tables(p, &sc->cols, &sc->mask_cols,
+					&sc->overlay_cols);
+     return err;
+}
+
+static void destroy_scratch(render_scratch *sc)
+{
+     free(sc->tile);
+     free(sc->vals);
+     free(sc->maskvals);
+     free(sc->mask_prev);
+     free(sc->overlayvals);
+     destroy_col_tables(&sc->cols, &sc->mask_cols, &sc->overlay_cols);
+}
+
+/* Row kernels.  A row is rendered by first sampling (interpolating)
+   the data, mask and overlay at each pixel into arrays of values, and
+   then colormapping the values and drawing the contours.  These are
+   specialized for the common cases, e.g. without rescaling no
+   interpolation is needed.  (The colormapping kernels, which have SIMD
+   variants chosen according to the CPU, are in colormap.c.) */
+
+/* interpolate vals[i] from row (weight wr) and row2 (weight 1-wr),
+   at the columns given by t */
+static void sample_row(REAL *vals, int width, const col_table *t,
+		       const REAL *row, const REAL *row2, REAL wr)
+{
+     int i;
+     for (i = 0; i < width; ++i) {
+	  ptrdiff_t n = t->off[i];
+	  REAL w = t->w[i];
+	  if (w == 0.0)
+	       vals[i] = row[n] * wr + row2[n] * (1 - wr);
+	  else {
+	       ptrdiff_t n2 = t->off2[i];
+	       vals[i] = (row[n] * (1 - w) + row[n2] * w) * wr +
+		    (row2[n] * (1 - w) + row2[n2] * w) * (1 - wr);
 	  }
      }
+}
 
-     /* determine mask color by middle of colormap (FIXME: use
-	median color of the data or some such thing instead?) */
-     {
-	  float r,g,b,a;
-	  cmap_lookup(0.5, colormap, &r, &g, &b, &a);
-	  if ((r + g + b) / 3.0 > 0.5)
-	       mask_byte = 0; /* black */
-	  else
-	       mask_byte = 255; /* white */
+/* vals[i] = row[i*stride], for unscaled data */
+static void gather_row(REAL *vals, int width, const REAL *row, int stride)
+{
+     int i;
+     for (i = 0; i < width; ++i)
+	  vals[i] = row[i * (ptrdiff_t) stride];
+}
+
+/* sample_row and gather_row for single-precision data, which is only
+   converted to REAL as it is sampled into vals (so that the bulk of
+   the data is read with half the memory traffic) */
+static void sample_row_float(REAL *vals, int width, const col_table *t,
+			     const float *row, const float *row2, REAL wr)
+{
+     int i;
+     for (i = 0; i < width; ++i) {
+	  ptrdiff_t n = t->off[i];
+	  REAL w = t->w[i];
+	  if (w == 0.0)
+	       vals[i] = row[n] * wr + row2[n] * (1 - wr);
+	  else {
+	       ptrdiff_t n2 = t->off2[i];
+	       vals[i] = (row[n] * (1 - w) + row[n2] * w) * wr +
+		    (row2[n] * (1 - w) + row2[n2] * w) * (1 - wr);
+	  }
      }
+}
 
-     fp = fopen(filename, "wb");
-     if (fp == NULL) {
-	  perror("Error creating file to write PNG in");
-	  return;
+static void gather_row_float(REAL *vals, int width, const float *row,
+			     int stride)
+{
+     int i;
+     for (i = 0; i < width; ++i)
+	  vals[i] = row[i * (ptrdiff_t) stride];
+}
+
+/* the contour level (starting at 1, or 0 if none) of a pixel whose
+   neighborhood has mask values from maskmin to maskmax: the lowest
+   level in that range */
+static int contour_level(const render_params *p, REAL maskmin, REAL maskmax)
+{
+     int lo = 0, hi = p->nlevels;
+
+     if (!p->levels)
+	  return maskmin <= p->mask_thresh && maskmax >= p->mask_thresh;
+     while (lo < hi) { /* find the first level >= maskmin */
+	  int mid = (lo + hi) / 2;
+	  if (p->levels[mid] < maskmin)
+	       lo = mid + 1;
+	  else
+	       hi = mid;
      }
-     /* Create and initialize the png_struct with the desired error
-      * handler * functions.  If you want to use the default stderr and
-      * longjump method, * you can supply NULL for the last three
-      * parameters.  We also check that * the library version is
-      * compatible with the one used at compile time, * in case we are
-      * using dynamically linked libraries.  REQUIRED. */
-     png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL,NULL);
+     return lo < p->nlevels && p->levels[lo] <= maskmax ? lo + 1 : 0;
+}
 
-     if (png_ptr == NULL) {
-	  fclose(fp);
-	  return;
+/* color pixel i of out for contour level (>= 1) */
+static void mark_contour(const render_params *p, int level, png_byte *out,
+			 int i)
+{
+     if (p->eight_bit) /* (the level, for render_layers) */
+	  out[i] = p->levels ? level : 255;
+     else if (p->levels)
+	  memcpy(out + 3*i, p->level_rgb + 3*(level-1), 3);
+     else
+	  out[3*i] = out[3*i + 1] = out[3*i + 2] = p->mask_byte;
+}
+
+/* Draw the contour pixels of the row: those where the mask values of
+   the pixel, its left neighbor, and the pixel above straddle mask_thresh
+   (or, with several levels, one of the levels).  mask_prev holds the
+   mask values of the row above, and is updated. */
+static void contour_row(const render_params *p, const REAL *maskvals,
+			REAL *mask_prev, int init_mask_prev, png_byte *out)
+{
+     int i, level;
+     for (i = 0; i < p->width; ++i) {
+	  REAL maskval = maskvals[i], maskmin, maskmax;
+	  if (init_mask_prev)
+	       maskmin = maskmax = maskval;
+	  else {
+	       maskmin = MIN(MIN(maskval, i ? mask_prev[i-1] : maskval),
+			     mask_prev[i]);
+	       maskmax = MAX(MAX(maskval, i ? mask_prev[i-1] : maskval),
+			     mask_prev[i]);
+	  }
+	  mask_prev[i] = maskval;
+	  if ((level = contour_level(p, maskmin, maskmax)))
+	       mark_contour(p, level, out, i);
      }
-     /* Allocate/initialize the image information data.  REQUIRED */
-     info_ptr = png_create_info_struct(png_ptr);
-     if (info_ptr == NULL) {
-	  fclose(fp);
-	  png_destroy_write_struct(&png_ptr, (png_infopp) NULL);
-	  return;
+}
+
+/* offsets of data row n in the data, mask and overlay: */
+#define ROW_OFFSET(p, n, nx, ny) ((p)->transpose ? (n) % (ny) \
+				  : ((n) % (nx) - (p)->row0) * (ptrdiff_t) (ny))
+
+/* The data rows n and n2 to interpolate for image row "row", with the
+   weight wr of row n, and the column tables t, mt and ot for the data,
+   mask and overlay (which depend on the row for skewed images). */
+static void row_geometry(const render_params *p, int row,
+			 render_scratch *sc, int *n_, int *n2_, REAL *wr,
+			 const col_table **t, const col_table **mt,
+			 const col_table **ot)
+{
+     REAL x = row * p->scalex;
+     int n = PIN(0,(int) (x + 0.5), p->data_height-1);
+     double delta = x - n;
+
+     *n_ = n;
+     *n2_ = PIN(0,n + (delta>0.0 ? 1 : -1), p->data_height-1);
+     *wr = 1 - fabs(delta);
+     *t = &p->cols;
+     *mt = &p->mask_cols;
+     *ot = &p->overlay_cols;
+     if (p->skewsin != 0.0) {
+	  REAL offset;
+	  if (p->skewsin < 0.0)
+	       offset = x*p->skewsin;
+	  else
+	       offset = (x - (p->height-1)*p->scalex) * p->skewsin;
+	  init_col_tables(p, offset, &sc->cols, &sc->mask_cols,
+			  &sc->overlay_cols);
+	  *t = &sc->cols;
+	  *mt = &sc->mask_cols;
+	  *ot = &sc->overlay_cols;
      }
-     /* Set error handling.  REQUIRED if you aren't supplying your own *
-      * error hadnling functions in the png_create_write_struct() call. */
-     if (setjmp(png_jmpbuf(png_ptr))) {
-	  /* If we get here, we had a problem reading the file */
-	  fclose(fp);
-	  png_destroy_write_struct(&png_ptr, (png_infopp) NULL);
+}
+
+/* draw the contour pixels of a row, as cached in bits */
+static void draw_contour(const render_params *p, const unsigned char *bits,
+			 png_byte *out)
+{
+     int i;
+     for (i = 0; i < p->width; ++i)
+	  if (bits[i])
+	       mark_contour(p, bits[i], out, i);
+}
+
+/* render row "row" of the image (0 is the bottom row, which is written
+   last) into row_pointer, updating the contour state sc->mask_prev */
+static void render_row(const render_params *p, int row,
+		       png_byte *row_pointer, render_scratch *sc,
+		       int init_mask_prev)
+{
+     int n, n2;
+     REAL wr;
+     const REAL *vals = sc->vals, *data = p->data;
+     ptrdiff_t off, off2; /* offsets of data rows n and n2 */
+     const col_table *t, *mt, *ot;
+
+     if (p->src) {
+	  memcpy(row_pointer, p->src + (p->height-1 - row - p->row0)
+		 * (size_t) p->rowbytes, p->rowbytes);
 	  return;
      }
-     /* set up the output control if you are using standard C streams */
-     png_init_io(png_ptr, fp);
-
-     /* Set the image information here.  Width and height are up to
-       2^31, bit_depth is one of 1, 2, 4, 8, or 16, but valid values
-       also depend on the color_type selected. color_type is one of
-       PNG_COLOR_TYPE_GRAY, PNG_COLOR_TYPE_GRAY_ALPHA,
-       PNG_COLOR_TYPE_PALETTE, PNG_COLOR_TYPE_RGB, or
-       PNG_COLOR_TYPE_RGB_ALPHA.  interlace is either
-       PNG_INTERLACE_NONE or PNG_INTERLACE_ADAM7, and the
-       compression_type and filter_type MUST currently be
-       PNG_COMPRESSION_TYPE_BASE and PNG_FILTER_TYPE_BASE. REQUIRED */
 
-     if (!eight_bit)
-	  png_set_IHDR(png_ptr, info_ptr, width, height, 8 /* bit_depth */ ,
-		       PNG_COLOR_TYPE_RGB,
-		       PNG_INTERLACE_NONE,
-		       PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+     row_geometry(p, row, sc, &n, &n2, &wr, &t, &mt, &ot);
+     if (p->tile_rows) {
+	  data = (const REAL *) sc->tile;
+	  off = n - sc->tile_n0;
+	  off2 = n2 - sc->tile_n0;
+     }
+     else if (p->transpose) {
+	  off = n;
+	  off2 = n2;
+     }
      else {
-	  png_colorp palette;
-	  png_set_IHDR(png_ptr, info_ptr, width, height, 8 /* bit_depth */ ,
-		       PNG_COLOR_TYPE_PALETTE,
-		       PNG_INTERLACE_NONE,
-		       PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+	  off = (n - p->row0) * (ptrdiff_t) p->data_width;
+	  off2 = (n2 - p->row0) * (ptrdiff_t) p->data_width;
+     }
+     if (p->fdata) {
+	  const float *fdata = p->tile_rows ? (const float *) sc->tile
+	       : p->fdata;
+	  if (p->unit)
+	       gather_row_float(sc->vals, p->width, fdata + off,
+				p->transpose ? DATA_STRIDE(p) : 1);
+	  else
+	       sample_row_float(sc->vals, p->width, t, fdata + off,
+				fdata + off2, wr);
+     }
+     else if (p->unit) {
+	  if (p->transpose)
+	       gather_row(sc->vals, p->width, data + off, DATA_STRIDE(p));
+	  else
+	       vals = data + off;
+     }
+     else
+	  sample_row(sc->vals, p->width, t, data + off, data + off2, wr);
 
-	  /* initialize alpha channel (if any) via png_set_tRNS */
-#if USE_ALPHA
-	  init_alpha(png_ptr, info_ptr, colormap);
-#endif
-	  palette = (png_colorp) png_malloc(png_ptr, 256 * sizeof(png_color));
+     if (p->eight_bit)
+	  p->kernels->eight_bit(vals, p->width, p->minrange, p->maxrange,
+				p->scale, row_pointer);
+     else if (p->overlay) {
+	  const REAL *overlayvals = sc->overlayvals;
+	  if (p->layers)
+	       overlayvals = p->layers->overlayvals + row * (size_t) p->width;
+	  else
+	       sample_row(sc->overlayvals, p->width, ot,
+			  p->overlay + ROW_OFFSET(p, n, p->onx, p->ony),
+			  p->overlay + ROW_OFFSET(p, n2, p->onx, p->ony), wr);
+	  colormap_row_overlay(vals, overlayvals, p->width,
+			       &p->lut, &p->overlay_lut, row_pointer);
+     }
+     else
+	  p->kernels->rgb(vals, p->width, &p->lut, row_pointer);
 
-	  /* set the palette if there is one.  REQUIRED for indexed-color
-	   * images */
-	  init_palette(palette, colormap, mask_byte);
-	  png_set_PLTE(png_ptr, info_ptr, palette, 256);
+     if (p->mask && p->layers)
+	  draw_contour(p, p->layers->contour + row * (size_t) p->width,
+		       row_pointer);
+     else if (p->mask) {
+	  int n3 = PIN(0,n + 1, p->data_height-1);
+	  sample_row(sc->maskvals, p->width, mt,
+		     p->mask + ROW_OFFSET(p, n, p->mnx, p->mny),
+		     p->mask + ROW_OFFSET(p, n3, p->mnx, p->mny), wr);
+	  contour_row(p, sc->maskvals, sc->mask_prev, init_mask_prev,
+		      row_pointer);
      }
+}
 
-     /* Write the file header information.  REQUIRED */
-     png_write_info(png_ptr, info_ptr);
+/* Transposed data is rendered by reading each row of the image down a
+   column of the data, touching a different cache line for every pixel,
+   so when the data is too big for the cache we first copy the few data
+   rows that each band needs into a tile, in which they are contiguous
+   for each column. */
 
-     /* Write out data, one row at a time: */
-     {
-	  REAL scale, *mask_prev = NULL;
-	  png_byte *row_pointer;
-	  int row;
-	  int data_height = transpose ? ny : nx;
-	  int data_width = transpose ? nx : ny;
-
-	  if (maxrange > minrange)
-	       scale = 254.0 / (maxrange - minrange);
-	  else
-	       scale = 0.0;
+#define TILE_MIN 65536 /* elements of data, below which we don't bother */
+#define TILE_BAND_ROWS 16 /* minimum rows per band (if not p->zip) */
 
-	  row_pointer = (png_byte *) malloc(width * sizeof(png_byte) *
-					    (eight_bit ? 1 : 3));
-	  if (row_pointer == NULL) {
-	       fclose(fp);
-	       return;
-	  }
-	  if (mask) {
-	       mask_prev = (REAL *) malloc(width * sizeof(REAL));
-	       if (mask_prev == NULL) {
-		    free(row_pointer);
-		    fclose(fp);
-		    return;
-	       }
+/* the data rows n0..n1-1 read to render band b (and the two rows above
+   it, which we may render for the contour and PNG filtering state) */
+static void band_tile_rows(const render_params *p, int rows_per_band, int b,
+			   int *n0, int *n1)
+{
+     int k, k0 = MAX(0, b * rows_per_band - 2);
+     int k1 = MIN((b + 1) * rows_per_band, p->height);
+
+     *n0 = p->data_height;
+     *n1 = 0;
+     for (k = k0; k < k1; ++k) {
+	  /* as in row_geometry */
+	  REAL x = (p->height-1 - k) * p->scalex;
+	  int n = PIN(0,(int) (x + 0.5), p->data_height-1);
+	  double delta = x - n;
+	  int n2 = PIN(0,n + (delta>0.0 ? 1 : -1), p->data_height-1);
+	  *n0 = MIN(*n0, MIN(n, n2));
+	  *n1 = MAX(*n1, MAX(n, n2) + 1);
+     }
+}
+
+/* copy the data rows needed for band b into sc->tile */
+static void fill_tile(const render_params *p, int b, int rows_per_band,
+		      render_scratch *sc)
+{
+     int i, n, n0, n1;
+
+     band_tile_rows(p, rows_per_band, b, &n0, &n1);
+     sc->tile_n0 = n0;
+     for (i = 0; i < p->data_width; ++i) {
+	  if (p->fdata) {
+	       const float *col = p->fdata + i * (ptrdiff_t) p->data_height;
+	       float *t = (float *) sc->tile + i * (ptrdiff_t) p->tile_rows - n0;
+	       for (n = n0; n < n1; ++n)
+		    t[n] = col[n];
 	  }
-	  for (row = height-1; row >= 0; --row) {
-	       REAL x = row * scalex;
-	       int n = PIN(0,(int) (x + 0.5), data_height-1);
-	       double delta = x - n;
-	       int n2 = PIN(0,n + (delta>0.0 ? 1 : -1), data_height-1);
-	       int n3 = PIN(0,n + 1, data_height-1);
-	       REAL offset;
-
-	       if (skewsin < 0.0)
-		    offset = x*skewsin;
-	       else
-		    offset = (x - (height-1)*scalex) * skewsin;
-	       if (transpose)
-		    convert_row(width, data_width, scaley, offset,
-				data + n, data + n2, 1 - fabs(delta),
-				data_height,
-				mask ? mask + (n%mny) : NULL,
-				mask ? mask + (n3%mny) : NULL,
-				mask_thresh, mask_prev, row == height-1,
-				mask_byte, mnx, mny,
-				overlay != 0,
-				overlay + (n%ony), overlay + (n2%ony),
-				overlay_cmap, minoverlay, maxoverlay, onx, ony,
-				colormap, minrange, maxrange, scale,
-				row_pointer, eight_bit);
-	       else
-		    convert_row(width, data_width, scaley, offset,
-				data + n * data_width, data + n2 * data_width,
-				1 - fabs(delta),
-				1,
-				mask ? mask + (n%mnx) * mny : NULL,
-				mask ? mask + (n3%mnx) * mny : NULL,
-				mask_thresh, mask_prev, row == height-1,
-				mask_byte, mny, 1,
-				overlay != 0,
-				overlay + (n%onx) * ony,
-				overlay + (n2%onx) * ony,
-				overlay_cmap, minoverlay, maxoverlay, ony, 1,
-				colormap, minrange, maxrange, scale,
-				row_pointer, eight_bit);
-	       png_write_rows(png_ptr, &row_pointer, 1);
+	  else {
+	       const REAL *col = p->data + i * (ptrdiff_t) p->data_height;
+	       REAL *t = (REAL *) sc->tile + i * (ptrdiff_t) p->tile_rows - n0;
+	       for (n = n0; n < n1; ++n)
+		    t[n] = col[n];
 	  }
-
-	  free(row_pointer);
-	  free(mask_prev);
      }
+}
+
+/* Render band b (rows_per_band rows, top to bottom) into buf.  halo is
+   scratch space for one row, used to recompute mask_prev for the row
+   above the band; it is NULL if mask_prev is carried over from
+   rendering band b-1.  If prev is not NULL, the row above the band
+   (which PNG filtering needs) is also rendered into prev, unless it is
+   carried over as well. */
+static void render_band(const render_params *p, int b, int rows_per_band,
+			png_byte *buf, png_byte *prev, png_byte *halo,
+			render_scratch *sc)
+{
+     int k, k0 = b * rows_per_band;
+     int k1 = MIN(k0 + rows_per_band, p->height);
 
-     /* It is REQUIRED to call this to finish writing the rest of the file */
-     png_write_end(png_ptr, info_ptr);
+     if (p->tile_rows)
+	  fill_tile(p, b, rows_per_band, sc);
 
-     /* if you malloced the palette, free it here */
-     {
-          png_colorp palette; int num_palette;
-          if (0 != png_get_PLTE(png_ptr, info_ptr, &palette, &num_palette))
-               png_free(png_ptr, palette);
+     if (k0 > 0 && halo) {
+	  if (prev) {
+	       /* the contours of row k0-1 depend on row k0-2 */
+	       if (p->mask && k0 > 1)
+		    render_row(p, p->height + 1 - k0, halo, sc, 1);
+	       render_row(p, p->height - k0, prev, sc, k0 == 1);
+	  }
+	  else if (p->mask)
+	       render_row(p, p->height - k0, halo, sc, 1);
      }
+     for (k = k0; k < k1; ++k)
+	  render_row(p, p->height-1 - k, buf + (k - k0) * p->rowbytes,
+		     sc, k == 0);
+}
 
-     /* if you allocated any text comments, free them here */
+static int num_threads = 0; /* 0 means use all available processors */
 
-     /* clean up after the write, and free any memory allocated */
-     png_destroy_write_struct(&png_ptr, (png_infopp) NULL);
+void writepng_set_nthreads(int nthreads)
+{
+     num_threads = nthreads;
+}
 
-     /* close the file */
-     fclose(fp);
+int writepng_get_nthreads(void)
+{
+     int nthreads = num_threads;
+#if defined(HAVE_SYSCONF) && defined(_SC_NPROCESSORS_ONLN)
+     if (nthreads <= 0)
+	  nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+     return nthreads > 0 ? nthreads : 1;
+}
 
-     /* that's it */
+/* the levels and colors of writepng_set_contour_levels, if n > 0 */
+static struct {
+     int n;
+     REAL *levels;
+     png_byte *rgb;
+} contour_levels;
+
+static const pngzip_settings *compression = &pngzip_defaults;
+static pngzip_settings compression_settings;
+
+static int output_format = WRITEPNG_PNG;
+
+/* the number of images that we failed to write (see writepng_failures) */
+static int write_failures = 0;
+
+int writepng_failures(void)
+{
+     return write_failures;
+}
+static FILE *stdout_fp = NULL; /* where "-" is written, if not stdout */
+
+void writepng_set_format(int format)
+{
+     output_format = format;
+}
+
+void writepng_set_stdout(FILE *fp)
+{
+     stdout_fp = fp;
+}
+
+int writepng_set_compression(const char *spec)
+{
+     pngzip_settings s = *compression;
+     if (pngzip_parse(&s, spec))
+	  return 1;
+     compression_settings = s;
+     compression = &compression_settings;
+     return 0;
+}
+
+/***********************************************************************/
+/* Animated PNG (APNG) output.  Each frame is written as it is rendered,
+   as an fcTL (frame control) chunk followed by its image data, in IDAT
+   chunks for the first frame and in fdAT chunks (IDAT chunks with a
+   sequence number) for the rest.  libpng doesn't support APNG, so we
+   write these chunks ourselves, and compress the frames ourselves too.
+
+   With delta frames, each frame after the first only stores the
+   bounding box of the pixels that changed.  For direct color, the
+   image has an alpha channel, where the unchanged pixels in the box are
+   transparent and the frame is blended over the previous one. */
+
+/* the animation being written, if anim.fp != NULL */
+static struct {
+     FILE *fp;
+     png_structp png_ptr;
+     png_infop info_ptr;
+     long actl_pos; /* file position of the acTL chunk */
+     int nframes, iframe, seq; /* seq: next chunk sequence number */
+     int delay_num, delay_den, delta;
+     int width, height, eight_bit; /* of the first frame */
+     png_byte *image, *prev; /* current and (for delta) previous frames */
+     png_byte *region; /* the part of the current frame to store */
+     int err;
+} anim;
+
+/* The montage being written, if montage.fp != NULL (see add_tile) */
+static struct {
+     FILE *fp;
+     int ntiles, ncols, itile;
+     int tile_width, tile_height; /* of the first tile */
+     png_byte *tile; /* the current tile */
+     render_params sheet; /* the whole montage, rendered from its strip */
+     png_byte *strip; /* rows sheet.row0 to avail-1 of the montage */
+     int strip_rows; /* size of strip */
+     int avail; /* rows 0..avail-1 of the montage have been rendered */
+     int rows_per_band, nbands, b; /* b: the next band to write */
+     uLong adler;
+     png_structp png_ptr;
+     png_infop info_ptr;
+     qoi_encoder *qoi;
+     int err;
+} montage;
+
+/* the compression of APNG frames, if libpng's is requested */
+static const pngzip_settings anim_compression = {
+     1, Z_DEFAULT_COMPRESSION, PNGZIP_FILTER_ADAPTIVE, Z_FILTERED
+};
+
+static void put_uint32(png_byte *buf, png_uint_32 x)
+{
+     buf[0] = (x >> 24) & 0xff;
+     buf[1] = (x >> 16) & 0xff;
+     buf[2] = (x >> 8) & 0xff;
+     buf[3] = x & 0xff;
+}
+
+/* write data (len bytes, with 4 writable bytes before it for an fdAT
+   sequence number) as an IDAT chunk or, after the first frame of an
+   animation, as an fdAT chunk */
+static void write_image_data(png_structp png_ptr, png_byte *data,
+			     size_t len)
+{
+     if (anim.fp && anim.iframe > 0) {
+	  put_uint32(data - 4, anim.seq++);
+	  png_write_chunk(png_ptr, (png_const_bytep) "fdAT", data - 4, len + 4);
+     }
+     else
+	  png_write_chunk(png_ptr, (png_const_bytep) "IDAT", data, len);
+}
+
+/* A band of rendered rows, and (if p->zip) the compressed band: 4
+   bytes for an APNG sequence number, a 2-byte zlib header, the zlen
+   bytes of deflate data with the adler32 checksum adler of the filtered
+   rows, and 4 bytes for the checksum of the whole zlib stream. */
+typedef struct {
+     png_byte *rows;
+     png_byte *z;
+     long zlen;
+     uLong adler;
+} band_buf;
+
+static int alloc_band_buf(const render_params *p, int rows_per_band,
+			  band_buf *bb)
+{
+     memset(bb, 0, sizeof(band_buf));
+     bb->rows = (png_byte *) malloc(rows_per_band * p->rowbytes);
+     if (p->zip)
+	  bb->z = (png_byte *) malloc(4 + 2 + pngzip_bound(p->rowbytes,
+							   rows_per_band) + 4);
+     return !bb->rows || (p->zip && !bb->z);
+}
+
+static void destroy_band_buf(band_buf *bb)
+{
+     free(bb->rows);
+     free(bb->z);
+}
+
+/* compress band b of the nbands bands (nrows rows, following the row
+   prev), returning nonzero on failure */
+static int compress_band(int b, int nbands, int nrows,
+			 const png_byte *prev, band_buf *bb, pngzip_stream *zs)
+{
+     bb->zlen = pngzip_band(zs, bb->rows, nrows, b ? prev : NULL,
+			    b == nbands - 1, bb->z + 6, &bb->adler);
+     return bb->zlen < 0;
+}
+
+static int init_zstream(const render_params *p, pngzip_stream *zs)
+{
+     if (!p->zip) {
+	  memset(zs, 0, sizeof(pngzip_stream));
+	  return 0;
+     }
+     return pngzip_init(zs, p->zip, p->rowbytes, p->bpp, p->eight_bit);
+}
+
+static int add_tile_rows(tile_pyramid *t, const png_byte *rows, int nrows);
+
+/* Write band b (nrows rows, each band but the last rows_per_band rows)
+   via libpng, returning nonzero on a libpng error.  If we compressed the
+   band ourselves, it is written as an image data chunk, where the first
+   band starts with the zlib header and the last ends with the checksum
+   *adler of all the bands (combined as we go).  If p->image or p->raw,
+   the rows are just stored there, or written there as they are, if
+   p->qoi they are QOI-encoded, and if p->tiles they are added to the
+   tile pyramid. */
+static int write_band(png_structp png_ptr, const render_params *p,
+		      band_buf *bb, int b, int nbands, int rows_per_band,
+		      int nrows, uLong *adler)
+{
+     int k;
+     if (p->tiles)
+	  return add_tile_rows(p->tiles, bb->rows, nrows);
+     if (p->image) {
+	  memcpy(p->image + b * (size_t) rows_per_band * p->rowbytes,
+		 bb->rows, nrows * (size_t) p->rowbytes);
+	  return 0;
+     }
+     if (p->raw)
+	  return fwrite(bb->rows, p->rowbytes, nrows, p->raw) != (size_t) nrows;
+     if (p->qoi)
+	  return qoi_encode(p->qoi, bb->rows, nrows * (size_t) p->width);
+     if (setjmp(png_jmpbuf(png_ptr)))
+	  return 1;
+     if (p->zip) {
+	  png_byte *z = bb->z + 6;
+	  size_t zlen = bb->zlen;
+	  if (b == 0) {
+	       z = bb->z + 4;
+	       pngzip_header(p->zip, z);
+	       zlen += 2;
+	       *adler = bb->adler;
+	  }
+	  else
+	       *adler = adler32_combine(*adler, bb->adler,
+					nrows * (p->rowbytes + (z_off_t) 1));
+	  if (b == nbands - 1) {
+	       z[zlen++] = (*adler >> 24) & 0xff;
+	       z[zlen++] = (*adler >> 16) & 0xff;
+	       z[zlen++] = (*adler >> 8) & 0xff;
+	       z[zlen++] = *adler & 0xff;
+	  }
+	  write_image_data(png_ptr, z, zlen);
+     }
+     else
+	  for (k = 0; k < nrows; ++k) {
+	       png_bytep row_pointer = bb->rows + k * p->rowbytes;
+	       png_write_rows(png_ptr, &row_pointer, 1);
+	  }
+     return 0;
+}
+
+#ifdef USE_THREADS
+typedef struct {
+     const render_params *p;
+     int nbands, rows_per_band, nslots;
+     int b1; /* render the bands up to b1-1 */
+     band_buf *bufs;
+     int *slot_band; /* band rendered in each slot, or -1 */
+     int next_band, nwritten, abort;
+     pthread_mutex_t lock;
+     pthread_cond_t space, done;
+} pipeline;
+
+static void *render_worker(void *data)
+{
+     pipeline *pl = (pipeline *) data;
+     const render_params *p = pl->p;
+     png_byte *halo, *prev = NULL;
+     render_scratch sc;
+     pngzip_stream zs;
+     int err;
+
+     halo = (png_byte *) malloc(p->rowbytes);
+     if (p->zip)
+	  prev = (png_byte *) malloc(p->rowbytes);
+     err = alloc_scratch(p, &sc) || !halo || (p->zip && !prev);
+     err = init_zstream(p, &zs) || err;
+
+     for (;;) {
+	  int b, slot, nrows;
+
+	  pthread_mutex_lock(&pl->lock);
+	  if (err) {
+	       pl->abort = 1;
+	       pthread_cond_broadcast(&pl->done);
+	       pthread_cond_broadcast(&pl->space);
+	  }
+	  while (!pl->abort && pl->next_band < pl->b1
+		 && pl->next_band - pl->nwritten >= pl->nslots)
+	       pthread_cond_wait(&pl->space, &pl->lock);
+	  if (pl->abort || pl->next_band >= pl->b1) {
+	       pthread_mutex_unlock(&pl->lock);
+	       break;
+	  }
+	  b = pl->next_band++;
+	  pthread_mutex_unlock(&pl->lock);
+
+	  slot = b % pl->nslots;
+	  nrows = MIN(pl->rows_per_band, p->height - b * pl->rows_per_band);
+	  render_band(p, b, pl->rows_per_band, pl->bufs[slot].rows,
+		      prev, halo, &sc);
+	  if (p->zip && compress_band(b, pl->nbands, nrows, prev,
+				      &pl->bufs[slot], &zs)) {
+	       err = 1;
+	       continue;
+	  }
+
+	  pthread_mutex_lock(&pl->lock);
+	  pl->slot_band[slot] = b;
+	  pthread_cond_broadcast(&pl->done);
+	  pthread_mutex_unlock(&pl->lock);
+     }
+
+     pngzip_destroy(&zs);
+     free(prev);
+     free(halo);
+     destroy_scratch(&sc);
+     return NULL;
+}
+
+static int render_rows_threaded(const render_params *p, png_structp png_ptr,
+				int nthreads, int rows_per_band, int nbands,
+				int b0, int b1, uLong *adler)
+{
+     pipeline pl;
+     pthread_t *threads;
+     int i, b, err = 0;
+
+     pl.p = p;
+     pl.nbands = nbands;
+     pl.rows_per_band = rows_per_band;
+     pl.nslots = MIN(2 * nthreads, b1 - b0);
+     pl.b1 = b1;
+     pl.next_band = pl.nwritten = b0;
+     pl.abort = 0;
+     pl.bufs = (band_buf *) calloc(pl.nslots, sizeof(band_buf));
+     pl.slot_band = (int *) malloc(pl.nslots * sizeof(int));
+     threads = (pthread_t *) malloc(nthreads * sizeof(pthread_t));
+     err = !pl.bufs || !pl.slot_band || !threads;
+     for (i = 0; i < pl.nslots && !err; ++i)
+	  err = alloc_band_buf(p, rows_per_band, &pl.bufs[i]);
+     if (err) {
+	  for (i = 0; pl.bufs && i < pl.nslots; ++i)
+	       destroy_band_buf(&pl.bufs[i]);
+	  free(pl.bufs);
+	  free(pl.slot_band);
+	  free(threads);
+	  return 1;
+     }
+     for (i = 0; i < pl.nslots; ++i)
+	  pl.slot_band[i] = -1;
+     pthread_mutex_init(&pl.lock, NULL);
+     pthread_cond_init(&pl.space, NULL);
+     pthread_cond_init(&pl.done, NULL);
+
+     for (i = 0; i < nthreads; ++i)
+	  if (pthread_create(&threads[i], NULL, render_worker, &pl))
+	       break;
+     nthreads = i;
+     if (!nthreads)
+	  err = 1;
+
+     for (b = b0; b < b1 && !err; ++b) {
+	  int slot = b % pl.nslots;
+	  int nrows = MIN(rows_per_band, p->height - b * rows_per_band);
+
+	  pthread_mutex_lock(&pl.lock);
+	  while (!pl.abort && pl.slot_band[slot] != b)
+	       pthread_cond_wait(&pl.done, &pl.lock);
+	  err = pl.abort;
+	  pthread_mutex_unlock(&pl.lock);
+	  if (err)
+	       break;
+
+	  err = write_band(png_ptr, p, &pl.bufs[slot], b, nbands, rows_per_band, nrows,
+			   adler);
+
+	  pthread_mutex_lock(&pl.lock);
+	  pl.slot_band[slot] = -1;
+	  pl.nwritten = b + 1;
+	  if (err)
+	       pl.abort = 1;
+	  pthread_cond_broadcast(&pl.space);
+	  pthread_mutex_unlock(&pl.lock);
+     }
+
+     for (i = 0; i < nthreads; ++i)
+	  pthread_join(threads[i], NULL);
+
+     pthread_cond_destroy(&pl.done);
+     pthread_cond_destroy(&pl.space);
+     pthread_mutex_destroy(&pl.lock);
+     free(threads);
+     free(pl.slot_band);
+     for (i = 0; i < pl.nslots; ++i)
+	  destroy_band_buf(&pl.bufs[i]);
+     free(pl.bufs);
+     return err;
+}
+#endif /* USE_THREADS */
+
+#define BAND_BYTES 65536 /* target size of a band of rendered rows */
+
+/* target size of the bands that we compress independently: large
+   enough that restarting compression for each band costs little */
+#define ZBAND_BYTES 262144
+
+/* render bands b0..b1-1 of the nbands bands of the image and pass them
+   to libpng, combining the checksum *adler of the compressed bands and
+   returning nonzero on failure */
+static int render_bands(const render_params *p, png_structp png_ptr,
+			int nthreads, int rows_per_band, int nbands,
+			int b0, int b1, uLong *adler)
+{
+     int b, err = 0;
+     png_byte *prev = NULL, *halo = NULL;
+     band_buf bb;
+     render_scratch sc;
+     pngzip_stream zs;
+
+#ifdef USE_THREADS
+     if (nthreads > 1 && b1 - b0 > 1)
+	  return render_rows_threaded(p, png_ptr, MIN(nthreads, b1 - b0),
+				      rows_per_band, nbands, b0, b1, adler);
+#endif
+
+     if (p->zip)
+	  prev = (png_byte *) malloc(p->rowbytes);
+     if (b0 > 0) /* the contour state must be recomputed for band b0 */
+	  halo = (png_byte *) malloc(p->rowbytes);
+     err = alloc_band_buf(p, rows_per_band, &bb);
+     err = alloc_scratch(p, &sc) || err || (p->zip && !prev) || (b0 && !halo);
+     err = init_zstream(p, &zs) || err;
+     for (b = b0; b < b1 && !err; ++b) {
+	  int nrows = MIN(rows_per_band, p->height - b * rows_per_band);
+	  render_band(p, b, rows_per_band, bb.rows, b == b0 ? prev : NULL,
+		      b == b0 ? halo : NULL, &sc);
+	  if (p->zip) {
+	       err = compress_band(b, nbands, nrows, prev, &bb, &zs);
+	       /* carry the last row over, for filtering the next band */
+	       memcpy(prev, bb.rows + (nrows - 1) * p->rowbytes, p->rowbytes);
+	  }
+	  err = err || write_band(png_ptr, p, &bb, b, nbands, rows_per_band,
+				  nrows, adler);
+     }
+     pngzip_destroy(&zs);
+     destroy_scratch(&sc);
+     destroy_band_buf(&bb);
+     free(halo);
+     free(prev);
+     return err;
+}
+
+/* the data rows n0..n1-1 needed to render bands b0..b1-1 of the image
+   (and the rows above them), with a margin for rounding */
+static void band_data_rows(const render_params *p, int rows_per_band,
+			   int b0, int b1, int *n0, int *n1)
+{
+     int k0 = b0 * rows_per_band, k1 = MIN(b1 * rows_per_band, p->height);
+     double x0 = floor((p->height - k1) * (double) p->scalex);
+     double x1 = ceil(MIN(p->height + 1 - k0, p->height - 1)
+		      * (double) p->scalex);
+     *n0 = MAX(0, (int) x0 - 2);
+     *n1 = MIN(p->data_height, (int) x1 + 3);
+}
+
+/* For writepng_stream: render the image in chunks of consecutive bands,
+   before each of which we read just the data rows that it needs (at most
+   max_rows, unless a single band needs more). */
+static int render_rows_streamed(const render_params *p, png_structp png_ptr,
+				int nthreads, int rows_per_band, int nbands)
+{
+     const row_source *src = p->source;
+     render_params q = *p;
+     size_t rowlen = p->data_width;
+     int b0, b1, n0, n1, m0, m1, max_rows = src->max_rows, err;
+     uLong adler = 0;
+
+     for (b0 = 0; b0 < nbands; ++b0) {
+	  band_data_rows(p, rows_per_band, b0, b0 + 1, &n0, &n1);
+	  max_rows = MAX(max_rows, n1 - n0);
+     }
+     q.data = (REAL *) malloc(max_rows * rowlen * sizeof(REAL));
+     if (p->mask)
+	  q.mask = (REAL *) malloc(max_rows * rowlen * sizeof(REAL));
+     if (p->overlay)
+	  q.overlay = (REAL *) malloc(max_rows * rowlen * sizeof(REAL));
+     err = !q.data || (p->mask && !q.mask) || (p->overlay && !q.overlay);
+
+     for (b0 = 0; b0 < nbands && !err; b0 = b1) {
+	  band_data_rows(p, rows_per_band, b0, b0 + 1, &n0, &n1);
+	  for (b1 = b0 + 1; b1 < nbands; ++b1) {
+	       band_data_rows(p, rows_per_band, b0, b1 + 1, &m0, &m1);
+	       if (m1 - m0 > max_rows)
+		    break;
+	       n0 = m0;
+	       n1 = m1;
+	  }
+	  q.row0 = n0;
+	  err = src->read_rows(src->ctx, n0, n1, q.data, q.mask, q.overlay)
+	       || render_bands(&q, png_ptr, nthreads, rows_per_band, nbands,
+			       b0, b1, &adler);
+     }
+     if (p->mask)
+	  free(q.mask);
+     if (p->overlay)
+	  free(q.overlay);
+     free(q.data);
+     return err;
+}
+
+/* render all of the rows of the image and pass them to libpng, returning
+   nonzero on failure */
+static int render_rows(const render_params *p, png_structp png_ptr)
+{
+     int nthreads = writepng_get_nthreads();
+     int rows_per_band, nbands;
+     int tiled = !p->source && p->transpose && p->data_width > 1
+	  && p->data_width * (double) p->data_height >= TILE_MIN;
+     uLong adler = 0;
+
+     if (p->zip) /* independent of nthreads, and so is the output */
+	  rows_per_band = MAX(1, ZBAND_BYTES / p->rowbytes);
+     else {
+	  /* bands of about BAND_BYTES, but at least a few bands per thread
+	     so that the work is balanced and libpng is kept busy: */
+	  rows_per_band = MAX(1, BAND_BYTES / p->rowbytes);
+	  if (nthreads > 1)
+	       rows_per_band = MIN(rows_per_band,
+				   MAX(1, p->height / (4 * nthreads)));
+	  /* enough rows to use most of each cache line of the tiles */
+	  if (tiled)
+	       rows_per_band = MAX(rows_per_band, TILE_BAND_ROWS);
+     }
+     nbands = (p->height + rows_per_band - 1) / rows_per_band;
+
+     if (p->source)
+	  return render_rows_streamed(p, png_ptr, nthreads, rows_per_band,
+				      nbands);
+     if (tiled) {
+	  /* render from tiles, with column tables for their stride */
+	  render_params q = *p;
+	  int b, n0, n1, err;
+
+	  for (b = 0; b < nbands; ++b) {
+	       band_tile_rows(p, rows_per_band, b, &n0, &n1);
+	       q.tile_rows = MAX(q.tile_rows, n1 - n0);
+	  }
+	  err = alloc_col_tables(&q, &q.cols, &q.mask_cols, &q.overlay_cols);
+	  if (!err)
+	       init_col_tables(&q, 0.0, &q.cols, &q.mask_cols,
+			       &q.overlay_cols);
+	  err = err || render_bands(&q, png_ptr, nthreads, rows_per_band,
+				    nbands, 0, nbands, &adler);
+	  destroy_col_tables(&q.cols, &q.mask_cols, &q.overlay_cols);
+	  return err;
+     }
+     return render_bands(p, png_ptr, nthreads, rows_per_band, nbands,
+			 0, nbands, &adler);
+}
+
+/***********************************************************************/
+
+void writepng_image_size(int nx, int ny, int transpose,
+			 REAL skew, REAL scalex, REAL scaley,
+			 int *width, int *height)
+{
+     double skewsin = sin(skew), skewcos = cos(skew);
+
+     if (transpose) {
+	  *height = MAX(1, ny * scalex * skewcos);
+	  *width = MAX(1, nx * scaley * (1.0 + fabs(skewsin)));
+     } else {
+	  *height = MAX(1, nx * scalex * skewcos);
+	  *width = MAX(1, ny * scaley * (1.0 + fabs(skewsin)));
+     }
+}
+
+/* The colormap LUTs only depend on the colors (the range just sets
+   their scale), so the last few are kept for the next images, most
+   recently used first, e.g. for the many images of h5topng --serve. */
+#define LUT_CACHE_SIZE 4
+typedef struct {
+     colormap_t cmap; /* a copy of the colors */
+     int want_rgba;
+     cmap_lut lut;
+} lut_cache_entry;
+static lut_cache_entry lut_cache[LUT_CACHE_SIZE];
+static int lut_cache_n = 0;
+
+/* like init_lut, except that the tables of lut belong to the cache (so
+   they must not be freed by destroy_lut) */
+static int get_lut(cmap_lut *lut, colormap_t cmap, REAL min, REAL max,
+		   int want_rgba)
+{
+     lut_cache_entry e;
+     int i;
+
+     for (i = 0; i < lut_cache_n; ++i)
+	  if (lut_cache[i].want_rgba == want_rgba
+	      && lut_cache[i].cmap.n == cmap.n
+	      && !memcmp(lut_cache[i].cmap.rgba, cmap.rgba,
+			 cmap.n * sizeof(rgba_t)))
+	       break;
+     if (i < lut_cache_n)
+	  e = lut_cache[i];
+     else {
+	  e.cmap.n = cmap.n;
+	  e.cmap.rgba = (rgba_t *) malloc(cmap.n * sizeof(rgba_t) + 1);
+	  e.want_rgba = want_rgba;
+	  if (!e.cmap.rgba || init_lut(&e.lut, cmap, 0.0, 1.0, want_rgba)) {
+	       if (e.cmap.rgba)
+		    destroy_lut(&e.lut);
+	       free(e.cmap.rgba);
+	       return 1;
+	  }
+	  memcpy(e.cmap.rgba, cmap.rgba, cmap.n * sizeof(rgba_t));
+	  if (lut_cache_n == LUT_CACHE_SIZE) { /* drop the least recent */
+	       free(lut_cache[i - 1].cmap.rgba);
+	       destroy_lut(&lut_cache[i - 1].lut);
+	       --i;
+	  }
+	  else
+	       ++lut_cache_n;
+     }
+     memmove(lut_cache + 1, lut_cache, i * sizeof(lut_cache_entry));
+     lut_cache[0] = e;
+
+     *lut = e.lut;
+     lut->scale = range_scale(&min, &max, lut->n - 1);
+     lut->min = min;
+     lut->max = max;
+     return 0;
+}
+
+/* Set up the parameters p for rendering the image given by writepng's
+   arguments, returning nonzero if we run out of memory.  (p must be
+   freed by destroy_render in any case.) */
+static int init_render(render_params *p,
+		       int nx, int ny, int transpose,
+		       REAL skew, REAL scalex, REAL scaley,
+		       REAL *data,
+		       REAL *mask, REAL mask_thresh,
+		       int mnx, int mny,
+		       REAL *overlay, colormap_t overlay_cmap,
+		       int onx, int ony, REAL minoverlay, REAL maxoverlay,
+		       REAL minrange, REAL maxrange,
+		       colormap_t colormap, int eight_bit)
+{
+     int height, width, err;
+     double skewsin = sin(skew);
+
+     memset(p, 0, sizeof(render_params));
+
+     /* we must use direct color for translucent overlays, for the
+	uncompressed formats (which have no color table), for montages
+	(whose tiles may have different mask colors), and for contours
+	of several colors */
+     if (overlay || output_format != WRITEPNG_PNG || montage.fp
+	 || (mask && contour_levels.n))
+	  eight_bit = 0;
+
+     /* compute png size from scaled (and possibly transposed) data size,
+      * and reverse the meaning of the scale factors; now they are what we
+      * multiply png coordinates by to get data coordinates: */
+
+     writepng_image_size(nx, ny, transpose, skew, scalex, scaley,
+			 &width, &height);
+     if (transpose) {
+	  scalex = height==1 ? 0 : (1.0 * (ny-1)) / (height-1);
+	  scaley = width==1 ? 0 : ((1.0 + fabs(skewsin)) * (nx-1)) / (width-1);
+     } else {
+	  scalex = height==1 ? 0 : (1.0 * (nx-1)) / (height-1);
+	  scaley = width==1 ? 0 : ((1.0 + fabs(skewsin)) * (ny-1)) / (width-1);
+     }
+
+     /* determine mask color by middle of colormap (FIXME: use
+	median color of the data or some such thing instead?) */
+     {
+	  float r,g,b,a;
+	  cmap_lookup(0.5, colormap, &r, &g, &b, &a);
+	  if ((r + g + b) / 3.0 > 0.5)
+	       p->mask_byte = 0; /* black */
+	  else
+	       p->mask_byte = 255; /* white */
+     }
+
+     p->width = width;
+     p->height = height;
+     p->transpose = transpose;
+     p->scalex = scalex;
+     p->scaley = scaley;
+     p->skewsin = skewsin;
+     p->data = data;
+     p->data_height = transpose ? ny : nx;
+     p->data_width = transpose ? nx : ny;
+     p->mask = mask;
+     p->mask_thresh = mask_thresh;
+     if (mask && contour_levels.n) {
+	  p->nlevels = contour_levels.n;
+	  p->levels = contour_levels.levels;
+	  p->level_rgb = contour_levels.rgb;
+     }
+     p->mnx = mnx;
+     p->mny = mny;
+     p->overlay = overlay;
+     p->onx = onx;
+     p->ony = ony;
+     p->scale = range_scale(&minrange, &maxrange, 254.0);
+     p->minrange = minrange;
+     p->maxrange = maxrange;
+     p->eight_bit = eight_bit;
+     p->bpp = eight_bit ? 1 : 3;
+     p->rowbytes = width * p->bpp;
+     p->zip = compression->banded ? compression : NULL;
+
+     p->kernels = get_colormap_kernels();
+     p->unit = !mask && !overlay && skewsin == 0.0
+	  && p->scalex == 1.0 && p->scaley == 1.0;
+
+     err = (!eight_bit && get_lut(&p->lut, colormap, minrange, maxrange,
+				  overlay != NULL))
+	  || (overlay && get_lut(&p->overlay_lut, overlay_cmap,
+				 minoverlay, maxoverlay, 1));
+     if (!err && !p->unit && skewsin == 0.0) {
+	  err = alloc_col_tables(p, &p->cols, &p->mask_cols,
+				 &p->overlay_cols);
+	  if (!err)
+	       init_col_tables(p, 0.0, &p->cols, &p->mask_cols,
+			       &p->overlay_cols);
+     }
+     return err;
+}
+
+static void destroy_render(render_params *p)
+{
+     destroy_col_tables(&p->cols, &p->mask_cols, &p->overlay_cols);
+}
+
+/* Create a libpng writer for fp, and write the PNG header for images
+   like p, of the given color_type for direct color, returning NULL on
+   failure. */
+static png_structp begin_png(FILE *fp, png_infop *info,
+			     const render_params *p, colormap_t colormap,
+			     int color_type)
+{
+     png_structp png_ptr;
+     png_infop info_ptr;
+
+     /* Create and initialize the png_struct with the desired error
+      * handler * functions.  If you want to use the default stderr and
+      * longjump method, * you can supply NULL for the last three
+      * parameters.  We also check that * the library version is
+      * compatible with the one used at compile time, * in case we are
+      * using dynamically linked libraries.  REQUIRED. */
+     png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL,NULL);
+
+     if (png_ptr == NULL)
+	  return NULL;
+     /* Allocate/initialize the image information data.  REQUIRED */
+     info_ptr = png_create_info_struct(png_ptr);
+     if (info_ptr == NULL) {
+	  png_destroy_write_struct(&png_ptr, (png_infopp) NULL);
+	  return NULL;
+     }
+     /* Set error handling.  REQUIRED if you aren't supplying your own *
+      * error hadnling functions in the png_create_write_struct() call. */
+     if (setjmp(png_jmpbuf(png_ptr))) {
+	  /* If we get here, we had a problem reading the file */
+	  png_destroy_write_struct(&png_ptr, &info_ptr);
+	  return NULL;
+     }
+     /* set up the output control if you are using standard C streams */
+     png_init_io(png_ptr, fp);
+
+     /* Set the image information here.  Width and height are up to
+       2^31, bit_depth is one of 1, 2, 4, 8, or 16, but valid values
+       also depend on the color_type selected. color_type is one of
+       PNG_COLOR_TYPE_GRAY, PNG_COLOR_TYPE_GRAY_ALPHA,
+       PNG_COLOR_TYPE_PALETTE, PNG_COLOR_TYPE_RGB, or
+       PNG_COLOR_TYPE_RGB_ALPHA.  interlace is either
+       PNG_INTERLACE_NONE or PNG_INTERLACE_ADAM7, and the
+       compression_type and filter_type MUST currently be
+       PNG_COMPRESSION_TYPE_BASE and PNG_FILTER_TYPE_BASE. REQUIRED */
+
+     if (!p->eight_bit)
+	  png_set_IHDR(png_ptr, info_ptr, p->width, p->height,
+		       8 /* bit_depth */ ,
+		       color_type,
+		       PNG_INTERLACE_NONE,
+		       PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+     else {
+	  png_colorp palette;
+	  png_set_IHDR(png_ptr, info_ptr, p->width, p->height,
+		       8 /* bit_depth */ ,
+		       PNG_COLOR_TYPE_PALETTE,
+		       PNG_INTERLACE_NONE,
+		       PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+
+	  /* initialize alpha channel (if any) via png_set_tRNS */
+#if USE_ALPHA
+	  init_alpha(png_ptr, info_ptr, colormap);
+#endif
+	  palette = (png_colorp) png_malloc(png_ptr, 256 * sizeof(png_color));
+
+	  /* set the palette if there is one.  REQUIRED for indexed-color
+	   * images */
+	  init_palette(palette, colormap, p->mask_byte);
+	  png_set_PLTE(png_ptr, info_ptr, palette, 256);
+	  png_free(png_ptr, palette); /* libpng keeps its own copy */
+     }
+
+     /* Write the file header information.  REQUIRED */
+     png_write_info(png_ptr, info_ptr);
+
+     *info = info_ptr;
+     return png_ptr;
+}
+
+/* finish writing the PNG file, returning nonzero on failure */
+static int end_png(png_structp png_ptr, png_infop info_ptr)
+{
+     if (setjmp(png_jmpbuf(png_ptr))) {
+	  png_destroy_write_struct(&png_ptr, &info_ptr);
+	  return 1;
+     }
+
+     /* It is REQUIRED to call this to finish writing the rest of the file
+	(unless we wrote the IDAT chunks ourselves, which libpng doesn't
+	know about, in which case we just end the file) */
+     if (compression->banded || anim.fp)
+	  png_write_chunk(png_ptr, (png_const_bytep) "IEND", NULL, 0);
+     else
+	  png_write_end(png_ptr, info_ptr);
+
+     /* clean up after the write, and free any memory allocated
+	(including libpng's copy of the palette) */
+     png_destroy_write_struct(&png_ptr, &info_ptr);
+     return 0;
+}
+
+int writepng_anim_begin(const char *filename, int nframes, double fps,
+			int delta)
+{
+     if (anim.fp || nframes < 1 || fps <= 0)
+	  return 1;
+     memset(&anim, 0, sizeof(anim));
+     anim.fp = fopen(filename, "wb");
+     if (anim.fp == NULL) {
+	  perror("Error creating file to write APNG in");
+	  return 1;
+     }
+     anim.nframes = nframes;
+     anim.delay_num = 100;
+     anim.delay_den = PIN(1, (int) (fps * 100 + 0.5), 65535);
+     anim.delta = delta;
+     return 0;
+}
+
+/* rewrite the frame count in the acTL chunk, if we wrote fewer frames
+   than expected, returning nonzero on failure */
+static int fix_frame_count(void)
+{
+     png_byte actl[12];
+     uLong crc;
+
+     put_uint32(actl, anim.iframe);
+     put_uint32(actl + 4, 0); /* loop forever */
+     crc = crc32(crc32(0L, (const Bytef *) "acTL", 4), actl, 8);
+     put_uint32(actl + 8, crc);
+     return fflush(anim.fp)
+	  || fseek(anim.fp, anim.actl_pos + 8, SEEK_SET)
+	  || fwrite(actl, 1, 12, anim.fp) != 12
+	  || fseek(anim.fp, 0, SEEK_END);
+}
+
+int writepng_anim_end(void)
+{
+     int err = anim.err || !anim.png_ptr;
+
+     if (!anim.fp)
+	  return 1;
+     if (anim.png_ptr) {
+	  if (anim.iframe < anim.nframes && fix_frame_count()) {
+	       fprintf(stderr, "couldn't fix the number of APNG frames\n");
+	       err = 1;
+	  }
+	  err = end_png(anim.png_ptr, anim.info_ptr) || err;
+     }
+     err = fclose(anim.fp) || err;
+     free(anim.image);
+     free(anim.prev);
+     free(anim.region);
+     memset(&anim, 0, sizeof(anim));
+     return err;
+}
+
+/* the bounding box [x0,x1) x [y0,y1) of the pixels that differ between
+   images a and b, which is empty (x1 == x0) if they are identical */
+static void changed_box(const png_byte *a, const png_byte *b,
+			int width, int height, int bpp,
+			int *x0, int *y0, int *x1, int *y1)
+{
+     size_t rowbytes = (size_t) width * bpp;
+     int x, y;
+
+     *x0 = width; *x1 = 0;
+     *y0 = height; *y1 = 0;
+     for (y = 0; y < height; ++y) {
+	  const png_byte *ra = a + y * rowbytes, *rb = b + y * rowbytes;
+	  if (!memcmp(ra, rb, rowbytes))
+	       continue;
+	  if (*y0 > y)
+	       *y0 = y;
+	  *y1 = y + 1;
+	  for (x = 0; x < *x0 && !memcmp(ra + x*bpp, rb + x*bpp, bpp); ++x)
+	       ;
+	  *x0 = x;
+	  for (x = width; x > *x1 && !memcmp(ra + (x-1)*bpp, rb + (x-1)*bpp,
+					     bpp); --x)
+	       ;
+	  *x1 = x;
+     }
+     if (*x1 <= *x0 || *y1 <= *y0)
+	  *x0 = *x1 = *y0 = *y1 = 0;
+}
+
+/* render p as the next frame of the animation */
+static void write_frame(render_params *p, colormap_t colormap)
+{
+     int alpha = anim.delta && !p->eight_bit; /* store alpha channel */
+     int x0, y0, x1, y1, bpp = p->bpp;
+     size_t framebytes = (size_t) p->width * p->height * bpp;
+     render_params q;
+     png_byte fctl[26];
+
+     if (anim.err)
+	  return;
+     if (anim.iframe == 0) {
+	  png_byte actl[8];
+	  anim.width = p->width;
+	  anim.height = p->height;
+	  anim.eight_bit = p->eight_bit;
+	  anim.image = (png_byte *) malloc(framebytes);
+	  if (anim.delta)
+	       anim.prev = (png_byte *) malloc(framebytes);
+	  if (anim.delta || alpha)
+	       anim.region = (png_byte *) malloc((size_t) p->width * p->height
+						 * (alpha ? 4 : bpp));
+	  if (!anim.image || (anim.delta && !anim.prev)
+	      || ((anim.delta || alpha) && !anim.region)
+	      || !(anim.png_ptr = begin_png(anim.fp, &anim.info_ptr, p,
+					    colormap, alpha
+					    ? PNG_COLOR_TYPE_RGB_ALPHA
+					    : PNG_COLOR_TYPE_RGB))) {
+	       anim.err = 1;
+	       return;
+	  }
+	  if (setjmp(png_jmpbuf(anim.png_ptr))) {
+	       anim.err = 1;
+	       return;
+	  }
+	  anim.actl_pos = ftell(anim.fp);
+	  put_uint32(actl, anim.nframes);
+	  put_uint32(actl + 4, 0); /* loop forever */
+	  png_write_chunk(anim.png_ptr, (png_const_bytep) "acTL", actl, 8);
+     }
+     else if (p->width != anim.width || p->height != anim.height
+	      || p->eight_bit != anim.eight_bit
+	      || anim.iframe >= anim.nframes) {
+	  fprintf(stderr, "APNG frames must all be of the same size\n");
+	  anim.err = 1;
+	  return;
+     }
+
+     /* render the whole frame into memory */
+     p->zip = NULL;
+     p->image = anim.image;
+     if (render_rows(p, NULL)) {
+	  anim.err = 1;
+	  return;
+     }
+
+     /* the part of the frame to store, in q (computed only after the
+	setjmp above, so that longjmp cannot clobber it) */
+     memset(&q, 0, sizeof(render_params));
+     q.src = anim.image;
+     x0 = y0 = 0;
+     x1 = p->width;
+     y1 = p->height;
+     if (anim.delta && anim.iframe > 0) {
+	  changed_box(anim.prev, anim.image, p->width, p->height, bpp,
+		      &x0, &y0, &x1, &y1);
+	  if (x1 == x0) /* nothing changed, but a frame can't be empty */
+	       x1 = y1 = 1;
+     }
+     if (alpha || x0 > 0 || y0 > 0 || x1 < p->width || y1 < p->height) {
+	  png_byte *out = anim.region;
+	  int x, y;
+	  for (y = y0; y < y1; ++y)
+	       for (x = x0; x < x1; ++x) {
+		    size_t i = ((size_t) y * p->width + x) * bpp;
+		    if (!alpha) {
+			 memcpy(out, anim.image + i, bpp);
+			 out += bpp;
+		    }
+		    else if (anim.iframe == 0
+			     || memcmp(anim.image + i, anim.prev + i, 3)) {
+			 memcpy(out, anim.image + i, 3);
+			 out[3] = 255;
+			 out += 4;
+		    }
+		    else {
+			 memset(out, 0, 4); /* unchanged: transparent */
+			 out += 4;
+		    }
+	       }
+	  q.src = anim.region;
+     }
+     q.width = x1 - x0;
+     q.height = y1 - y0;
+     q.eight_bit = p->eight_bit;
+     q.bpp = alpha ? 4 : bpp;
+     q.rowbytes = q.width * q.bpp;
+     q.zip = compression->banded ? compression : &anim_compression;
+
+     put_uint32(fctl, anim.seq++);
+     put_uint32(fctl + 4, q.width);
+     put_uint32(fctl + 8, q.height);
+     put_uint32(fctl + 12, x0);
+     put_uint32(fctl + 16, y0);
+     fctl[20] = anim.delay_num >> 8; fctl[21] = anim.delay_num & 0xff;
+     fctl[22] = anim.delay_den >> 8; fctl[23] = anim.delay_den & 0xff;
+     fctl[24] = 0; /* dispose_op: none */
+     fctl[25] = alpha && anim.iframe > 0; /* blend_op: over, or source */
+     if (setjmp(png_jmpbuf(anim.png_ptr))) {
+	  anim.err = 1;
+	  return;
+     }
+     png_write_chunk(anim.png_ptr, (png_const_bytep) "fcTL", fctl, 26);
+
+     if (render_rows(&q, anim.png_ptr)) {
+	  anim.err = 1;
+	  return;
+     }
+     if (anim.delta) {
+	  png_byte *swap = anim.prev;
+	  anim.prev = anim.image;
+	  anim.image = swap;
+     }
+     ++anim.iframe;
+}
+
+/***********************************************************************/
+/* Montages ("contact sheets"): the images of successive writepng calls
+   are the tiles of one image, filled in row by row.  Each row of tiles
+   is rendered into a strip, and the bands of the montage are written
+   as soon as all of their rows are in the strip, so only about one row
+   of tiles is in memory at a time. */
+
+int writepng_montage_begin(const char *filename, int ntiles, int ncols,
+			   int tile_width, int tile_height)
+{
+     if (montage.fp || anim.fp || ntiles < 1
+	 || output_format == WRITEPNG_DZI)
+	  return 1;
+     memset(&montage, 0, sizeof(montage));
+     montage.fp = fopen(filename, "wb");
+     if (montage.fp == NULL) {
+	  perror("Error creating file to write montage in");
+	  return 1;
+     }
+     montage.ntiles = ntiles;
+     montage.tile_width = tile_width;
+     montage.tile_height = tile_height;
+     if (ncols <= 0) {
+	  double side = ceil(sqrt((double) ntiles));
+	  ncols = (int) side;
+     }
+     montage.ncols = MIN(ncols, ntiles);
+     return 0;
+}
+
+/* write the bands of the montage whose rows are all rendered, now that
+   rows 0..avail-1 are, and move the rows still needed to the top of the
+   strip, clearing the rest */
+static void flush_montage(int avail)
+{
+     render_params *q = &montage.sheet;
+     int b1 = avail >= q->height ? montage.nbands
+	  : avail / montage.rows_per_band;
+     int row0;
+
+     montage.avail = avail;
+     if (b1 > montage.b) {
+	  montage.err = render_bands(q, montage.png_ptr,
+				     writepng_get_nthreads(),
+				     montage.rows_per_band, montage.nbands,
+				     montage.b, b1, &montage.adler);
+	  montage.b = b1;
+     }
+     if (avail >= q->height)
+	  return;
+     /* keep the last row written, which the next band is filtered with */
+     row0 = MAX(q->row0, montage.b * montage.rows_per_band - 1);
+     memmove(montage.strip, montage.strip + (row0 - q->row0)
+	     * (size_t) q->rowbytes, (avail - row0) * (size_t) q->rowbytes);
+     memset(montage.strip + (avail - row0) * (size_t) q->rowbytes, 0,
+	    (montage.strip_rows - (avail - row0)) * (size_t) q->rowbytes);
+     q->row0 = row0;
+}
+
+/* set up the montage, given its first tile p (which sets the size of
+   the tiles, unless it was given), returning nonzero on failure */
+static int begin_montage(const render_params *p, colormap_t colormap)
+{
+     render_params *q = &montage.sheet;
+     int nrows = (montage.ntiles + montage.ncols - 1) / montage.ncols;
+
+     if (montage.tile_width <= 0 || montage.tile_height <= 0) {
+	  montage.tile_width = p->width;
+	  montage.tile_height = p->height;
+     }
+     memset(q, 0, sizeof(render_params));
+     q->width = montage.ncols * montage.tile_width;
+     q->height = nrows * montage.tile_height;
+     q->bpp = 3;
+     q->rowbytes = q->width * 3;
+     q->zip = compression->banded ? compression : NULL;
+     montage.rows_per_band = MAX(1, (q->zip ? ZBAND_BYTES : BAND_BYTES)
+				 / q->rowbytes);
+     montage.nbands = (q->height + montage.rows_per_band - 1)
+	  / montage.rows_per_band;
+
+     /* the rows left over from the bands written, and a row of tiles */
+     montage.strip_rows = montage.rows_per_band + montage.tile_height;
+     montage.strip = (png_byte *) calloc(montage.strip_rows, q->rowbytes);
+     montage.tile = (png_byte *) malloc(montage.tile_height * (size_t)
+					montage.tile_width * 3);
+     if (!montage.strip || !montage.tile)
+	  return 1;
+     q->src = montage.strip;
+
+     if (output_format == WRITEPNG_PNG) {
+	  montage.png_ptr = begin_png(montage.fp, &montage.info_ptr, q,
+				      colormap, PNG_COLOR_TYPE_RGB);
+	  return !montage.png_ptr;
+     }
+     if (output_format == WRITEPNG_QOI) {
+	  q->qoi = montage.qoi = (qoi_encoder *) malloc(sizeof(qoi_encoder));
+	  return !q->qoi || qoi_begin(q->qoi, montage.fp, q->width, q->height);
+     }
+     q->raw = montage.fp;
+     if (output_format == WRITEPNG_PPM)
+	  fprintf(montage.fp, "P6\n%d %d\n255\n", q->width, q->height);
+     return 0;
+}
+
+/* render p as the next tile of the montage */
+static void add_tile(render_params *p, colormap_t colormap)
+{
+     int c = montage.itile % montage.ncols, r = montage.itile / montage.ncols;
+     size_t tilebytes = (size_t) p->rowbytes;
+     int k, y0;
+
+     if (montage.err)
+	  return;
+     if (montage.itile == 0)
+	  montage.err = begin_montage(p, colormap);
+     if (!montage.err && (p->width > montage.tile_width
+			  || p->height > montage.tile_height
+			  || montage.itile >= montage.ntiles)) {
+	  fprintf(stderr, "montage tiles must fit in %dx%d pixels\n",
+		  montage.tile_width, montage.tile_height);
+	  montage.err = 1;
+     }
+     if (montage.err)
+	  return;
+
+     p->zip = NULL;
+     p->image = montage.tile;
+     if (render_rows(p, NULL)) {
+	  montage.err = 1;
+	  return;
+     }
+     /* (a smaller tile is at the top left of its place) */
+     y0 = r * montage.tile_height - montage.sheet.row0;
+     for (k = 0; k < p->height; ++k)
+	  memcpy(montage.strip + (y0 + k) * (size_t) montage.sheet.rowbytes
+		 + c * (size_t) montage.tile_width * 3,
+		 montage.tile + k * tilebytes, tilebytes);
+     ++montage.itile;
+     if (c == montage.ncols - 1)
+	  flush_montage((r + 1) * montage.tile_height);
+}
+
+int writepng_montage_end(void)
+{
+     int err = montage.err;
+
+     if (!montage.fp)
+	  return 1;
+     if (montage.itile == 0)
+	  err = 1;
+     else {
+	  /* the last row of tiles may be partial, and if we got fewer
+	     tiles than expected the rest of the montage is blank */
+	  while (!montage.err && montage.avail < montage.sheet.height)
+	       flush_montage(montage.avail + montage.tile_height);
+	  err = err || montage.err;
+	  if (montage.png_ptr)
+	       err = end_png(montage.png_ptr, montage.info_ptr) || err;
+	  if (montage.qoi && !err)
+	       err = qoi_end(montage.qoi);
+     }
+     err = fclose(montage.fp) || err;
+     free(montage.qoi);
+     free(montage.strip);
+     free(montage.tile);
+     memset(&montage, 0, sizeof(montage));
+     return err;
+}
+
+/***********************************************************************/
+/* Uncompressed output: a binary PPM (P6) image, or just the raw RGB
+   pixels, top row first.  Written to stdout, a sequence of these is a
+   stream of video frames, e.g. for ffmpeg.  QOI images are written the
+   same way, only encoded as the rows come. */
+
+static void write_raw(render_params *p, const char *filename)
+{
+     static int stream_width = 0, stream_height = 0;
+     int to_stdout = !strcmp(filename, "-");
+     FILE *fp;
+
+     if (to_stdout) {
+	  fp = stdout_fp ? stdout_fp : stdout;
+	  /* without a header, the frames must all be of the same size */
+	  if (output_format == WRITEPNG_RGB && stream_width
+	      && (p->width != stream_width || p->height != stream_height)) {
+	       fprintf(stderr, "raw frames must all be of the same size "
+		       "(%dx%d, not %dx%d)\n", stream_width, stream_height,
+		       p->width, p->height);
+	       ++write_failures;
+	       return;
+	  }
+	  stream_width = p->width;
+	  stream_height = p->height;
+     }
+     else if (!(fp = fopen(filename, "wb"))) {
+	  perror("Error creating file to write image in");
+	  ++write_failures;
+	  return;
+     }
+
+     p->zip = NULL;
+     if (output_format == WRITEPNG_QOI) {
+	  qoi_encoder *q = (qoi_encoder *) malloc(sizeof(qoi_encoder));
+	  p->qoi = q;
+	  if (!q || qoi_begin(q, fp, p->width, p->height)
+	      || render_rows(p, NULL) || qoi_end(q) || fflush(fp)) {
+	       perror("Error writing image");
+	       ++write_failures;
+	  }
+	  p->qoi = NULL;
+	  free(q);
+     }
+     else {
+	  if (output_format == WRITEPNG_PPM)
+	       fprintf(fp, "P6\n%d %d\n255\n", p->width, p->height);
+	  p->raw = fp;
+	  if (render_rows(p, NULL) || fflush(fp)) {
+	       perror("Error writing image");
+	       ++write_failures;
+	  }
+     }
+     if (!to_stdout && fclose(fp)) {
+	  perror("Error writing image");
+	  ++write_failures;
+     }
+}
+
+/***********************************************************************/
+/* Deep Zoom (DZI) tile pyramids, for viewing huge images in a web
+   browser with a static viewer such as OpenSeadragon.  For an image
+   foo.dzi (a small XML descriptor), level k of the pyramid is the image
+   downsampled by 2^(nlevels-1-k), down to 1x1 pixel at level 0, split
+   into tile_size x tile_size tiles foo_files/k/<column>_<row>.png.
+
+   The rows of the image are streamed through the levels as they are
+   rendered, so the image is never in memory all at once: each level
+   holds one strip of tile_size rows, which is written out as tiles (by
+   all of the threads) when it is full, and averages each pair of its
+   rows (and columns) into a row of the next coarser level. */
+
+static int tile_size = 256;
+
+void writepng_set_tile_size(int size)
+{
+     tile_size = size;
+}
+
+typedef struct {
+     int width, height, nrows; /* nrows: the number of rows received */
+     png_byte *strip; /* the current strip of (up to) tile_size rows */
+     png_byte *pending; /* an even row, to be averaged with the next */
+     png_byte *half; /* a row of the next coarser level */
+} tile_level;
+
+struct tile_pyramid_s {
+     char *dir; /* the foo_files directory */
+     int nlevels;
+     tile_level *levels;
+};
+
+/* write the w x h RGB pixels (top row first) as the PNG file filename,
+   serially, returning nonzero on failure */
+static int write_tile(const char *filename, png_byte *pixels, int w, int h)
+{
+     render_params q;
+     band_buf bb;
+     pngzip_stream zs;
+     png_structp png_ptr;
+     png_infop info_ptr;
+     colormap_t no_colormap = { 0, NULL };
+     uLong adler = 0;
+     FILE *fp;
+     int err;
+
+     memset(&q, 0, sizeof(render_params));
+     q.width = w;
+     q.height = h;
+     q.bpp = 3;
+     q.rowbytes = w * 3;
+     q.zip = compression->banded ? compression : NULL;
+     memset(&bb, 0, sizeof(band_buf));
+     bb.rows = pixels;
+     if (q.zip)
+	  bb.z = (png_byte *) malloc(4 + 2 + pngzip_bound(q.rowbytes, h) + 4);
+     err = init_zstream(&q, &zs) || (q.zip && !bb.z);
+     err = err || (q.zip && compress_band(0, 1, h, NULL, &bb, &zs));
+     pngzip_destroy(&zs);
+     if (!err && (fp = fopen(filename, "wb"))) {
+	  png_ptr = begin_png(fp, &info_ptr, &q, no_colormap,
+			      PNG_COLOR_TYPE_RGB);
+	  if (png_ptr && write_band(png_ptr, &q, &bb, 0, 1, h, h, &adler)) {
+	       png_destroy_write_struct(&png_ptr, &info_ptr);
+	       png_ptr = NULL;
+	  }
+	  err = !png_ptr || end_png(png_ptr, info_ptr);
+	  err = fclose(fp) || err;
+     }
+     else
+	  err = 1;
+     free(bb.z);
+     return err;
+}
+
+typedef struct {
+     const tile_pyramid *t;
+     int level, row; /* the strip: row of tiles at this level */
+     int first, step; /* write tiles first, first+step, ... of the strip */
+     int err;
+} tile_job;
+
+static void *write_tiles(void *data)
+{
+     tile_job *job = (tile_job *) data;
+     const tile_level *l = job->t->levels + job->level;
+     int ncols = (l->width + tile_size - 1) / tile_size;
+     int h = l->nrows - job->row * tile_size, i, y;
+     size_t rowbytes = l->width * (size_t) 3;
+     char *fname;
+     png_byte *buf;
+
+     fname = (char *) malloc(strlen(job->t->dir) + 64);
+     buf = (png_byte *) malloc(tile_size * (size_t) tile_size * 3);
+     job->err = !fname || !buf;
+     for (i = job->first; i < ncols && !job->err; i += job->step) {
+	  int x0 = i * tile_size, w = MIN(tile_size, l->width - x0);
+	  for (y = 0; y < h; ++y)
+	       memcpy(buf + y * (size_t) w * 3, l->strip + y * rowbytes + x0 * 3,
+		      w * 3);
+	  sprintf(fname, "%s/%d/%d_%d.png", job->t->dir, job->level, i,
+		  job->row);
+	  job->err = write_tile(fname, buf, w, h);
+     }
+     free(buf);
+     free(fname);
+     return NULL;
+}
+
+/* write the current strip of level k as tiles, in parallel */
+static int flush_strip(const tile_pyramid *t, int k)
+{
+     const tile_level *l = t->levels + k;
+     int ncols = (l->width + tile_size - 1) / tile_size;
+     int nthreads = MIN(writepng_get_nthreads(), ncols), i, err = 0;
+     tile_job *jobs;
+
+     jobs = (tile_job *) malloc(nthreads * sizeof(tile_job));
+     if (!jobs)
+	  return 1;
+     for (i = 0; i < nthreads; ++i) {
+	  jobs[i].t = t;
+	  jobs[i].level = k;
+	  jobs[i].row = (l->nrows - 1) / tile_size;
+	  jobs[i].first = i;
+	  jobs[i].step = nthreads;
+     }
+#ifdef USE_THREADS
+     if (nthreads > 1) {
+	  pthread_t *threads;
+	  int nstarted = 0;
+	  threads = (pthread_t *) malloc(nthreads * sizeof(pthread_t));
+	  if (threads)
+	       for (; nstarted < nthreads - 1; ++nstarted)
+		    if (pthread_create(&threads[nstarted], NULL, write_tiles,
+				       &jobs[nstarted + 1]))
+			 break;
+	  /* the calling thread writes the tiles of any threads that
+	     couldn't be started, too */
+	  for (i = nstarted + 1; i < nthreads; ++i)
+	       write_tiles(&jobs[i]);
+	  write_tiles(&jobs[0]);
+	  for (i = 0; i < nstarted; ++i)
+	       pthread_join(threads[i], NULL);
+	  free(threads);
+     }
+     else
+#endif
+	  write_tiles(&jobs[0]);
+     for (i = 0; i < nthreads; ++i)
+	  err = err || jobs[i].err;
+     free(jobs);
+     return err;
+}
+
+/* add a row to level k of the pyramid, returning nonzero on failure */
+static int add_tile_row(tile_pyramid *t, int k, const png_byte *row)
+{
+     tile_level *l = t->levels + k;
+     size_t rowbytes = l->width * (size_t) 3;
+     int err = 0;
+
+     memcpy(l->strip + (l->nrows % tile_size) * rowbytes, row, rowbytes);
+     ++l->nrows;
+     if (l->nrows % tile_size == 0 || l->nrows == l->height)
+	  err = flush_strip(t, k);
+
+     /* average each 2x2 block of pixels into the next level, where a
+	last odd row or column is averaged with itself */
+     if (k > 0 && !err) {
+	  if (l->nrows % 2 && l->nrows < l->height)
+	       memcpy(l->pending, row, rowbytes);
+	  else {
+	       const png_byte *r0 = l->nrows % 2 ? row : l->pending;
+	       int x, c, w = t->levels[k-1].width;
+	       for (x = 0; x < w; ++x) {
+		    int x0 = 2*x * 3, x1 = MIN(2*x + 1, l->width - 1) * 3;
+		    for (c = 0; c < 3; ++c)
+			 l->half[x*3 + c] = (r0[x0 + c] + r0[x1 + c]
+					     + row[x0 + c] + row[x1 + c]
+					     + 2) >> 2;
+	       }
+	       err = add_tile_row(t, k - 1, l->half);
+	  }
+     }
+     return err;
+}
+
+static int add_tile_rows(tile_pyramid *t, const png_byte *rows, int nrows)
+{
+     int i;
+     size_t rowbytes = t->levels[t->nlevels - 1].width * (size_t) 3;
+     for (i = 0; i < nrows; ++i)
+	  if (add_tile_row(t, t->nlevels - 1, rows + i * rowbytes))
+	       return 1;
+     return 0;
+}
+
+static int make_dir(const char *dir)
+{
+#if defined(HAVE_SYS_STAT_H) && defined(HAVE_MKDIR)
+     struct stat st;
+     return mkdir(dir, 0777) && (stat(dir, &st) || !S_ISDIR(st.st_mode));
+#else
+     return 1;
+#endif
+}
+
+/* Remove the tiles dir/<column>_<row>.png outside the first ncols x
+   nrows, left by an earlier, bigger pyramid (whose tiles at each level
+   are likewise the first columns and rows). */
+static void remove_stale_tiles(const char *dir, int ncols, int nrows)
+{
+     char *fname = (char *) malloc(strlen(dir) + 64);
+     int row, col, found;
+
+     for (row = 0; fname; ++row) {
+	  found = 0;
+	  for (col = row < nrows ? ncols : 0; ; ++col) {
+	       sprintf(fname, "%s/%d_%d.png", dir, col, row);
+	       if (remove(fname))
+		    break;
+	       found = 1;
+	  }
+	  if (row >= nrows && !found)
+	       break;
+     }
+     free(fname);
+}
+
+/* write the image p as the Deep Zoom image filename (foo.dzi) */
+static void write_dzi(render_params *p, const char *filename)
+{
+     tile_pyramid t;
+     size_t len = strlen(filename);
+     int k, w, h, err = 0, ok = 0;
+     FILE *fp;
+
+     memset(&t, 0, sizeof(tile_pyramid));
+     for (w = p->width, h = p->height, t.nlevels = 1; w > 1 || h > 1;
+	  ++t.nlevels) {
+	  w = (w + 1) / 2;
+	  h = (h + 1) / 2;
+     }
+     t.levels = (tile_level *) calloc(t.nlevels, sizeof(tile_level));
+     t.dir = (char *) malloc(len + 64);
+     if (!t.levels || !t.dir) {
+	  fprintf(stderr, "out of memory for tiles\n");
+	  goto done;
+     }
+     if (len > 4 && !strcmp(filename + len - 4, ".dzi"))
+	  len -= 4;
+     memcpy(t.dir, filename, len);
+     strcpy(t.dir + len, "_files");
+     if (make_dir(t.dir)) {
+	  perror("Error creating directory for tiles");
+	  goto done;
+     }
+     for (k = t.nlevels - 1, w = p->width, h = p->height; k >= 0;
+	  --k, w = (w + 1) / 2, h = (h + 1) / 2) {
+	  tile_level *l = t.levels + k;
+	  l->width = w;
+	  l->height = h;
+	  l->strip = (png_byte *) malloc(MIN(tile_size, h) * (size_t) w * 3);
+	  l->pending = (png_byte *) malloc(w * (size_t) 3);
+	  l->half = (png_byte *) malloc(((w + 1) / 2) * (size_t) 3);
+	  if (!l->strip || !l->pending || !l->half) {
+	       fprintf(stderr, "out of memory for tiles\n");
+	       goto done;
+	  }
+	  sprintf(t.dir + len + 6, "/%d", k);
+	  err = make_dir(t.dir);
+	  if (!err)
+	       remove_stale_tiles(t.dir, (w + tile_size - 1) / tile_size,
+				  (h + tile_size - 1) / tile_size);
+	  t.dir[len + 6] = 0;
+	  if (err) {
+	       perror("Error creating directory for tiles");
+	       goto done;
+	  }
+     }
+     /* ...and the levels beyond ours (of a bigger image) */
+     for (k = t.nlevels; ; ++k) {
+	  int removed;
+	  sprintf(t.dir + len + 6, "/%d", k);
+	  remove_stale_tiles(t.dir, 0, 0);
+	  removed = !remove(t.dir);
+	  t.dir[len + 6] = 0;
+	  if (!removed)
+	       break;
+     }
+
+     p->zip = NULL;
+     p->tiles = &t;
+     if (render_rows(p, NULL)) {
+	  fprintf(stderr, "Error writing tiles in %s\n", t.dir);
+	  goto done;
+     }
+
+     if (!(fp = fopen(filename, "w"))) {
+	  perror("Error creating file to write DZI in");
+	  goto done;
+     }
+     fprintf(fp, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+	     "<Image xmlns=\"http://schemas.microsoft.com/deepzoom/2008\"\n"
+	     "       TileSize=\"%d\" Overlap=\"0\" Format=\"png\">\n"
+	     "  <Size Width=\"%d\" Height=\"%d\"/>\n"
+	     "</Image>\n", tile_size, p->width, p->height);
+     if (fclose(fp))
+	  perror("Error writing DZI file");
+     else
+	  ok = 1;
+
+done:
+     if (!ok)
+	  ++write_failures;
+     for (k = 0; t.levels && k < t.nlevels; ++k) {
+	  free(t.levels[k].strip);
+	  free(t.levels[k].pending);
+	  free(t.levels[k].half);
+     }
+     free(t.levels);
+     free(t.dir);
+}
+
+/***********************************************************************/
+/* Layer cache.  h5topng often renders many images with the same contour
+   and overlay layers (e.g. a sweep of slices or files with a fixed
+   dielectric function), in which case we render the layers just once,
+   as the contour pixels and the overlay values interpolated to each
+   pixel, and only redo the colormapping of the data for each image. */
+
+static int cache_layers = 0;
+static layer_cache lcache;
+
+/* the most memory for the cached layers of an image: a bigger image is
+   rendered band by band as usual (as are its layers) */
+#define MAX_LAYER_CACHE_BYTES (64 * 1048576.0)
+
+/* the overlay range of the cached layers, for any geometry */
+static const REAL *range_overlay = NULL;
+static int range_onx, range_ony;
+static REAL range_min, range_max;
+
+static void clear_layer_cache(void)
+{
+     free(lcache.contour);
+     free(lcache.overlayvals);
+     memset(&lcache, 0, sizeof(layer_cache));
+     range_overlay = NULL;
+}
+
+void writepng_cache_layers(int enable)
+{
+     clear_layer_cache();
+     cache_layers = enable;
+}
+
+int writepng_set_contour_levels(int n, const REAL *levels,
+				const rgba_t *colors)
+{
+     int i, j;
+
+     clear_layer_cache();
+     free(contour_levels.levels);
+     free(contour_levels.rgb);
+     memset(&contour_levels, 0, sizeof(contour_levels));
+     if (n <= 0)
+	  return 0;
+     if (n > 255) /* (the most that the layer cache can distinguish) */
+	  return 1;
+     contour_levels.levels = (REAL *) malloc(n * sizeof(REAL));
+     contour_levels.rgb = (png_byte *) malloc(n * 3);
+     if (!contour_levels.levels || !contour_levels.rgb) {
+	  free(contour_levels.levels);
+	  free(contour_levels.rgb);
+	  contour_levels.levels = NULL;
+	  contour_levels.rgb = NULL;
+	  return 1;
+     }
+     /* insertion sort of the levels, along with their colors */
+     for (i = 0; i < n; ++i) {
+	  png_byte rgb[3];
+	  rgb[0] = PIN(0, colors[i].r, 1) * 255 + 0.5;
+	  rgb[1] = PIN(0, colors[i].g, 1) * 255 + 0.5;
+	  rgb[2] = PIN(0, colors[i].b, 1) * 255 + 0.5;
+	  for (j = i; j > 0 && contour_levels.levels[j-1] > levels[i]; --j) {
+	       contour_levels.levels[j] = contour_levels.levels[j-1];
+	       memcpy(contour_levels.rgb + 3*j, contour_levels.rgb + 3*(j-1),
+		      3);
+	  }
+	  contour_levels.levels[j] = levels[i];
+	  memcpy(contour_levels.rgb + 3*j, rgb, 3);
+     }
+     contour_levels.n = n;
+     return 0;
+}
+
+/* render the layers of p into c, which is cleared */
+static int render_layers(const render_params *p, layer_cache *c)
+{
+     render_params q = *p;
+     render_scratch sc;
+     size_t npix = p->height * (size_t) p->width;
+     int k, err;
+
+     q.eight_bit = 1; /* so that contour_row marks the contours with 255
+			 (or, with several levels, the level) */
+     if (p->mask)
+	  c->contour = (unsigned char *) calloc(npix, 1);
+     if (p->overlay)
+	  c->overlayvals = (REAL *) malloc(npix * sizeof(REAL));
+     err = alloc_scratch(&q, &sc) || (p->mask && !c->contour)
+	  || (p->overlay && !c->overlayvals);
+     for (k = 0; k < p->height && !err; ++k) {
+	  int row = p->height-1 - k, n, n2;
+	  REAL wr;
+	  const col_table *t, *mt, *ot;
+
+	  row_geometry(&q, row, &sc, &n, &n2, &wr, &t, &mt, &ot);
+	  if (p->mask) {
+	       int n3 = PIN(0,n + 1, p->data_height-1);
+	       sample_row(sc.maskvals, p->width, mt,
+			  p->mask + ROW_OFFSET(p, n, p->mnx, p->mny),
+			  p->mask + ROW_OFFSET(p, n3, p->mnx, p->mny), wr);
+	       contour_row(&q, sc.maskvals, sc.mask_prev, k == 0,
+			   c->contour + row * (size_t) p->width);
+	  }
+	  if (p->overlay)
+	       sample_row(c->overlayvals + row * (size_t) p->width,
+			  p->width, ot,
+			  p->overlay + ROW_OFFSET(p, n, p->onx, p->ony),
+			  p->overlay + ROW_OFFSET(p, n2, p->onx, p->ony), wr);
+     }
+     destroy_scratch(&sc);
+     return err;
+}
+
+/* the cached layers for p, rendering them if they have changed, or NULL
+   if they are not cached */
+static const layer_cache *get_layer_cache(const render_params *p)
+{
+     layer_cache key;
+
+     if (!cache_layers || p->source || (!p->mask && !p->overlay)
+	 || p->height * (double) p->width
+	 * ((p->mask ? 1 : 0) + (p->overlay ? sizeof(REAL) : 0))
+	 > MAX_LAYER_CACHE_BYTES)
+	  return NULL;
+
+     memset(&key, 0, sizeof(layer_cache));
+     key.valid = 1;
+     key.mask = p->mask;
+     key.overlay = p->overlay;
+     key.mask_thresh = p->mask_thresh;
+     key.mnx = p->mnx;
+     key.mny = p->mny;
+     key.onx = p->onx;
+     key.ony = p->ony;
+     key.width = p->width;
+     key.height = p->height;
+     key.transpose = p->transpose;
+     key.data_width = p->data_width;
+     key.data_height = p->data_height;
+     key.scalex = p->scalex;
+     key.scaley = p->scaley;
+     key.skewsin = p->skewsin;
+     if (lcache.valid && lcache.mask == key.mask
+	 && lcache.overlay == key.overlay
+	 && lcache.mask_thresh == key.mask_thresh
+	 && lcache.mnx == key.mnx && lcache.mny == key.mny
+	 && lcache.onx == key.onx && lcache.ony == key.ony
+	 && lcache.width == key.width && lcache.height == key.height
+	 && lcache.transpose == key.transpose
+	 && lcache.data_width == key.data_width
+	 && lcache.data_height == key.data_height
+	 && lcache.scalex == key.scalex && lcache.scaley == key.scaley
+	 && lcache.skewsin == key.skewsin)
+	  return &lcache;
+
+     free(lcache.contour);
+     free(lcache.overlayvals);
+     lcache = key;
+     if (render_layers(p, &lcache)) {
+	  free(lcache.contour);
+	  free(lcache.overlayvals);
+	  memset(&lcache, 0, sizeof(layer_cache));
+	  return NULL;
+     }
+     return &lcache;
+}
+
+/***********************************************************************/
+
+/* write the image p in the current output format (and destroy p) */
+static void write_image(render_params *p, char *filename,
+			colormap_t colormap)
+{
+     FILE *fp;
+     png_structp png_ptr;
+     png_infop info_ptr;
+     int err;
+
+     if (anim.fp) { /* add a frame to the animation instead */
+	  write_frame(p, colormap);
+	  destroy_render(p);
+	  return;
+     }
+     if (montage.fp) { /* or a tile to the montage */
+	  add_tile(p, colormap);
+	  destroy_render(p);
+	  return;
+     }
+     if (output_format == WRITEPNG_DZI) {
+	  write_dzi(p, filename);
+	  destroy_render(p);
+	  return;
+     }
+     if (output_format != WRITEPNG_PNG) {
+	  write_raw(p, filename);
+	  destroy_render(p);
+	  return;
+     }
+
+     if (!strcmp(filename, "-"))
+	  fp = stdout_fp ? stdout_fp : stdout;
+     else
+	  fp = fopen(filename, "wb");
+     if (fp == NULL) {
+	  perror("Error creating file to write PNG in");
+	  ++write_failures;
+	  destroy_render(p);
+	  return;
+     }
+     png_ptr = begin_png(fp, &info_ptr, p, colormap, PNG_COLOR_TYPE_RGB);
+
+     /* Write out data, rendering bands of rows in parallel: */
+     if (png_ptr && render_rows(p, png_ptr)) {
+	  png_destroy_write_struct(&png_ptr, &info_ptr);
+	  png_ptr = NULL;
+     }
+     destroy_render(p);
+
+     /* finish and close the file */
+     err = !png_ptr || end_png(png_ptr, info_ptr);
+     err = (strcmp(filename, "-") ? fclose(fp) : fflush(fp)) || err;
+     if (err) {
+	  fprintf(stderr, "Error writing PNG file \"%s\"\n", filename);
+	  ++write_failures;
+     }
+
+     /* that's it */
+}
+
+/* writepng, for data (REAL) or fdata (float) */
+static void write_data(char *filename,
+		       int nx, int ny, int transpose,
+		       REAL skew, REAL scalex, REAL scaley,
+		       REAL *data, const float *fdata,
+		       REAL *mask, REAL mask_thresh,
+		       int mnx, int mny,
+		       REAL *overlay, colormap_t overlay_cmap,
+		       int onx, int ony,
+		       REAL minrange, REAL maxrange,
+		       colormap_t colormap, int eight_bit)
+{
+     render_params p;
+     REAL minoverlay = 0, maxoverlay = 0;
+
+     if (overlay && cache_layers && overlay == range_overlay
+	 && onx == range_onx && ony == range_ony) {
+	  minoverlay = range_min;
+	  maxoverlay = range_max;
+     }
+     else if (overlay) {
+	  int i;
+	  minoverlay = maxoverlay = overlay[0];
+	  for (i = 1; i < onx * ony; ++i) {
+	       if (minoverlay > overlay[i])
+		    minoverlay = overlay[i];
+	       if (maxoverlay < overlay[i])
+		    maxoverlay = overlay[i];
+	  }
+	  if (cache_layers) {
+	       range_overlay = overlay;
+	       range_onx = onx;
+	       range_ony = ony;
+	       range_min = minoverlay;
+	       range_max = maxoverlay;
+	  }
+     }
+
+     if (init_render(&p, nx, ny, transpose, skew, scalex, scaley, data,
+		     mask, mask_thresh, mnx, mny, overlay, overlay_cmap,
+		     onx, ony, minoverlay, maxoverlay,
+		     minrange, maxrange, colormap, eight_bit)) {
+	  fprintf(stderr, "out of memory rendering \"%s\"\n", filename);
+	  ++write_failures;
+	  destroy_render(&p);
+	  return;
+     }
+     p.fdata = fdata;
+     p.layers = get_layer_cache(&p);
+     write_image(&p, filename, colormap);
+}
+
+void writepng(char *filename,
+	      int nx, int ny, int transpose,
+	      REAL skew, REAL scalex, REAL scaley,
+	      REAL * data,
+	      REAL *mask, REAL mask_thresh,
+	      int mnx, int mny,
+	      REAL *overlay, colormap_t overlay_cmap,
+	      int onx, int ony,
+	      REAL minrange, REAL maxrange,
+	      colormap_t colormap, int eight_bit)
+{
+     write_data(filename, nx, ny, transpose, skew, scalex, scaley,
+		data, NULL, mask, mask_thresh, mnx, mny,
+		overlay, overlay_cmap, onx, ony,
+		minrange, maxrange, colormap, eight_bit);
+}
+
+void writepng_float(char *filename,
+		    int nx, int ny, int transpose,
+		    REAL skew, REAL scalex, REAL scaley,
+		    const float *data,
+		    REAL *mask, REAL mask_thresh,
+		    int mnx, int mny,
+		    REAL *overlay, colormap_t overlay_cmap,
+		    int onx, int ony,
+		    REAL minrange, REAL maxrange,
+		    colormap_t colormap, int eight_bit)
+{
+     write_data(filename, nx, ny, transpose, skew, scalex, scaley,
+		NULL, data, mask, mask_thresh, mnx, mny,
+		overlay, overlay_cmap, onx, ony,
+		minrange, maxrange, colormap, eight_bit);
+}
+
+void writepng_stream(char *filename, int nx, int ny,
+		     REAL skew, REAL scalex, REAL scaley,
+		     writepng_read_rows read_rows, void *ctx, int max_rows,
+		     int have_mask, REAL mask_thresh,
+		     int have_overlay, colormap_t overlay_cmap,
+		     REAL minoverlay, REAL maxoverlay,
+		     REAL minrange, REAL maxrange,
+		     colormap_t colormap, int eight_bit)
+{
+     static REAL unread[1]; /* stands in for the rows until they are read */
+     render_params p;
+     row_source src;
+
+     src.read_rows = read_rows;
+     src.ctx = ctx;
+     src.max_rows = max_rows;
+     if (init_render(&p, nx, ny, 0, skew, scalex, scaley, unread,
+		     have_mask ? unread : NULL, mask_thresh, nx, ny,
+		     have_overlay ? unread : NULL, overlay_cmap, nx, ny,
+		     minoverlay, maxoverlay,
+		     minrange, maxrange, colormap, eight_bit)) {
+	  fprintf(stderr, "out of memory rendering \"%s\"\n", filename);
+	  ++write_failures;
+	  destroy_render(&p);
+	  return;
+     }
+     p.source = &src;
+     write_image(&p, filename, colormap);
 }
 
 /* In the following code, we use a heuristic algorithm to compute
@@ -23,6 +23,10 @@
 #ifndef WRITEPNG_H
 #define WRITEPNG_H
 
+#include <stdio.h>
+
+#include "libnames.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif /* __cplusplus */
@@ -44,6 +48,8 @@ typedef struct {
      rgba_t *rgba;
 } colormap_t;
 
+/* Write the image of data to filename ("-" for stdout), in the
+   current output format (see writepng_set_format). */
 void writepng(char *filename,
 	      int nx, int ny, int transpose,
 	      REAL skew, REAL scalex, REAL scaley,
@@ -54,6 +60,19 @@ void writepng(char *filename,
 	      REAL minrange, REAL maxrange,
 	      colormap_t colormap, int eight_bit);
 
+/* Like writepng, but for single-precision data, which is read as is
+   rather than first converted to REAL. */
+void writepng_float(char *filename,
+		    int nx, int ny, int transpose,
+		    REAL skew, REAL scalex, REAL scaley,
+		    const float *data,
+		    REAL *mask, REAL mask_thresh,
+		    int mnx, int mny,
+		    REAL *overlay, colormap_t overlay_cmap,
+		    int onx, int ony,
+		    REAL minrange, REAL maxrange,
+		    colormap_t colormap, int eight_bit);
+
 void writepng_autorange(char *filename,
 			int nx, int ny, int transpose,
 			REAL skew, REAL scalex, REAL scaley,
@@ -61,6 +80,109 @@ void writepng_autorange(char *filename,
 			REAL *overlay, colormap_t overlay_cmap,
 			colormap_t colormap, int eight_bit);
 
+/* Reads the nx x ny data (not transposed) rows n0..n1-1 into data, and
+   likewise the mask and overlay (each nx x ny, like the data) if they
+   are not NULL.  Returns nonzero on failure. */
+typedef int (*writepng_read_rows)(void *ctx, int n0, int n1, REAL *data,
+				  REAL *mask, REAL *overlay);
+
+/* Like writepng, but without the whole data in memory: the rows are
+   read by read_rows as they are needed, about max_rows at a time (or
+   more if the scaling requires it).  The overlay range must be given,
+   since it cannot be computed in advance. */
+void writepng_stream(char *filename, int nx, int ny,
+		     REAL skew, REAL scalex, REAL scaley,
+		     writepng_read_rows read_rows, void *ctx, int max_rows,
+		     int have_mask, REAL mask_thresh,
+		     int have_overlay, colormap_t overlay_cmap,
+		     REAL minoverlay, REAL maxoverlay,
+		     REAL minrange, REAL maxrange,
+		     colormap_t colormap, int eight_bit);
+
+/* the number of images that could not be written so far (for which an
+   error was printed on stderr); errors in the images of an animation or
+   montage are returned by writepng_anim_end or writepng_montage_end */
+int writepng_failures(void);
+
+/* number of threads used to render each image (default, or <= 0: all
+   available processors) */
+void writepng_set_nthreads(int nthreads);
+int writepng_get_nthreads(void);
+
+/* Whether to keep the rendered mask contours and overlay from one image
+   to the next, for as long as the mask and overlay arrays (identified by
+   their pointers) and the image geometry stay the same (default: no).
+   Every call discards the kept layers, so call it again whenever the
+   contents of those arrays change.  (The layers of very big images are
+   not kept.) */
+void writepng_cache_layers(int enable);
+
+/* Contour the mask (see writepng) at each of the n levels, in the
+   corresponding colors, rather than just at mask_thresh in black or
+   white (if n <= 0, go back to that); an image with such contours is
+   always in direct color.  Returns nonzero if out of memory or if there
+   are more than 255 levels. */
+int writepng_set_contour_levels(int n, const REAL *levels,
+				const rgba_t *colors);
+
+/* PNG compression settings: a comma-separated list of presets (fastest,
+   fast, default, small, smallest), zlib levels (0-9), filters (none,
+   sub, up, avg, paeth, adaptive) and zlib strategies (filtered, huffman,
+   rle, fixed).  Except for "default" (libpng's own compression), bands
+   of rows are compressed in parallel.  Returns nonzero if spec is
+   invalid. */
+int writepng_set_compression(const char *spec);
+
+/* Output formats: PNG (the default), binary PPM (P6), or just the raw
+   8-bit RGB pixels (top row first).  The latter two are uncompressed,
+   always use direct color, and are mainly useful for streaming frames
+   to stdout. */
+#define WRITEPNG_PNG 0
+#define WRITEPNG_PPM 1
+#define WRITEPNG_RGB 2
+/* A Deep Zoom tile pyramid for web viewers: for an image foo.dzi, the
+   XML descriptor foo.dzi and the PNG tiles foo_files/<level>/<x>_<y>.png,
+   of writepng_set_tile_size pixels square (default 256). */
+#define WRITEPNG_DZI 3
+/* The "Quite OK Image" format (qoiformat.org): lossless like PNG, and
+   usually somewhat larger, but much faster to write. */
+#define WRITEPNG_QOI 4
+void writepng_set_format(int format);
+void writepng_set_tile_size(int size);
+
+/* Write the images for the filename "-" to fp rather than to stdout
+   (or to stdout again, if fp is NULL). */
+void writepng_set_stdout(FILE *fp);
+
+/* the width and height in pixels of the image that writepng would
+   write for the given size and scaling of the data */
+void writepng_image_size(int nx, int ny, int transpose,
+			 REAL skew, REAL scalex, REAL scaley,
+			 int *width, int *height);
+
+/* Write the images of subsequent writepng calls (ignoring their
+   filenames) as the nframes frames of an animated PNG (APNG) file,
+   shown at fps frames per second, until writepng_anim_end is called.
+   The frames must all have the same size.  If delta, each frame after
+   the first only stores the pixels that changed.  Both return nonzero
+   on failure. */
+int writepng_anim_begin(const char *filename, int nframes, double fps,
+			int delta);
+int writepng_anim_end(void);
+
+/* Write the images of subsequent writepng calls (ignoring their
+   filenames) as the ntiles tiles of a single image, a "contact sheet"
+   ncols tiles wide (or about square if ncols <= 0), filled row by row,
+   until writepng_montage_end is called; the image is in the current
+   output format (which must not be DZI).  The tiles are tile_width x
+   tile_height pixels (or if either is <= 0, the size of the first), and
+   a smaller image is put at the top left of its tile, with the rest
+   black.  Only about one row of tiles is kept in memory.  Both return
+   nonzero on failure. */
+int writepng_montage_begin(const char *filename, int ntiles, int ncols,
+			   int tile_width, int tile_height);
+int writepng_montage_end(void);
+
 /***********************************************************************/
 
 #ifdef __cplusplus